@@ -0,0 +1,84 @@
+// Command completion benchmark: fills a temporary PATH with N executables
+// spread over several directories, then times the initial index build,
+// a full completion (every match for a prefix, as readline asks for it)
+// and a refresh after one directory changed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../src/builtins.h"
+#include "../src/complete.h"
+#include "../src/vars.h"
+
+#define NDIRS 20
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Ask for every completion of prefix. Returns the number of matches.
+static int complete_all(const char *prefix) {
+    int n = 0;
+    char *m;
+    while ((m = complete_command(prefix, n)) != NULL) {
+        free(m);
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int nfiles = argc > 1 ? atoi(argv[1]) : 6000;
+    char root[] = "/tmp/complete_benchXXXXXX";
+    char path[NDIRS * 64] = "";
+    char file[256];
+
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    for (int d = 0; d < NDIRS; d++) {
+        snprintf(file, sizeof(file), "%s/bin%d", root, d);
+        mkdir(file, 0755);
+        strcat(path, d ? ":" : "");
+        strcat(path, file);
+    }
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(file, sizeof(file), "%s/bin%d/tool%05d", root, i % NDIRS, i);
+        close(open(file, O_CREAT | O_WRONLY, 0755));
+    }
+    // Only the shell's own $PATH; system() below still sees the real one
+    var_set("PATH", path, VAR_EXPORT);
+    builtins_init();
+
+    double t0 = now();
+    complete_init();
+    int all = complete_all("");
+    double build = now() - t0;
+
+    int rounds = 1000, found = 0;
+    t0 = now();
+    for (int i = 0; i < rounds; i++) found += complete_all("tool01");
+    double query = (now() - t0) / rounds;
+
+    // A new program in one directory: only that one is read again
+    snprintf(file, sizeof(file), "%s/bin3/tool_new", root);
+    close(open(file, O_CREAT | O_WRONLY, 0755));
+    t0 = now();
+    int after = complete_all("tool_n");
+    double rescan = now() - t0;
+
+    printf("%d executables in %d PATH directories (%d names with builtins)\n", nfiles, NDIRS, all);
+    printf("  initial build + first completion: %8.3f ms\n", build * 1e3);
+    printf("  complete 'tool01' (%d matches):  %8.3f ms\n", found / rounds, query * 1e3);
+    printf("  after adding one program:         %8.3f ms (%d match)\n", rescan * 1e3, after);
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    return system(cmd) != 0;
+}
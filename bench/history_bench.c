@@ -0,0 +1,69 @@
+// History store benchmark: writes N commands to a temporary history file
+// through histstore_add(), then times what an interactive shell pays for
+// it: opening the file and loading the Up/Down window at startup,
+// indexing every record on the first Ctrl-R, and a reverse search that
+// has to look at every record.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/histstore.h"
+#include "../src/vars.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    char path[] = "/tmp/history_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+    var_set("HISTFILE", path, 0);
+
+    double t0 = now();
+    histstore_init(HISTORY_WINDOW);
+    char line[128];
+    for (long i = 0; i < n; i++) {
+        snprintf(line, sizeof(line), "make -C build/target%ld -j8 && ./run --case %ld", i % 977, i);
+        histstore_add(line);
+    }
+    double write = now() - t0;
+
+    // What a new shell does with the file
+    t0 = now();
+    histstore_init(HISTORY_WINDOW);
+    double startup = now() - t0;
+
+    t0 = now();
+    long total = histstore_index();
+    double index = now() - t0;
+
+    t0 = now();
+    histstore_search_start();
+    long miss = histstore_search("no such command", total - 1);
+    double scan = now() - t0;
+
+    t0 = now();
+    histstore_search_start();
+    long hit = histstore_search("--case 99999", total - 1);
+    double recent = now() - t0;
+
+    printf("%ld commands, %ld indexed\n", n, total);
+    printf("  append:                 %8.3f us/command\n", write / n * 1e6);
+    printf("  startup (load %d):    %8.3f ms\n", HISTORY_WINDOW, startup * 1e3);
+    printf("  first Ctrl-R (index):   %8.3f ms\n", index * 1e3);
+    printf("  search, no match:       %8.3f ms\n", scan * 1e3);
+    printf("  search, recent match:   %8.3f ms  (%s)\n", recent * 1e3, hit >= 0 ? histstore_text(hit) : "none");
+
+    unlink(path);
+    return miss != -1;
+}
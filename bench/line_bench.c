@@ -0,0 +1,125 @@
+// Line-processing microbenchmark: the work the shell does on every command
+// line before anything is launched. Each line is parsed, each simple
+// command's words are expanded, and the first word is checked for an alias
+// (spliced and parsed again on a hit, like the executor does). Reports the
+// cost per line of each step; `-j` prints the numbers as JSON members for
+// bench/run.sh.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/arena.h"
+#include "../src/ast.h"
+#include "../src/parser.h"
+#include "../src/expand.h"
+#include "../src/symtab.h"
+#include "../src/builtins.h"
+#include "../src/vars.h"
+
+static const char *lines[] = {
+    "ls -l /usr/bin | grep -v '^d' | sort -k5 -n | tail -20 > /tmp/out.txt",
+    "ll \"$HOME/src\" && echo done || echo failed",
+    "gs --short",
+    "cat <input.txt|tr a-z A-Z|uniq -c 2>errors.log",
+    "echo a\\ b 'c d' \"e $HOME g\" ~/file $? # trailing comment",
+    "printf '%s %d\\n' item 42 > /dev/null",
+    "[ -d /tmp ] && true",
+};
+#define NUM_LINES (sizeof(lines) / sizeof(lines[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What resolve_command() does for one command: look the first word up
+// straight from its span and, for an alias, parse the spliced text.
+static struct Node *resolve(struct Node *n, struct Arena *arena) {
+    if (n->cmd.argc == 0) return n;
+    struct Symbol *sym = sym_lookupn(n->cmd.argv[0].text, n->cmd.argv[0].len);
+    if (!sym || !sym->alias) return n;
+
+    const char *rest = n->cmd.argv[0].text + n->cmd.argv[0].len;
+    size_t vlen = strlen(sym->alias), rlen = strlen(rest);
+    char *text = arena_alloc(arena, vlen + rlen + 2);
+    memcpy(text, sym->alias, vlen);
+    text[vlen] = ' ';
+    memcpy(text + vlen + 1, rest, rlen + 1);
+    int status;
+    struct Node *r = parse_line(text, arena, &status);
+    return r ? r : n;
+}
+
+// Run the steps up to `depth` (1 parse, 2 expand, 3 alias) on every
+// simple command of the tree.
+static size_t walk(struct Node *n, int depth, struct Arena *arena) {
+    size_t words = 0;
+    if (!n) return 0;
+    switch (n->type) {
+    case NODE_COMMAND:
+        if (depth >= 3) n = resolve(n, arena);
+        if (n->type != NODE_COMMAND) return walk(n, depth, arena);
+        if (depth >= 2) {
+            char **argv = expand_words(n->cmd.argv, n->cmd.argc, arena);
+            while (argv[words]) words++;
+        }
+        return words + 1;
+    case NODE_PIPELINE:
+        for (int i = 0; i < n->pipe.n; i++) words += walk(n->pipe.stages[i], depth, arena);
+        return words;
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQ:
+        return walk(n->pair.left, depth, arena) + walk(n->pair.right, depth, arena);
+    default:
+        return walk(n->sub.body, depth, arena);
+    }
+}
+
+static double run(int depth, int count, int rounds, size_t *sink) {
+    struct Arena arena = {0};
+    double best = 1e9;
+    for (int r = 0; r < rounds; r++) {
+        double t0 = now();
+        for (int i = 0; i < count; i++) {
+            struct ArenaMark mark = arena_mark(&arena);
+            int status;
+            *sink += walk(parse_line(lines[i % NUM_LINES], &arena, &status), depth, &arena);
+            arena_release(&arena, mark);
+        }
+        double dt = now() - t0;
+        if (dt < best) best = dt;
+    }
+    return best / count * 1e9;
+}
+
+int main(int argc, char **argv) {
+    int json = argc > 1 && strcmp(argv[1], "-j") == 0;
+    int count = argc > 1 + json ? atoi(argv[1 + json]) : 200000;
+    int rounds = 5;
+    size_t sink = 0;
+
+    builtins_init();
+    char *alias_args[] = { "alias", "ll=ls -alF", "gs=git status", NULL };
+    shell_alias(alias_args);
+    var_set("HOME", "/home/bench", VAR_EXPORT);
+
+    double parse = run(1, count, rounds, &sink);
+    double expand = run(2, count, rounds, &sink) - parse;
+    double total = run(3, count, rounds, &sink);
+    double alias = total - parse - expand;
+
+    if (json) {
+        printf("\"line_total_ns\": %.1f\n\"line_parse_ns\": %.1f\n"
+               "\"line_expand_ns\": %.1f\n\"line_alias_ns\": %.1f\n",
+               total, parse, expand, alias);
+    } else {
+        printf("line processing: %d lines (best of %d)\n", count, rounds);
+        printf("  parse:  %8.1f ns/line\n", parse);
+        printf("  expand: %8.1f ns/line\n", expand);
+        printf("  alias:  %8.1f ns/line\n", alias);
+        printf("  total:  %8.1f ns/line  (%.0f lines/s)\n", total, 1e9 / total);
+    }
+    return sink == 0;
+}
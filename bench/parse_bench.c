@@ -0,0 +1,68 @@
+// Parse-throughput microbenchmark: generates a large script in memory and
+// times lexing + AST construction over it, without executing anything.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/arena.h"
+#include "../src/ast.h"
+#include "../src/parser.h"
+
+static const char *templates[] = {
+    "ls -l /usr/bin | grep -v '^d' | sort -k5 -n | tail -20 > /tmp/out.txt",
+    "export PATH=\"$HOME/bin:$PATH\" && echo done || echo failed",
+    "alias ll='ls -alF'",
+    "cat <input.txt|tr a-z A-Z|uniq -c 2>errors.log&",
+    "(cd /tmp; make -j8 all) &> build.log; echo $? ",
+    "grep -rn \"pattern with spaces\" src/*.c include/*.h | cut -d: -f1 | sort -u",
+    "echo a\\ b 'c d' \"e $f g\" ~/file # trailing comment",
+};
+#define NUM_TEMPLATES (sizeof(templates) / sizeof(templates[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 200000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    // One big buffer of NUL-separated lines, like a script read into memory
+    size_t total = 0;
+    for (int i = 0; i < lines; i++) total += strlen(templates[i % NUM_TEMPLATES]) + 1;
+    char *script = malloc(total);
+    char *p = script;
+    for (int i = 0; i < lines; i++) {
+        size_t n = strlen(templates[i % NUM_TEMPLATES]) + 1;
+        memcpy(p, templates[i % NUM_TEMPLATES], n);
+        p += n;
+    }
+
+    struct Arena arena = {0};
+    size_t nodes = 0;
+    double best = 1e9;
+    for (int r = 0; r < rounds; r++) {
+        double t0 = now();
+        p = script;
+        for (int i = 0; i < lines; i++) {
+            struct ArenaMark mark = arena_mark(&arena);
+            int status;
+            struct Node *n = parse_line(p, &arena, &status);
+            if (status != PARSE_OK) {
+                fprintf(stderr, "parse error in: %s\n", p);
+                return 1;
+            }
+            nodes += n != NULL;
+            arena_release(&arena, mark);
+            p += strlen(p) + 1;
+        }
+        double dt = now() - t0;
+        if (dt < best) best = dt;
+    }
+
+    printf("parse: %d lines, %.2f MB in %.3f s (best of %d): %.0f lines/s, %.1f MB/s\n",
+           lines, total / 1e6, best, rounds, lines / best, total / 1e6 / best);
+    return nodes == 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Pushes MB megabytes of zeros through `head | cat | cat | cat` with the
+# pipes between the stages at several capacities (@pipesize), then in
+# packet mode and through a splice relay, and reports the throughput and
+# the context switches the pipeline made (from the shell's own `time`).
+# The kernel default is 64K; larger pipes mostly show up as fewer
+# switches, and as throughput once the stages have cores of their own.
+#
+#   usage: bench/pipe_bench.sh [megabytes] [path/to/myshell]
+
+MB=${1:-1024}
+SHELL_BIN=${2:-./myshell}
+
+# run LABEL PREFIX: one pipeline, best of three
+run() {
+    best=
+    for i in 1 2 3; do
+        out=$("$SHELL_BIN" --norc -c "time $2 head -c ${MB}M /dev/zero | cat | cat | cat > /dev/null" 2>&1)
+        t=$(echo "$out" | awk '$1 == "real" { split($2, a, "m"); sub(/s/, "", a[2]); print a[1] * 60 + a[2] }')
+        sw=$(echo "$out" | awk '$1 == "ctxsw" { print $2 + $4 }')
+        if [ -z "$best" ] || awk -v t="$t" -v b="$best" 'BEGIN { exit !(t < b) }'; then
+            best=$t
+            best_sw=$sw
+        fi
+    done
+    awk -v l="$1" -v t="$best" -v m="$MB" -v sw="$best_sw" \
+        'BEGIN { printf "  %-16s %8.1f MB/s  %8d switches\n", l, m * 1.048576 / t, sw }'
+}
+
+echo "pipes: ${MB}M through 4 stages"
+for size in 64K 256K 1M; do
+    run "pipesize=$size" "@pipesize=$size"
+done
+run "packet" "@packet"
+run "relay, 1M" "@relay @pipesize=1M"
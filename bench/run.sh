@@ -0,0 +1,180 @@
+#!/bin/sh
+# Benchmark harness behind `make bench`. Measures the shell's hot paths:
+#
+#   line_*_ns        parse + expand + alias work per command line (line_bench)
+#   fork_exec_us     launching and waiting for one external command
+#   pipeline_N_MBps  throughput of `head -c ... /dev/zero | cat | ... > /dev/null`
+#                    with N stages
+#   rc_startup_ms    starting with a 300-line rc file and exiting
+#   restore_startup_ms  the same state from `myshell --restore` (myshell only)
+#   script_10k_ms    a 10k-line script, end to end
+#   loop_100k_ms     a while loop counting to 100000 with [ ] and $((...))
+#
+# Results are written as flat JSON ("shell.metric": value), compared with a
+# baseline and, for the shell-level numbers, with dash and bash when they
+# are installed. Metrics ending in _ns, _us or _ms are better lower; the
+# rest better higher; changes over 10% are flagged. Each number is the
+# best of ROUNDS runs.
+#
+#   usage: bench/run.sh [-o results.json] [-b baseline.json] [-r rounds]
+#
+# Refresh the checked-in baseline with `make bench-baseline`.
+
+cd "$(dirname "$0")/.." || exit 1
+OUT=bench/results.json
+BASELINE=bench/baseline.json
+ROUNDS=3
+while getopts o:b:r: opt; do
+    case $opt in
+    o) OUT=$OPTARG ;;
+    b) BASELINE=$OPTARG ;;
+    r) ROUNDS=$OPTARG ;;
+    *) exit 2 ;;
+    esac
+done
+
+MYSHELL=$(pwd)/myshell
+PIPE_MB=${PIPE_MB:-256}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+RESULTS=$TMP/results
+
+now() {
+    date +%s.%N
+}
+
+# best CMD...: the shortest wall time of ROUNDS runs, in seconds
+best() {
+    b=
+    i=0
+    while [ $i -lt "$ROUNDS" ]; do
+        start=$(now)
+        "$@" > /dev/null 2>&1
+        end=$(now)
+        b=$(awk -v a="$start" -v z="$end" -v b="$b" 'BEGIN { t = z - a; print (b == "" || t < b) ? t : b }')
+        i=$((i + 1))
+    done
+    echo "$b"
+}
+
+# record NAME VALUE
+record() {
+    printf '"%s": %s\n' "$1" "$2" >> "$RESULTS"
+}
+
+# ---- inputs, shared by every shell ----
+
+FORKS=1000
+awk -v n=$FORKS 'BEGIN { for (i = 0; i < n; i++) print "/bin/true" }' > "$TMP/fork.sh"
+
+# An rc file of aliases, exports and cheap builtins
+mkdir "$TMP/home"
+awk 'BEGIN {
+    for (i = 0; i < 100; i++) {
+        printf "alias a%d='"'"'ls -l --color=auto dir%d'"'"'\n", i, i
+        printf "export BENCH_VAR%d=/opt/tool%d/bin\n", i, i
+        printf "[ -d /tmp ] && echo rc line %d > /dev/null\n", i
+    }
+}' > "$TMP/home/.myshellrc"
+
+# Only what myshell, dash and bash all run the same way
+awk 'BEGIN {
+    for (i = 0; i < 10000; i++) {
+        if (i % 100 == 0)     print "/bin/true"
+        else if (i % 5 == 0)  printf "echo line %d | cat > /dev/null\n", i
+        else if (i % 5 == 1)  printf "[ %d -lt 5000 ] && true || false\n", i
+        else if (i % 5 == 2)  printf "printf '"'"'%%s %%d\\n'"'"' item %d > /dev/null\n", i
+        else if (i % 5 == 3)  printf "echo \"$HOME\" '"'"'x %d'"'"' > /dev/null\n", i
+        else                  print "cd /tmp && pwd > /dev/null"
+    }
+}' > "$TMP/script.sh"
+
+pipeline() {
+    cmd="head -c ${PIPE_MB}M /dev/zero"
+    s=1
+    while [ $s -lt "$1" ]; do
+        cmd="$cmd | cat"
+        s=$((s + 1))
+    done
+    echo "$cmd > /dev/null"
+}
+
+# ---- measurements ----
+
+bench_shell() {
+    name=$1
+    sh=$2
+    # rc files are read by myshell itself; the others source it
+    if [ "$name" = myshell ]; then
+        run_rc() { HOME="$TMP/home" "$sh" -c true; }
+        run_sh() { HOME="$TMP/home" "$sh" --norc "$@"; }
+    else
+        run_rc() { HOME="$TMP/home" "$sh" -c ". $TMP/home/.myshellrc"; }
+        run_sh() { HOME="$TMP/home" "$sh" "$@"; }
+    fi
+
+    t=$(best run_sh "$TMP/fork.sh")
+    record "$name.fork_exec_us" "$(awk -v t="$t" -v n=$FORKS 'BEGIN { printf "%.1f", t / n * 1e6 }')"
+    for stages in 2 4 8; do
+        t=$(best run_sh -c "$(pipeline $stages)")
+        record "$name.pipeline_${stages}_MBps" "$(awk -v t="$t" -v m="$PIPE_MB" 'BEGIN { printf "%.1f", m * 1.048576 / t }')"
+    done
+    t=$(best run_rc)
+    record "$name.rc_startup_ms" "$(awk -v t="$t" 'BEGIN { printf "%.2f", t * 1e3 }')"
+    if [ "$name" = myshell ]; then
+        HOME="$TMP/home" "$sh" -c "snapshot save $TMP/rc.snap"
+        t=$(best "$sh" --restore "$TMP/rc.snap" -c true)
+        record "$name.restore_startup_ms" "$(awk -v t="$t" 'BEGIN { printf "%.2f", t * 1e3 }')"
+    fi
+    t=$(best run_sh "$TMP/script.sh")
+    record "$name.script_10k_ms" "$(awk -v t="$t" 'BEGIN { printf "%.1f", t * 1e3 }')"
+    t=$(best run_sh -c 'i=0; while [ $i -lt 100000 ]; do i=$((i + 1)); done')
+    record "$name.loop_100k_ms" "$(awk -v t="$t" 'BEGIN { printf "%.1f", t * 1e3 }')"
+}
+
+./bench/line_bench -j | sed 's/^"/"myshell./' >> "$RESULTS"
+bench_shell myshell "$MYSHELL"
+for other in dash bash; do
+    path=$(command -v $other) && bench_shell $other "$path"
+done
+
+awk 'BEGIN { print "{" } NR > 1 { print prev "," } { prev = "  " $0 } END { print prev; print "}" }' \
+    "$RESULTS" > "$OUT"
+
+# ---- report ----
+
+# Nothing to compare with when writing the baseline itself
+if [ ! -f "$BASELINE" ] || [ "$BASELINE" -ef "$OUT" ]; then
+    BASELINE=/dev/null
+fi
+awk -v baseline="$BASELINE" '
+function value(line) { sub(/.*: /, "", line); sub(/,$/, "", line); return line + 0 }
+function key(line) { sub(/^ *"/, "", line); sub(/".*/, "", line); return line }
+FILENAME == baseline { if ($0 ~ /":/) base[key($0)] = value($0); next }
+/":/ {
+    k = key($0); split(k, parts, "."); sh = parts[1]; m = parts[2]
+    val[sh, m] = value($0)
+    if (!(m in seen)) { seen[m] = 1; order[++n] = m }
+    if (sh != "myshell") others[sh] = 1
+}
+END {
+    printf "%-22s %12s", "metric", "myshell"
+    for (o in others) printf " %12s", o
+    printf " %12s %10s\n", "baseline", "change"
+    for (i = 1; i <= n; i++) {
+        m = order[i]; cur = val["myshell", m]
+        printf "%-22s %12g", m, cur
+        for (o in others) {
+            if ((o, m) in val) printf " %12g", val[o, m]
+            else printf " %12s", "-"
+        }
+        if (("myshell." m) in base && base["myshell." m] > 0) {
+            b = base["myshell." m]
+            pct = (cur - b) / b * 100
+            better = m ~ /_(ns|us|ms)$/ ? pct < 0 : pct > 0
+            printf " %12g %+9.1f%%%s", b, pct, (pct > 10 || pct < -10) ? (better ? " better" : " WORSE") : ""
+        }
+        printf "\n"
+    }
+}' "$BASELINE" "$OUT"
+echo "results: $OUT"
@@ -0,0 +1,55 @@
+// Command-name lookup microbenchmark: defines N aliases through the real
+// `alias` builtin, then times the lookups the executor does for every
+// command (alias check + builtin check) on a mix of alias hits, builtins
+// and external names. The cost per lookup should not grow with N.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/builtins.h"
+#include "../src/symtab.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int lookups = argc > 1 ? atoi(argv[1]) : 2000000;
+    static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+    builtins_init();
+
+    // Names a command line typically starts with
+    char names[64][32];
+    for (int i = 0; i < 64; i++) {
+        switch (i % 4) {
+        case 0: snprintf(names[i], sizeof(names[i]), "al%d", i * 7); break;
+        case 1: snprintf(names[i], sizeof(names[i]), "%s", builtin_str[i % shell_num_builtins()]); break;
+        case 2: snprintf(names[i], sizeof(names[i]), "ls"); break;
+        default: snprintf(names[i], sizeof(names[i]), "cmd%d", i); break;
+        }
+    }
+
+    int defined = 0;
+    size_t found = 0;
+    printf("%10s %12s %14s\n", "aliases", "ns/lookup", "lookups/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (; defined < sizes[s]; defined++) {
+            char def[64];
+            snprintf(def, sizeof(def), "al%d=echo alias number %d", defined, defined);
+            char *args[] = { "alias", def, NULL };
+            shell_alias(args);
+        }
+
+        double t0 = now();
+        for (int i = 0; i < lookups; i++) {
+            const char *name = names[i & 63];
+            found += resolve_alias(name) != NULL || is_builtin(name);
+        }
+        double dt = now() - t0;
+        printf("%10d %12.1f %14.0f\n", defined, dt / lookups * 1e9, lookups / dt);
+    }
+    return found == 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Runs a generated script of 10k iterations over the hot utilities (echo,
+# printf, test/[, true, false, pwd, basename, dirname) twice: once with
+# the in-process builtins and once with every call prefixed by `command`,
+# which forces the external binaries (the behaviour before the builtins).
+#
+#   usage: bench/utils_bench.sh [iterations] [path/to/myshell]
+
+ITER=${1:-10000}
+SHELL_BIN=${2:-./myshell}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+gen() {
+    awk -v n="$ITER" -v p="$1" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "%secho line %d > /dev/null\n", p, i
+            printf "%sprintf '"'"'%%s %%d\\n'"'"' item %d > /dev/null\n", p, i
+            printf "%s[ %d -lt 5000 ] && %strue || %sfalse\n", p, i, p, p
+            printf "%stest -d /tmp\n", p
+            printf "%sbasename /usr/lib/file%d.so .so > /dev/null\n", p, i
+            printf "%sdirname /usr/lib/file%d.so > /dev/null\n", p, i
+            printf "%spwd > /dev/null\n", p
+        }
+    }'
+}
+
+now() {
+    date +%s.%N
+}
+
+run() {
+    start=$(now)
+    echo "source $1" | HOME="$TMP" "$SHELL_BIN" > /dev/null 2>&1
+    end=$(now)
+    awk -v a="$start" -v b="$end" 'BEGIN { print b - a }'
+}
+
+gen "" > "$TMP/builtin.sh"
+gen "command " > "$TMP/external.sh"
+lines=$(wc -l < "$TMP/builtin.sh")
+
+t_ext=$(run "$TMP/external.sh")
+t_bi=$(run "$TMP/builtin.sh")
+
+awk -v n="$ITER" -v l="$lines" -v e="$t_ext" -v b="$t_bi" 'BEGIN {
+    printf "utils: %d iterations, %d lines\n", n, l
+    printf "  external (command ...): %8.3f s  %10.0f lines/s\n", e, l / e
+    printf "  in-process builtins:    %8.3f s  %10.0f lines/s\n", b, l / b
+    printf "  speedup: %.1fx\n", e / b
+}'
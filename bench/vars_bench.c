@@ -0,0 +1,72 @@
+// Variable store benchmark: an environment of N exported variables, as a
+// shell started from a heavy login environment sees it. Times `$NAME`
+// lookups against getenv(), and what each launch pays for its envp: the
+// cached array, a rebuild after an export, and a per-command assignment.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/vars.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 2000;
+    int rounds = 100000;
+    char name[64], value[64];
+    size_t sink = 0;
+
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "BENCH_VAR%d", i);
+        snprintf(value, sizeof(value), "/opt/tool%d/bin", i);
+        setenv(name, value, 1);
+    }
+    extern char **environ;
+    double t0 = now();
+    vars_init(environ);
+    double import = now() - t0;
+
+    // The last variable is the worst case for getenv()
+    snprintf(name, sizeof(name), "BENCH_VAR%d", n - 1);
+    t0 = now();
+    for (int i = 0; i < rounds; i++) sink += strlen(getenv(name));
+    double env_get = (now() - t0) / rounds;
+    t0 = now();
+    for (int i = 0; i < rounds; i++) sink += strlen(var_get(name));
+    double var_lookup = (now() - t0) / rounds;
+
+    t0 = now();
+    for (int i = 0; i < rounds; i++) sink += (size_t)vars_environ();
+    double cached = (now() - t0) / rounds;
+
+    int rebuilds = 1000;
+    t0 = now();
+    for (int i = 0; i < rebuilds; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        var_set("BENCH_CHANGED", value, VAR_EXPORT);
+        sink += (size_t)vars_environ();
+    }
+    double rebuild = (now() - t0) / rebuilds;
+
+    char *assigns[] = { "LC_ALL=C", "TZ=UTC", NULL };
+    t0 = now();
+    for (int i = 0; i < rebuilds; i++) {
+        char **env = vars_environ_with(assigns);
+        sink += (size_t)env[0];
+        free(env);
+    }
+    double with = (now() - t0) / rebuilds;
+
+    printf("%d exported variables\n", n);
+    printf("  import at startup:         %8.3f ms\n", import * 1e3);
+    printf("  getenv(last):              %8.1f ns\n", env_get * 1e9);
+    printf("  var_get(last):             %8.1f ns\n", var_lookup * 1e9);
+    printf("  envp, unchanged:           %8.1f ns/launch\n", cached * 1e9);
+    printf("  envp, after an export:     %8.3f us/launch\n", rebuild * 1e6);
+    printf("  envp, with 2 assignments:  %8.3f us/launch\n", with * 1e6);
+    return sink == 0;
+}
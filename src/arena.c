@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "myshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static struct ArenaBlock *new_block(size_t min_size) {
+    size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+    struct ArenaBlock *b = xmalloc(sizeof(struct ArenaBlock) + size);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *arena_alloc(struct Arena *a, size_t size) {
+    size = ALIGN_UP(size ? size : 1);
+
+    if (!a->head) {
+        a->head = a->cur = new_block(size);
+    }
+
+    // Blocks after `cur` are left over from earlier, longer lines; reuse
+    // them before asking malloc for more.
+    while (a->cur->used + size > a->cur->size) {
+        if (!a->cur->next) {
+            a->cur->next = new_block(size);
+        } else if (a->cur->next->size < size) {
+            struct ArenaBlock *b = new_block(size);
+            b->next = a->cur->next;
+            a->cur->next = b;
+        }
+        a->cur = a->cur->next;
+        a->cur->used = 0;
+    }
+
+    void *p = a->cur->data + a->cur->used;
+    a->cur->used += size;
+    return p;
+}
+
+// realloc() for arena memory. The most recent allocation grows in place.
+void *arena_grow(struct Arena *a, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr && a->cur) {
+        char *end = a->cur->data + a->cur->used;
+        if ((char *)ptr + ALIGN_UP(old_size) == end &&
+            (size_t)((char *)ptr - a->cur->data) + new_size <= a->cur->size) {
+            a->cur->used = (size_t)((char *)ptr - a->cur->data) + ALIGN_UP(new_size);
+            return ptr;
+        }
+    }
+    void *p = arena_alloc(a, new_size);
+    if (ptr) memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+    return p;
+}
+
+char *arena_strndup(struct Arena *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *arena_strdup(struct Arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+struct ArenaMark arena_mark(struct Arena *a) {
+    struct ArenaMark m = { a->cur, a->cur ? a->cur->used : 0 };
+    return m;
+}
+
+// Roll back to `mark` in O(1). Blocks stay allocated for the next line.
+void arena_release(struct Arena *a, struct ArenaMark mark) {
+    if (!a->head) return;
+    if (mark.block) {
+        a->cur = mark.block;
+        a->cur->used = mark.used;
+    } else {
+        a->cur = a->head;
+        a->cur->used = 0;
+    }
+}
+
+// Give every block back to malloc, for arenas that outlive a line (the
+// parsed body of a function).
+void arena_free(struct Arena *a) {
+    struct ArenaBlock *b = a->head;
+    while (b) {
+        struct ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = a->cur = NULL;
+}
+
+#define POOL_HEADER ALIGN_UP(sizeof(void *))
+
+void *pool_alloc(struct Pool *p) {
+    if (!p->free_list) {
+        size_t obj = ALIGN_UP(p->obj_size);
+        char *chunk = xmalloc(POOL_HEADER + obj * p->per_chunk);
+        *(void **)chunk = p->chunks;
+        p->chunks = chunk;
+        for (size_t i = 0; i < p->per_chunk; i++) {
+            pool_free(p, chunk + POOL_HEADER + i * obj);
+        }
+    }
+    void *obj = p->free_list;
+    p->free_list = *(void **)obj;
+    return obj;
+}
+
+void pool_free(struct Pool *p, void *obj) {
+    *(void **)obj = p->free_list;
+    p->free_list = obj;
+}
@@ -0,0 +1,50 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for everything that lives only as long as one command
+// line: tokens, alias splices, expanded words. Nothing is freed
+// individually; the whole line is released at once with arena_release().
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct Arena {
+    struct ArenaBlock *head;
+    struct ArenaBlock *cur;
+};
+
+// Position to roll back to. Marks nest, so a command that runs another
+// command line (e.g. `source`) can release only what it allocated.
+struct ArenaMark {
+    struct ArenaBlock *block;
+    size_t used;
+};
+
+void *arena_alloc(struct Arena *a, size_t size);
+void *arena_grow(struct Arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(struct Arena *a, const char *s);
+char *arena_strndup(struct Arena *a, const char *s, size_t n);
+struct ArenaMark arena_mark(struct Arena *a);
+void arena_release(struct Arena *a, struct ArenaMark mark);
+void arena_free(struct Arena *a);
+
+// Fixed-size object pool with a free list, for long-lived nodes (aliases,
+// jobs, processes, directory stack entries) that come and go one by one.
+struct Pool {
+    size_t obj_size;
+    size_t per_chunk;
+    void *free_list;
+    void *chunks;
+};
+
+#define POOL_INIT(type) { sizeof(type) < sizeof(void *) ? sizeof(void *) : sizeof(type), 64, NULL, NULL }
+
+void *pool_alloc(struct Pool *p);
+void pool_free(struct Pool *p, void *obj);
+
+#endif
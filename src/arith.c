@@ -0,0 +1,307 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arith.h"
+#include "vars.h"
+
+// Arithmetic expansion, $((expr)): C integer expressions on longs, by
+// recursive descent with one function per precedence level. Variables are
+// referenced by bare name (an unset or empty one is 0) and can be assigned
+// with =, +=, ++ and friends. The text has already been through parameter
+// expansion and command substitution.
+
+struct Arith {
+    const char *p;
+    const char *error;      // first error, NULL if none
+    int skip;               // inside an unevaluated branch: no side effects
+};
+
+static long assignment(struct Arith *a);
+
+static void skip_blanks(struct Arith *a) {
+    while (isspace((unsigned char)*a->p)) a->p++;
+}
+
+// Consume the operator `op` if it comes next and is not the start of a
+// longer one: `<` is not `<<` or `<=`, `+` is not `++` or `+=`.
+static int accept(struct Arith *a, const char *op) {
+    size_t len = strlen(op);
+    skip_blanks(a);
+    if (strncmp(a->p, op, len) != 0) return 0;
+    char next = a->p[len];
+    if (next == '=' && op[len - 1] != '=') return 0;
+    if (len == 1 && next == op[0] && strchr("&|<>+-*", next)) return 0;
+    a->p += len;
+    return 1;
+}
+
+static void fail(struct Arith *a, const char *msg) {
+    if (!a->error) a->error = msg;
+}
+
+static long var_value(struct Arith *a, const char *name) {
+    const char *v = var_get(name);
+    if (!v || !*v) return 0;
+    char *end;
+    long n = strtol(v, &end, 0);
+    while (isspace((unsigned char)*end)) end++;
+    if (*end) fail(a, "variable is not a number");
+    return n;
+}
+
+static void set_value(struct Arith *a, const char *name, long n) {
+    char buf[32];
+    if (a->skip) return;
+    snprintf(buf, sizeof(buf), "%ld", n);
+    var_set(name, buf, 0);
+}
+
+static int read_name(struct Arith *a, char *name, size_t cap) {
+    size_t n = 0;
+    skip_blanks(a);
+    if (!isalpha((unsigned char)*a->p) && *a->p != '_') return 0;
+    while ((isalnum((unsigned char)a->p[n]) || a->p[n] == '_') && n < cap - 1) n++;
+    memcpy(name, a->p, n);
+    name[n] = '\0';
+    a->p += n;
+    return 1;
+}
+
+static long primary(struct Arith *a) {
+    char name[256];
+    skip_blanks(a);
+    if (accept(a, "(")) {
+        long v = assignment(a);
+        if (!accept(a, ")")) fail(a, "missing `)'");
+        return v;
+    }
+    if (isdigit((unsigned char)*a->p)) {
+        char *end;
+        long v = strtol(a->p, &end, 0);
+        if (isalnum((unsigned char)*end) || *end == '_') fail(a, "invalid number");
+        a->p = end;
+        return v;
+    }
+    if (read_name(a, name, sizeof(name))) {
+        long v = var_value(a, name);
+        // Postfix ++ and --: the old value is the result
+        if (accept(a, "++")) set_value(a, name, v + 1);
+        else if (accept(a, "--")) set_value(a, name, v - 1);
+        return v;
+    }
+    fail(a, *a->p ? "syntax error in expression" : "operand expected");
+    return 0;
+}
+
+static long unary(struct Arith *a) {
+    skip_blanks(a);
+    if (strncmp(a->p, "++", 2) == 0 || strncmp(a->p, "--", 2) == 0) {
+        int inc = *a->p == '+';
+        char name[256];
+        a->p += 2;
+        if (!read_name(a, name, sizeof(name))) {
+            fail(a, "operand expected");
+            return 0;
+        }
+        long v = var_value(a, name) + (inc ? 1 : -1);
+        set_value(a, name, v);
+        return v;
+    }
+    if (accept(a, "-")) return -unary(a);
+    if (accept(a, "+")) return unary(a);
+    if (accept(a, "!")) return !unary(a);
+    if (accept(a, "~")) return ~unary(a);
+    return primary(a);
+}
+
+// ** is right-associative and binds tighter than the other binary operators
+static long power(struct Arith *a) {
+    long base = unary(a);
+    if (!accept(a, "**")) return base;
+    long exp = power(a);
+    if (exp < 0) {
+        fail(a, "exponent less than 0");
+        return 0;
+    }
+    long r = 1;
+    while (exp-- > 0) r *= base;
+    return r;
+}
+
+// v / r or v % r for r != 0. LONG_MIN / -1 does not fit and would trap;
+// it wraps to LONG_MIN, with remainder 0, as in bash.
+static long divide(long v, long r, int op) {
+    if (r == -1) return op == '/' ? (long)(0UL - (unsigned long)v) : 0;
+    return op == '/' ? v / r : v % r;
+}
+
+static long multiplicative(struct Arith *a) {
+    long v = power(a);
+    while (1) {
+        int op;
+        if (accept(a, "*")) op = '*';
+        else if (accept(a, "/")) op = '/';
+        else if (accept(a, "%")) op = '%';
+        else return v;
+        long r = power(a);
+        if (op == '*') {
+            v *= r;
+        } else if (r == 0) {
+            if (!a->skip) fail(a, "division by 0");
+            v = 0;
+        } else {
+            v = divide(v, r, op);
+        }
+    }
+}
+
+static long additive(struct Arith *a) {
+    long v = multiplicative(a);
+    while (1) {
+        if (accept(a, "+")) v += multiplicative(a);
+        else if (accept(a, "-")) v -= multiplicative(a);
+        else return v;
+    }
+}
+
+static long shift(struct Arith *a) {
+    long v = additive(a);
+    while (1) {
+        if (accept(a, "<<")) v <<= additive(a);
+        else if (accept(a, ">>")) v >>= additive(a);
+        else return v;
+    }
+}
+
+static long relational(struct Arith *a) {
+    long v = shift(a);
+    while (1) {
+        if (accept(a, "<=")) v = v <= shift(a);
+        else if (accept(a, ">=")) v = v >= shift(a);
+        else if (accept(a, "<")) v = v < shift(a);
+        else if (accept(a, ">")) v = v > shift(a);
+        else return v;
+    }
+}
+
+static long equality(struct Arith *a) {
+    long v = relational(a);
+    while (1) {
+        if (accept(a, "==")) v = v == relational(a);
+        else if (accept(a, "!=")) v = v != relational(a);
+        else return v;
+    }
+}
+
+static long bit_and(struct Arith *a) {
+    long v = equality(a);
+    while (accept(a, "&")) v &= equality(a);
+    return v;
+}
+
+static long bit_xor(struct Arith *a) {
+    long v = bit_and(a);
+    while (accept(a, "^")) v ^= bit_and(a);
+    return v;
+}
+
+static long bit_or(struct Arith *a) {
+    long v = bit_xor(a);
+    while (accept(a, "|")) v |= bit_xor(a);
+    return v;
+}
+
+// The right side of && and || is parsed but, when the left side already
+// decides, not evaluated.
+static long logical_and(struct Arith *a) {
+    long v = bit_or(a);
+    while (accept(a, "&&")) {
+        a->skip += !v;
+        long r = bit_or(a);
+        a->skip -= !v;
+        v = v && r;
+    }
+    return v;
+}
+
+static long logical_or(struct Arith *a) {
+    long v = logical_and(a);
+    while (accept(a, "||")) {
+        a->skip += !!v;
+        long r = logical_and(a);
+        a->skip -= !!v;
+        v = v || r;
+    }
+    return v;
+}
+
+static long conditional(struct Arith *a) {
+    long c = logical_or(a);
+    if (!accept(a, "?")) return c;
+    a->skip += !c;
+    long t = assignment(a);
+    a->skip -= !c;
+    if (!accept(a, ":")) fail(a, "`:' expected for conditional expression");
+    a->skip += !!c;
+    long f = conditional(a);
+    a->skip -= !!c;
+    return c ? t : f;
+}
+
+static const char *const assign_ops[] = {
+    "=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=", NULL
+};
+
+static long assignment(struct Arith *a) {
+    const char *save = a->p;
+    char name[256];
+    if (read_name(a, name, sizeof(name))) {
+        skip_blanks(a);
+        for (int i = 0; assign_ops[i]; i++) {
+            size_t len = strlen(assign_ops[i]);
+            if (strncmp(a->p, assign_ops[i], len) != 0) continue;
+            if (len == 1 && a->p[1] == '=') break;     // ==, not =
+            a->p += len;
+            long r = assignment(a);
+            long v = var_value(a, name);
+            switch (assign_ops[i][0]) {
+            case '=': v = r; break;
+            case '+': v += r; break;
+            case '-': v -= r; break;
+            case '*': v *= r; break;
+            case '/':
+            case '%':
+                if (r == 0) {
+                    if (!a->skip) fail(a, "division by 0");
+                    return 0;
+                }
+                v = divide(v, r, assign_ops[i][0]);
+                break;
+            case '<': v <<= r; break;
+            case '>': v >>= r; break;
+            case '&': v &= r; break;
+            case '^': v ^= r; break;
+            case '|': v |= r; break;
+            }
+            set_value(a, name, v);
+            return v;
+        }
+        a->p = save;
+    }
+    return conditional(a);
+}
+
+// Evaluate expr. On an error, reports it and returns 0 with *ok cleared.
+long arith_eval(const char *expr, int *ok) {
+    struct Arith a = { .p = expr };
+    long v = assignment(&a);
+    skip_blanks(&a);
+    if (*a.p && !a.error) fail(&a, "syntax error in expression");
+    *ok = a.error == NULL;
+    if (a.error) {
+        fprintf(stderr, "myshell: %s: %s\n", expr, a.error);
+        return 0;
+    }
+    return v;
+}
@@ -0,0 +1,6 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+long arith_eval(const char *expr, int *ok);
+
+#endif
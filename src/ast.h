@@ -0,0 +1,109 @@
+#ifndef AST_H
+#define AST_H
+
+// Parsed form of a command line. Nodes are allocated from the line arena;
+// words point straight into the source text with their quotes intact and
+// are only interpreted by the expander at execution time.
+
+typedef enum {
+    NODE_COMMAND,       // simple command: words + redirections
+    NODE_PIPELINE,      // cmd | cmd | ...
+    NODE_AND,           // left && right
+    NODE_OR,            // left || right
+    NODE_SEQ,           // left ; right
+    NODE_BACKGROUND,    // body &
+    NODE_SUBSHELL,      // ( body )
+    NODE_TIME,          // time body
+    NODE_NOT,           // ! body
+    NODE_GROUP,         // { body; }
+    NODE_IF,            // if cond; then body; else orelse; fi
+    NODE_WHILE,         // while cond; do body; done
+    NODE_UNTIL,         // until cond; do body; done
+    NODE_FOR,           // for name in words; do body; done
+    NODE_CASE,          // case word in pattern) body;; ... esac
+    NODE_FUNCTION       // name() body
+} NodeType;
+
+typedef enum {
+    REDIR_IN,           // <
+    REDIR_OUT,          // >
+    REDIR_APPEND,       // >>
+    REDIR_OUT_ERR,      // &>
+    REDIR_HEREDOC,      // <<WORD
+    REDIR_HEREDOC_STRIP,// <<-WORD: leading tabs removed
+    REDIR_HERESTRING,   // <<<word
+    REDIR_DUP_IN,       // <&N, <&-
+    REDIR_DUP_OUT,      // >&N, >&-
+    REDIR_RDWR          // <>
+} RedirType;
+
+struct Word {
+    const char *text;
+    int len;
+};
+
+struct Redir {
+    RedirType type;
+    int fd;             // file descriptor being redirected
+    int literal;        // here-document with a quoted delimiter: no expansion
+    struct Word target; // file name, descriptor (dups), or a here-document's body
+    struct Redir *next;
+};
+
+struct Node;
+
+// One `pattern | pattern) body ;;` of a case command.
+struct CaseItem {
+    int npatterns;
+    struct Word *patterns;
+    struct Node *body;      // NULL for an empty item
+};
+
+struct Node {
+    NodeType type;
+    struct Word src;    // source text this node was parsed from
+    union {
+        struct {
+            int argc;
+            struct Word *argv;
+            struct Redir *redirs;
+        } cmd;
+        struct {
+            int n;
+            struct Node **stages;
+        } pipe;
+        struct {
+            struct Node *left;
+            struct Node *right;
+        } pair;         // NODE_AND, NODE_OR, NODE_SEQ
+        struct {
+            struct Node *body;
+            struct Redir *redirs;
+        } sub;          // NODE_BACKGROUND, NODE_SUBSHELL, NODE_TIME, NODE_NOT, NODE_GROUP
+        struct {
+            struct Node *cond;
+            struct Node *body;
+            struct Node *orelse;    // else or elif branch, NULL if none
+            struct Redir *redirs;
+        } ctl;          // NODE_IF, NODE_WHILE, NODE_UNTIL
+        struct {
+            struct Word name;
+            int nwords;             // -1 without `in`: loop over "$@"
+            struct Word *words;
+            struct Node *body;
+            struct Redir *redirs;
+        } loop;         // NODE_FOR
+        struct {
+            struct Word word;
+            int n;
+            struct CaseItem *items;
+            struct Redir *redirs;
+        } match;        // NODE_CASE
+        struct {
+            struct Word name;
+            struct Node *body;
+        } func;         // NODE_FUNCTION
+    };
+};
+
+#endif
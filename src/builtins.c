@@ -2,13 +2,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include "builtins.h"
+#include "pathcache.h"
+#include "options.h"
+#include "executor.h"
+#include "arena.h"
+#include "shell.h"
+#include "symtab.h"
+#include "jobs.h"
+#include "expand.h"
+#include "vars.h"
+#include "snapshot.h"
 
 char *builtin_str[] = {
   "cd",
   "help",
   "exit",
   "export",
+  "unset",
   "alias",
   "unalias",
   "pushd",
@@ -16,7 +31,34 @@ char *builtin_str[] = {
   "dirs",
   "jobs",
   "fg",
-  "bg"
+  "bg",
+  "hash",
+  "type",
+  "set",
+  "source",
+  ".",
+  "echo",
+  "printf",
+  "test",
+  "[",
+  "true",
+  "false",
+  "pwd",
+  "basename",
+  "dirname",
+  "sleep",
+  "command",
+  "shift",
+  "parallel",
+  "break",
+  "continue",
+  "return",
+  "local",
+  "read",
+  ":",
+  "snapshot",
+  "ulimit",
+  NULL
 };
 
 int (*builtin_func[]) (char **) = {
@@ -24,6 +66,7 @@ int (*builtin_func[]) (char **) = {
   &shell_help,
   &shell_exit,
   &shell_export,
+  &shell_unset,
   &shell_alias,
   &shell_unalias,
   &shell_pushd,
@@ -31,29 +74,74 @@ int (*builtin_func[]) (char **) = {
   &shell_dirs,
   &shell_jobs,
   &shell_fg,
-  &shell_bg
+  &shell_bg,
+  &shell_hash,
+  &shell_type,
+  &shell_set,
+  &shell_source,
+  &shell_source,
+  &shell_echo,
+  &shell_printf,
+  &shell_test,
+  &shell_test,
+  &shell_true,
+  &shell_false,
+  &shell_pwd,
+  &shell_basename,
+  &shell_dirname,
+  &shell_sleep,
+  &shell_command,
+  &shell_shift,
+  &shell_parallel,
+  &shell_break,
+  &shell_break,
+  &shell_return,
+  &shell_local,
+  &shell_read,
+  &shell_true,
+  &shell_snapshot,
+  &shell_ulimit
 };
 
+// Exit status of the builtin that just ran. Reset to 0 by
+// execute_builtin(); builtins set it when they fail.
+int builtin_status = 0;
+
 int shell_num_builtins() {
-  return sizeof(builtin_str) / sizeof(char *);
+  return sizeof(builtin_str) / sizeof(char *) - 1;
 }
 
-int execute_builtin(char **args) {
+// Enter the builtins into the symbol table. Called once at startup.
+void builtins_init(void) {
   for (int i = 0; i < shell_num_builtins(); i++) {
-    if (strcmp(args[0], builtin_str[i]) == 0) {
-      return (*builtin_func[i])(args);
-    }
+    sym_intern(builtin_str[i])->builtin = builtin_func[i];
   }
-  return -1; // Not a builtin
+}
+
+builtin_fn find_builtin(const char *name) {
+  struct Symbol *sym = sym_lookup(name);
+  return sym ? sym->builtin : NULL;
+}
+
+int is_builtin(const char *name) {
+  return find_builtin(name) != NULL;
+}
+
+int execute_builtin(char **args) {
+  builtin_fn fn = find_builtin(args[0]);
+  builtin_status = 0;
+  return fn ? fn(args) : -1; // -1: not a builtin
 }
 
 int shell_cd(char **args)
 {
   if (args[1] == NULL) {
     fprintf(stderr, "myshell: expected argument to \"cd\"\n");
+    builtin_status = 1;
   } else {
     if (chdir(args[1]) != 0) {
       perror("myshell");
+      builtin_status = 1;
     }
   }
   return 1;
@@ -67,66 +155,509 @@ int shell_help(char **args)
   printf("The following commands are built-in:\n");
   printf("  cd <dir>  - Change the current working directory.\n");
   printf("  help      - Print this help information.\n");
-  printf("  exit      - Safely terminate the shell.\n");
+  printf("  exit [n]  - Safely terminate the shell, with status n.\n");
+  printf("  shift [n] - Drop the first n script arguments ($1, $2, ...).\n");
+  printf("  export    - Export variables (export NAME=value, export NAME); list them.\n");
+  printf("  unset n   - Remove the variable n (unset -f n: the function n).\n");
+  printf("  hash [-r] - Show or reset the remembered command locations.\n");
+  printf("  type name - Describe how a command name would be run.\n");
+  printf("  set -o/+o - Turn a shell option on/off (set -o lists them).\n");
+  printf("  source f  - Run the commands in file f in this shell (also `.`).\n");
+  printf("  command c - Run c as an external program even if it is a builtin or function.\n");
+  printf("  break [n], continue [n]\n");
+  printf("            - Leave, or start the next round of, the n-th enclosing loop.\n");
+  printf("  return [n] - Leave the current function with status n.\n");
+  printf("  local v   - Make v local to the current function (local v=value).\n");
+  printf("  read [-r] v... - Read a line from stdin into v... (split on $IFS).\n");
+  printf("  snapshot save FILE - Save aliases, variables, functions, options and hashed\n");
+  printf("            commands for `myshell --restore FILE`.\n");
+  printf("  ulimit [-SH] [-a | -cdflnstuv [n]]\n");
+  printf("            - Show or set the limits of the shell and the commands it starts.\n");
+  printf("  echo, printf, test, [, true, false, :, pwd, basename, dirname, sleep\n");
+  printf("            - Common utilities, run inside the shell without a fork.\n");
+  printf("  parallel [-j N] [-k] cmd [args] [::: items]\n");
+  printf("            - Run cmd once per item (or stdin line), N at a time.\n");
   
   printf("\nSupported Shell Features:\n");
   printf("  <         - Redirect input from a file.\n");
   printf("  >         - Redirect output to a file.\n");
+  printf("  N>&M, N<&- - Make fd N a copy of fd M, or close it (also N>file, N<file, N<>file).\n");
   printf("  |         - Pipe the output of one command to another.\n");
+  printf("  @pipesize=N, @packet, @relay, @rate=N cmd | ...\n");
+  printf("            - Pipe capacity, O_DIRECT pipes, splice relay and rate limit for one pipeline.\n");
+  printf("  @cpus=0-3, @nice=N, @mem=N cmd | ...\n");
+  printf("            - CPU affinity, niceness and memory limit for every process of one pipeline.\n");
+  printf("  $(cmd)    - Replace with the output of cmd (also `cmd`).\n");
+  printf("  <(cmd)    - Replace with a /dev/fd name to read cmd's output from (>(cmd): to write its input).\n");
+  printf("  <<EOF     - Here-document: the following lines up to EOF are the input (<<< word: one line).\n");
   printf("  &         - Run the command in the background.\n");
+  printf("  time cmd  - Report the time and resources cmd (a pipeline or && / || list) used.\n");
+  printf("  if, while, until, for, case, { ...; }\n");
+  printf("            - Conditionals and loops; name() { ...; } defines a function.\n");
+  printf("  $((expr)) - Integer arithmetic, with C operators and variables by name.\n");
   printf("  Up/Down   - Cycle through command history.\n");
+  printf("  Ctrl+R    - Search the whole saved history (~/.myshell_history).\n");
+  printf("  Tab       - Complete command names (builtins, aliases, $PATH) and files.\n");
   
   printf("\nMost standard Unix commands (e.g., ls, pwd, echo, cat) form external processes.\n");
   printf("Use the man command for detailed information on other programs.\n");
   return 1;
 }
 
+// exit [n]: leave with status n, or with the last command's status.
 int shell_exit(char **args)
 {
-  (void)args; // unused
+  builtin_status = last_command_status;
+  if (args[1] != NULL) {
+    char *end;
+    long n = strtol(args[1], &end, 10);
+    if (end == args[1] || *end != '\0') {
+      fprintf(stderr, "myshell: exit: %s: numeric argument required\n", args[1]);
+      n = 2;
+    }
+    builtin_status = n & 0xff;
+  }
   return 0;
 }
 
+// shift [n]: drop the first n positional parameters.
+int shell_shift(char **args)
+{
+  int n = args[1] ? atoi(args[1]) : 1;
+  if (n < 0 || n > pos_count) {
+    fprintf(stderr, "myshell: shift: %s: shift count out of range\n", args[1] ? args[1] : "1");
+    builtin_status = 1;
+    return 1;
+  }
+  pos_params += n;
+  pos_count -= n;
+  return 1;
+}
+
+// export NAME=value ... / export NAME ...: mark variables for the
+// environment of launched commands. With no names, list them.
 int shell_export(char **args)
 {
   if (args[1] == NULL) {
-    fprintf(stderr, "myshell: expected argument to \"export\", e.g., export VAR=value\n");
+    vars_print_exported();
     return 1;
   }
-  
-  // Find the '=' character
-  char *eq_pos = strchr(args[1], '=');
-  if (eq_pos == NULL) {
-    fprintf(stderr, "myshell: invalid format for export, use VAR=value\n");
+
+  for (int i = 1; args[i] != NULL; i++) {
+    size_t len = strlen(args[i]);
+    size_t name_len = var_name_len(args[i], len);
+    if (name_len > 0 && args[i][name_len] == '=') {
+      var_setn(args[i], name_len, args[i] + name_len + 1, VAR_EXPORT);
+    } else if (name_len > 0 && name_len == len) {
+      var_export(args[i]);
+    } else {
+      fprintf(stderr, "myshell: export: `%s': not a valid identifier\n", args[i]);
+      builtin_status = 1;
+    }
+  }
+  return 1;
+}
+
+// unset NAME ... / unset -f NAME ...: remove variables or functions.
+int shell_unset(char **args)
+{
+  int i = 1, functions = 0;
+  if (args[1] && (strcmp(args[1], "-f") == 0 || strcmp(args[1], "-v") == 0)) {
+    functions = args[1][1] == 'f';
+    i++;
+  }
+  for (; args[i] != NULL; i++) {
+    if (functions) unset_function(args[i]);
+    else var_unset(args[i]);
+  }
+  return 1;
+}
+
+// The count argument of break, continue and return.
+static int count_arg(char **args, long *n)
+{
+  char *end;
+  if (args[1] == NULL) return 1;
+  *n = strtol(args[1], &end, 10);
+  if (end == args[1] || *end != '\0') {
+    fprintf(stderr, "myshell: %s: %s: numeric argument required\n", args[0], args[1]);
+    builtin_status = 2;
+    return 0;
+  }
+  return 1;
+}
+
+// break [n] / continue [n]: leave (or start the next round of) the n-th
+// enclosing loop. The executor unwinds to it, see loop_done().
+int shell_break(char **args)
+{
+  long n = 1;
+  if (!count_arg(args, &n)) return 1;
+  if (n < 1) {
+    fprintf(stderr, "myshell: %s: %s: loop count out of range\n", args[0], args[1]);
+    builtin_status = 1;
     return 1;
   }
-  
-  // Split name and value securely
-  *eq_pos = '\0';
-  char *name = args[1];
-  char *value = eq_pos + 1;
-  
-  if (setenv(name, value, 1) != 0) {
-    perror("myshell: export");
+  // Outside a loop there is nothing to do
+  if (loop_depth == 0) return 1;
+  pending_break = n < loop_depth ? n : loop_depth;
+  pending_continue = args[0][0] == 'c';
+  return 1;
+}
+
+// return [n]: leave the running function with status n, or with the
+// last command's status.
+int shell_return(char **args)
+{
+  long n = last_command_status;
+  if (func_depth == 0) {
+    fprintf(stderr, "myshell: return: can only `return' from a function\n");
+    builtin_status = 1;
+    return 1;
   }
-  
+  if (!count_arg(args, &n)) n = 2;
+  builtin_status = n & 0xff;
+  pending_return = 1;
+  return 1;
+}
+
+// local NAME[=value] ...: variables that get their old value back when
+// the function returns.
+int shell_local(char **args)
+{
+  if (func_depth == 0) {
+    fprintf(stderr, "myshell: local: can only be used in a function\n");
+    builtin_status = 1;
+    return 1;
+  }
+  for (int i = 1; args[i] != NULL; i++) {
+    size_t len = strlen(args[i]);
+    size_t name_len = var_name_len(args[i], len);
+    if (name_len == 0 || (name_len < len && args[i][name_len] != '=')) {
+      fprintf(stderr, "myshell: local: `%s': not a valid identifier\n", args[i]);
+      builtin_status = 1;
+      continue;
+    }
+    char *name = strndup(args[i], name_len);
+    var_local(name);
+    free(name);
+    // Without a value it starts out empty, as in dash
+    var_setn(args[i], name_len, name_len < len ? args[i] + name_len + 1 : "", 0);
+  }
+  return 1;
+}
+
+// read [-r] NAME ...: one line from stdin, split on $IFS, one field per
+// name and the rest of the line to the last one. Reads a byte at a time
+// so nothing after the line is taken from a shared descriptor.
+int shell_read(char **args)
+{
+  int raw = 0, i = 1;
+  if (args[1] && strcmp(args[1], "-r") == 0) {
+    raw = 1;
+    i++;
+  }
+  char **names = args + i;
+  char *default_names[] = { "REPLY", NULL };
+  if (names[0] == NULL) names = default_names;
+
+  // A script being read from stdin hands its read-ahead back first
+  if (launch_hook) launch_hook();
+  size_t len = 0, cap = 128;
+  char *line = malloc(cap);
+  int eof = 0;
+  while (1) {
+    char c;
+    ssize_t r = read(STDIN_FILENO, &c, 1);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {
+      eof = 1;
+      break;
+    }
+    if (c == '\n') break;
+    if (c == '\\' && !raw) {
+      // A backslash escapes the next character; before a newline it joins lines
+      if (read(STDIN_FILENO, &c, 1) <= 0) break;
+      if (c == '\n') continue;
+    }
+    if (len + 2 > cap) line = realloc(line, cap *= 2);
+    line[len++] = c;
+  }
+  line[len] = '\0';
+
+  const char *ifs = var_get("IFS");
+  if (!ifs) ifs = " \t\n";
+  char *p = line;
+  for (int k = 0; names[k] != NULL; k++) {
+    while (*p && strchr(ifs, *p)) p++;
+    char *field = p;
+    if (names[k + 1] == NULL) {
+      // The last name takes the rest, less trailing separators
+      char *end = p + strlen(p);
+      while (end > p && strchr(ifs, end[-1])) end--;
+      *end = '\0';
+    } else {
+      while (*p && !strchr(ifs, *p)) p++;
+      if (*p) *p++ = '\0';
+    }
+    var_set(names[k], field, 0);
+  }
+  free(line);
+  // End of input before a newline: the fields are set, but the status says so
+  if (eof) builtin_status = 1;
   return 1;
 }
 
-struct Alias {
-    char *name;
-    char *value;
-    struct Alias *next;
+int shell_snapshot(char **args)
+{
+  if (args[1] == NULL || strcmp(args[1], "save") != 0 || args[2] == NULL || args[3] != NULL) {
+    fprintf(stderr, "myshell: snapshot: usage: snapshot save FILE\n");
+    builtin_status = 2;
+    return 1;
+  }
+  if (!snapshot_save(args[2])) builtin_status = 1;
+  return 1;
+}
+
+// The limits `ulimit` knows, by option letter. Sizes are in KiB, as in
+// other shells; the rest are counts or seconds.
+static const struct {
+  char opt;
+  int resource;
+  int unit;
+  const char *name;
+} ulimits[] = {
+  { 'c', RLIMIT_CORE, 1024, "core file size (KiB)" },
+  { 'd', RLIMIT_DATA, 1024, "data seg size (KiB)" },
+  { 'f', RLIMIT_FSIZE, 1024, "file size (KiB)" },
+  { 'l', RLIMIT_MEMLOCK, 1024, "max locked memory (KiB)" },
+  { 'n', RLIMIT_NOFILE, 1, "open files" },
+  { 's', RLIMIT_STACK, 1024, "stack size (KiB)" },
+  { 't', RLIMIT_CPU, 1, "cpu time (seconds)" },
+  { 'u', RLIMIT_NPROC, 1, "max user processes" },
+  { 'v', RLIMIT_AS, 1024, "virtual memory (KiB)" },
 };
-struct Alias *alias_head = NULL;
+#define NUM_ULIMITS (int)(sizeof(ulimits) / sizeof(ulimits[0]))
+
+static void print_limit(rlim_t v, int unit) {
+  if (v == RLIM_INFINITY) printf("unlimited\n");
+  else printf("%llu\n", (unsigned long long)(v / unit));
+}
+
+// ulimit [-SH] [-a | -cdflnstuv [limit]]: show or set the shell's own
+// limits, which every command it launches inherits. Setting one without
+// -S or -H sets both; showing one shows the soft limit unless -H is given.
+int shell_ulimit(char **args)
+{
+  int soft = 0, hard = 0, all = 0, which = 2; // -f
+  int i = 1;
+  for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+    for (char *c = args[i] + 1; *c; c++) {
+      int k = 0;
+      while (k < NUM_ULIMITS && ulimits[k].opt != *c) k++;
+      if (*c == 'S') soft = 1;
+      else if (*c == 'H') hard = 1;
+      else if (*c == 'a') all = 1;
+      else if (k < NUM_ULIMITS) which = k;
+      else {
+        fprintf(stderr, "myshell: ulimit: -%c: invalid option\n", *c);
+        fprintf(stderr, "myshell: ulimit: usage: ulimit [-SH] [-a | -cdflnstuv [limit]]\n");
+        builtin_status = 2;
+        return 1;
+      }
+    }
+  }
+
+  struct rlimit rl;
+  if (all) {
+    for (int k = 0; k < NUM_ULIMITS; k++) {
+      getrlimit(ulimits[k].resource, &rl);
+      printf("%-26s (-%c) ", ulimits[k].name, ulimits[k].opt);
+      print_limit(hard && !soft ? rl.rlim_max : rl.rlim_cur, ulimits[k].unit);
+    }
+    return 1;
+  }
+  getrlimit(ulimits[which].resource, &rl);
+  if (args[i] == NULL) {
+    print_limit(hard && !soft ? rl.rlim_max : rl.rlim_cur, ulimits[which].unit);
+    return 1;
+  }
+
+  rlim_t v = RLIM_INFINITY;
+  if (strcmp(args[i], "unlimited") != 0) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(args[i], &end, 10);
+    if (end == args[i] || *end || args[i][0] == '-' || errno ||
+        n > (unsigned long long)(RLIM_INFINITY - 1) / ulimits[which].unit) {
+      fprintf(stderr, "myshell: ulimit: %s: invalid number\n", args[i]);
+      builtin_status = 1;
+      return 1;
+    }
+    v = (rlim_t)n * ulimits[which].unit;
+  }
+  if (!soft && !hard) soft = hard = 1;
+  if (soft) rl.rlim_cur = v;
+  if (hard) rl.rlim_max = v;
+  if (setrlimit(ulimits[which].resource, &rl) != 0) {
+    fprintf(stderr, "myshell: ulimit: %s: cannot modify limit: %s\n", ulimits[which].name, strerror(errno));
+    builtin_status = 1;
+  }
+  return 1;
+}
+
+int shell_hash(char **args)
+{
+  if (args[1] == NULL) {
+    pathcache_print();
+    return 1;
+  }
+  if (strcmp(args[1], "-r") == 0) {
+    pathcache_clear();
+    return 1;
+  }
+  for (int i = 1; args[i] != NULL; i++) {
+    if (!pathcache_add(args[i])) {
+      fprintf(stderr, "myshell: hash: %s: not found\n", args[i]);
+      builtin_status = 1;
+    }
+  }
+  return 1;
+}
+
+int shell_type(char **args)
+{
+  for (int i = 1; args[i] != NULL; i++) {
+    char *name = args[i];
+    struct Symbol *sym = sym_lookup(name);
+    int found = 0;
+
+    if (sym && sym->alias) {
+      printf("%s is aliased to `%s'\n", name, sym->alias);
+      continue;
+    }
+    if (sym && sym->func) {
+      printf("%s is a function\n", name);
+      continue;
+    }
+    if (sym && sym->builtin) {
+      printf("%s is a shell builtin\n", name);
+      continue;
+    }
+
+    const char *path = pathcache_peek(name, &found);
+    char *resolved;
+    if (found && path) {
+      printf("%s is hashed (%s)\n", name, path);
+    } else if ((resolved = pathcache_resolve(name)) != NULL) {
+      printf("%s is %s\n", name, resolved);
+      free(resolved);
+    } else {
+      fprintf(stderr, "myshell: type: %s: not found\n", name);
+      builtin_status = 1;
+    }
+  }
+  return 1;
+}
+
+// The executor strips `command` off a command line before running it, so
+// only the lookup forms (`command -v name`, `command -V name`) get here.
+int shell_command(char **args)
+{
+  int verbose = 0, i = 1;
+  if (args[1] && (strcmp(args[1], "-v") == 0 || strcmp(args[1], "-V") == 0)) {
+    verbose = args[1][1] == 'V';
+    i++;
+  } else if (args[1]) {
+    fprintf(stderr, "myshell: command: %s: invalid option\n", args[1]);
+    builtin_status = 2;
+    return 1;
+  }
+
+  for (; args[i] != NULL; i++) {
+    struct Symbol *sym = sym_lookup(args[i]);
+    char *path;
+    if (verbose) {
+      char *type_args[] = { "type", args[i], NULL };
+      shell_type(type_args);
+    } else if (sym && sym->alias) {
+      printf("alias %s='%s'\n", args[i], sym->alias);
+    } else if (sym && (sym->func || sym->builtin)) {
+      printf("%s\n", args[i]);
+    } else if ((path = pathcache_resolve(args[i])) != NULL) {
+      printf("%s\n", path);
+      free(path);
+    } else {
+      builtin_status = 1;
+    }
+  }
+  return 1;
+}
+
+int shell_set(char **args)
+{
+  if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL)) {
+    option_print();
+    return 1;
+  }
+
+  for (int i = 1; args[i] != NULL; i++) {
+    int on;
+    if (strcmp(args[i], "-o") == 0) on = 1;
+    else if (strcmp(args[i], "+o") == 0) on = 0;
+    else {
+      fprintf(stderr, "myshell: set: %s: invalid option\n", args[i]);
+      builtin_status = 1;
+      return 1;
+    }
+
+    if (args[i+1] == NULL) {
+      fprintf(stderr, "myshell: set: %s: option name required\n", args[i]);
+      builtin_status = 1;
+      return 1;
+    }
+    int opt = option_index(args[++i]);
+    if (opt < 0) {
+      fprintf(stderr, "myshell: set: %s: invalid option name\n", args[i]);
+      builtin_status = 1;
+      return 1;
+    }
+    shell_options[opt] = on;
+  }
+  return 1;
+}
+
+int shell_source(char **args)
+{
+  if (args[1] == NULL) {
+    fprintf(stderr, "myshell: %s: filename argument required\n", args[0]);
+    builtin_status = 1;
+    return 1;
+  }
+  if (access(args[1], R_OK) != 0) {
+    fprintf(stderr, "myshell: %s: ", args[0]);
+    perror(args[1]);
+    builtin_status = 1;
+    return 1;
+  }
+  int res = shell_run_file(args[1]);
+  builtin_status = last_command_status;
+  return res;
+}
+
+// Aliases live in the shared symbol table next to the builtins.
+static int is_alias(const struct Symbol *sym) {
+    return sym->alias != NULL;
+}
 
 int shell_alias(char **args) {
     if (args[1] == NULL) {
-        struct Alias *curr = alias_head;
-        while (curr) {
-            printf("alias %s='%s'\n", curr->name, curr->value);
-            curr = curr->next;
+        struct Symbol **list;
+        int n = sym_collect(is_alias, &list);
+        for (int i = 0; i < n; i++) {
+            printf("alias %s='%s'\n", list[i]->name, list[i]->alias);
         }
+        free(list);
         return 1;
     }
     
@@ -138,15 +669,13 @@ int shell_alias(char **args) {
     
     char *eq_pos = strchr(buf, '=');
     if (!eq_pos) {
-        struct Alias *curr = alias_head;
-        while (curr) {
-            if (strcmp(curr->name, buf) == 0) {
-                printf("alias %s='%s'\n", curr->name, curr->value);
-                return 1;
-            }
-            curr = curr->next;
+        char *value = resolve_alias(buf);
+        if (value) {
+            printf("alias %s='%s'\n", buf, value);
+        } else {
+            fprintf(stderr, "myshell: alias: %s: not found\n", buf);
+            builtin_status = 1;
         }
-        fprintf(stderr, "myshell: alias: %s: not found\n", buf);
         return 1;
     }
     
@@ -160,70 +689,52 @@ int shell_alias(char **args) {
         value++;
     }
     
-    struct Alias *curr = alias_head;
-    while (curr) {
-        if (strcmp(curr->name, name) == 0) {
-            free(curr->value);
-            curr->value = strdup(value);
-            return 1;
-        }
-        curr = curr->next;
-    }
-    
-    struct Alias *new_alias = malloc(sizeof(struct Alias));
-    new_alias->name = strdup(name);
-    new_alias->value = strdup(value);
-    new_alias->next = alias_head;
-    alias_head = new_alias;
-    
+    struct Symbol *sym = sym_intern(name);
+    free(sym->alias);
+    sym->alias = strdup(value);
     return 1;
 }
 
 int shell_unalias(char **args) {
     if (args[1] == NULL) {
         fprintf(stderr, "unalias: usage: unalias name\n");
+        builtin_status = 1;
         return 1;
     }
     
-    struct Alias *curr = alias_head;
-    struct Alias *prev = NULL;
-    while (curr) {
-        if (strcmp(curr->name, args[1]) == 0) {
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                alias_head = curr->next;
-            }
-            free(curr->name);
-            free(curr->value);
-            free(curr);
-            return 1;
-        }
-        prev = curr;
-        curr = curr->next;
+    struct Symbol *sym = sym_lookup(args[1]);
+    if (!sym || !sym->alias) {
+        fprintf(stderr, "myshell: unalias: %s: not found\n", args[1]);
+        builtin_status = 1;
+        return 1;
     }
-    fprintf(stderr, "myshell: unalias: %s: not found\n", args[1]);
+    free(sym->alias);
+    sym->alias = NULL;
+    sym_release(sym);
     return 1;
 }
 
 char *resolve_alias(const char *name) {
-    struct Alias *curr = alias_head;
-    while (curr) {
-        if (strcmp(curr->name, name) == 0) {
-            return curr->value;
-        }
-        curr = curr->next;
-    }
-    return NULL;
+    struct Symbol *sym = sym_lookup(name);
+    return sym ? sym->alias : NULL;
 }
 
 #define DIR_STACK_SIZE 128
+#define DIR_PATH_MAX 1024
+
+// Saved directories live in fixed-size pool slots, so pushd/popd never
+// go through malloc once the pool has warmed up.
+struct DirSlot {
+    char path[DIR_PATH_MAX];
+};
+static struct Pool dir_pool = POOL_INIT(struct DirSlot);
+
 char *dir_stack[DIR_STACK_SIZE];
 int dir_stack_top = 0;
 
 int shell_dirs(char **args) {
     (void)args;
-    char cwd[1024];
+    char cwd[DIR_PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
         printf("%s ", cwd);
     }
@@ -234,25 +745,37 @@ int shell_dirs(char **args) {
     return 1;
 }
 
+// Push a directory onto the stack. Returns 0 if the stack is full.
+int dir_stack_push(const char *path) {
+    if (dir_stack_top == DIR_STACK_SIZE) return 0;
+    struct DirSlot *slot = pool_alloc(&dir_pool);
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    dir_stack[dir_stack_top++] = slot->path;
+    return 1;
+}
+
 int shell_pushd(char **args) {
     if (args[1] == NULL) {
         fprintf(stderr, "myshell: pushd: no other directory\n");
+        builtin_status = 1;
         return 1;
     }
-    char cwd[1024];
+    char cwd[DIR_PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) == NULL) {
         perror("myshell: pushd");
+        builtin_status = 1;
         return 1;
     }
     
     if (chdir(args[1]) != 0) {
         perror("myshell: pushd");
+        builtin_status = 1;
     } else {
-        if (dir_stack_top < DIR_STACK_SIZE) {
-            dir_stack[dir_stack_top++] = strdup(cwd);
+        if (dir_stack_push(cwd)) {
             shell_dirs(NULL);
         } else {
             fprintf(stderr, "myshell: pushd: directory stack full\n");
+            builtin_status = 1;
         }
     }
     return 1;
@@ -265,96 +788,61 @@ int shell_popd(char **args) {
         char *target = dir_stack[dir_stack_top];
         if (chdir(target) != 0) {
             perror("myshell: popd");
+            builtin_status = 1;
         } else {
             shell_dirs(NULL);
         }
-        free(target);
+        pool_free(&dir_pool, target);
     } else {
         fprintf(stderr, "myshell: popd: directory stack empty\n");
+        builtin_status = 1;
     }
     return 1;
 }
 
-struct Job *first_job = NULL;
-int next_job_id = 1;
-
-void add_job(pid_t pid, int bg, const char *cmd) {
-    struct Job *new_job = malloc(sizeof(struct Job));
-    new_job->id = next_job_id++;
-    new_job->pid = pid;
-    new_job->cmd = strdup(cmd);
-    new_job->state = bg ? JOB_RUNNING : JOB_FOREGROUND;
-    new_job->next = NULL;
-    
-    if (first_job == NULL) {
-        first_job = new_job;
-    } else {
-        struct Job *curr = first_job;
-        while (curr->next != NULL) curr = curr->next;
-        curr->next = new_job;
-    }
-}
-
-void remove_job(pid_t pid) {
-    struct Job *curr = first_job, *prev = NULL;
-    while (curr != NULL) {
-        if (curr->pid == pid) {
-            if (prev == NULL) first_job = curr->next;
-            else prev->next = curr->next;
-            free(curr->cmd);
-            free(curr);
-            if (first_job == NULL) next_job_id = 1;
-            return;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-}
-
-struct Job *find_job_by_pid(pid_t pid) {
-    struct Job *curr = first_job;
-    while (curr) {
-        if (curr->pid == pid) return curr;
-        curr = curr->next;
-    }
-    return NULL;
+static const char *process_state_str(struct Process *p) {
+    if (p->stopped) return "Stopped";
+    if (!p->completed) return "Running";
+    return WIFSIGNALED(p->status) ? "Killed" : "Done";
 }
 
 int shell_jobs(char **args) {
-    (void)args;
+    int long_fmt = args[1] != NULL && strcmp(args[1], "-l") == 0;
+    jobs_reap();
     struct Job *curr = first_job;
     while (curr) {
+        struct Job *next = curr->next;
         if (curr->state != JOB_FOREGROUND) {
-            printf("[%d] %s    %s\n", curr->id, 
-                curr->state == JOB_STOPPED ? "Stopped" : "Running", curr->cmd);
+            int done = job_is_completed(curr);
+            const char *state = curr->state == JOB_STOPPED ? "Stopped" :
+                done ? "Done" : "Running";
+            printf("[%d] %s    %s\n", curr->id, state, curr->cmd);
+            if (long_fmt) {
+                // Finished stages are already summed on the job
+                double total = curr->usage.ru_utime.tv_sec + curr->usage.ru_stime.tv_sec +
+                    (curr->usage.ru_utime.tv_usec + curr->usage.ru_stime.tv_usec) / 1e6;
+                long peak = curr->usage.ru_maxrss;
+                int started = 0;
+                for (struct Process *p = curr->procs; p; p = p->next) {
+                    if (p->pid == 0) continue;
+                    double cpu;
+                    long rss;
+                    process_usage(p, &cpu, &rss);
+                    printf("      %d %-8s cpu %.2fs  rss %ldk\n", p->pid, process_state_str(p), cpu, rss);
+                    if (!p->completed) total += cpu;
+                    if (rss > peak) peak = rss;
+                    started++;
+                }
+                if (started > 1) printf("      total    cpu %.2fs  rss %ldk\n", total, peak);
+            }
+            // Reported here, so the prompt does not announce it again
+            if (done) remove_job(curr);
         }
-        curr = curr->next;
+        curr = next;
     }
     return 1;
 }
 
-#include <sys/wait.h>
-extern pid_t shell_pgid;
-extern int shell_terminal;
-
-void wait_for_job(struct Job *job) {
-    int status;
-    pid_t pid = job->pid;
-    
-    tcsetpgrp(shell_terminal, pid);
-    
-    if (waitpid(pid, &status, WUNTRACED) > 0) {
-        if (WIFSTOPPED(status)) {
-            job->state = JOB_STOPPED;
-            printf("\n[%d]+  Stopped                 %s\n", job->id, job->cmd);
-        } else {
-            remove_job(pid);
-        }
-    }
-    
-    tcsetpgrp(shell_terminal, shell_pgid);
-}
-
 int shell_fg(char **args) {
     struct Job *job = NULL;
     if (args[1] == NULL) {
@@ -365,23 +853,20 @@ int shell_fg(char **args) {
             curr = curr->next;
         }
     } else {
-        int target_id = atoi(args[1]);
-        struct Job *curr = first_job;
-        while (curr) {
-            if (curr->id == target_id) { job = curr; break; }
-            curr = curr->next;
-        }
+        job = find_job_by_id(atoi(args[1]));
     }
     
     if (job) {
         printf("%s\n", job->cmd);
         if (job->state == JOB_STOPPED) {
-            kill(-job->pid, SIGCONT);
+            continue_job(job);
         }
         job->state = JOB_FOREGROUND;
         wait_for_job(job);
+        builtin_status = last_command_status;
     } else {
         fprintf(stderr, "myshell: fg: current: no such job\n");
+        builtin_status = 1;
     }
     return 1;
 }
@@ -396,25 +881,21 @@ int shell_bg(char **args) {
             curr = curr->next;
         }
     } else {
-        int target_id = atoi(args[1]);
-        struct Job *curr = first_job;
-        while (curr) {
-            if (curr->id == target_id) { job = curr; break; }
-            curr = curr->next;
-        }
+        job = find_job_by_id(atoi(args[1]));
     }
     
     if (job) {
         if (job->state == JOB_STOPPED) {
             printf("[%d]+ %s &\n", job->id, job->cmd);
             job->state = JOB_RUNNING;
-            kill(-job->pid, SIGCONT);
+            continue_job(job);
         } else {
             fprintf(stderr, "myshell: bg: job already in background\n");
+            builtin_status = 1;
         }
     } else {
         fprintf(stderr, "myshell: bg: current: no such job\n");
+        builtin_status = 1;
     }
     return 1;
 }
-
@@ -2,11 +2,13 @@
 #define BUILTINS_H
 
 #include <sys/types.h>
+#include "symtab.h"
 
 int shell_cd(char **args);
 int shell_help(char **args);
 int shell_exit(char **args);
 int shell_export(char **args);
+int shell_unset(char **args);
 int shell_alias(char **args);
 int shell_unalias(char **args);
 int shell_pushd(char **args);
@@ -15,32 +17,41 @@ int shell_dirs(char **args);
 int shell_jobs(char **args);
 int shell_fg(char **args);
 int shell_bg(char **args);
+int shell_hash(char **args);
+int shell_type(char **args);
+int shell_set(char **args);
+int shell_command(char **args);
+int shell_shift(char **args);
+int shell_source(char **args);
+int shell_echo(char **args);
+int shell_printf(char **args);
+int shell_test(char **args);
+int shell_true(char **args);
+int shell_false(char **args);
+int shell_pwd(char **args);
+int shell_basename(char **args);
+int shell_dirname(char **args);
+int shell_sleep(char **args);
+int shell_parallel(char **args);
+int shell_break(char **args);
+int shell_return(char **args);
+int shell_local(char **args);
+int shell_read(char **args);
+int shell_snapshot(char **args);
+int shell_ulimit(char **args);
 int shell_num_builtins(void);
+void builtins_init(void);
+builtin_fn find_builtin(const char *name);
+int is_builtin(const char *name);
 int execute_builtin(char **args);
 char *resolve_alias(const char *name);
+int dir_stack_push(const char *path);
 
-typedef enum {
-    JOB_FOREGROUND,
-    JOB_RUNNING,
-    JOB_STOPPED
-} JobState;
-
-struct Job {
-    int id;
-    pid_t pid;
-    char *cmd;
-    JobState state;
-    struct Job *next;
-};
-
-extern struct Job *first_job;
-
-void add_job(pid_t pid, int bg, const char *cmd);
-void remove_job(pid_t pid);
-struct Job *find_job_by_pid(pid_t pid);
-void wait_for_job(struct Job *job);
+extern char *dir_stack[];
+extern int dir_stack_top;
 
 extern char *builtin_str[];
+extern int builtin_status;
 
 #endif
 
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "complete.h"
+#include "symtab.h"
+#include "vars.h"
+
+// Command-name completion index. Every executable on $PATH is kept in one
+// sorted array, so a prefix is answered with a binary search instead of
+// a directory scan. Each PATH directory keeps its own list of names and
+// the mtime it had when it was read; adding or removing a file changes
+// the directory's mtime, so only those directories are read again. The
+// first build runs in a background thread started with the shell, since
+// PATH can hold thousands of programs on slow (NFS) mounts.
+//
+// Builtins and aliases come from the symbol table at lookup time, so
+// `alias` and `unalias` take effect without touching the index.
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+struct CompDir {
+    char *path;
+    struct timespec mtime;
+    char *names;        // packed, NUL-separated
+    size_t len;
+    size_t count;
+    int seen;           // still on PATH (used while refreshing)
+};
+
+static struct CompDir *dirs;
+static int ndirs;
+static char *indexed_path;      // $PATH the index was built for
+
+static const char **entries;    // sorted, unique, pointing into dirs[].names
+static size_t nentries;
+
+static pthread_t build_thread;
+static int build_running;
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+static const char *current_path(void) {
+    const char *path = var_get("PATH");
+    return path ? path : DEFAULT_PATH;
+}
+
+// Read the executables in one directory.
+static void scan_dir(struct CompDir *d) {
+    struct stat st;
+    size_t cap = 0;
+
+    free(d->names);
+    d->names = NULL;
+    d->len = d->count = 0;
+    d->mtime.tv_sec = d->mtime.tv_nsec = 0;
+
+    int fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (fstat(fd, &st) == 0) d->mtime = st.st_mtim;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        if (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) continue;
+        if (fstatat(fd, e->d_name, &st, 0) != 0) continue;
+        if (!S_ISREG(st.st_mode) || !(st.st_mode & 0111)) continue;
+
+        size_t n = strlen(e->d_name) + 1;
+        if (d->len + n > cap) {
+            cap = cap ? cap * 2 : 4096;
+            while (d->len + n > cap) cap *= 2;
+            d->names = realloc(d->names, cap);
+        }
+        memcpy(d->names + d->len, e->d_name, n);
+        d->len += n;
+        d->count++;
+    }
+    closedir(dir);
+}
+
+static int dir_changed(struct CompDir *d) {
+    struct stat st;
+    if (stat(d->path, &st) != 0) return d->names != NULL || d->mtime.tv_sec != 0;
+    return st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec;
+}
+
+// Merge the per-directory lists into the sorted array.
+static void rebuild_entries(void) {
+    size_t total = 0;
+    for (int i = 0; i < ndirs; i++) total += dirs[i].count;
+
+    entries = realloc(entries, (total ? total : 1) * sizeof(char *));
+    size_t n = 0;
+    for (int i = 0; i < ndirs; i++) {
+        const char *p = dirs[i].names;
+        for (size_t k = 0; k < dirs[i].count; k++) {
+            entries[n++] = p;
+            p += strlen(p) + 1;
+        }
+    }
+    qsort(entries, n, sizeof(char *), cmp_name);
+
+    // The same program in several directories is offered once
+    size_t out = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (out == 0 || strcmp(entries[out - 1], entries[k]) != 0) entries[out++] = entries[k];
+    }
+    nentries = out;
+}
+
+// Bring the index up to date with $PATH, reading only directories that
+// are new or whose mtime moved.
+static void refresh(const char *path) {
+    int changed = 0;
+
+    if (!indexed_path || strcmp(indexed_path, path) != 0) {
+        // Keep the directories PATH still names, in the new order
+        struct CompDir *old = dirs;
+        int nold = ndirs;
+        char *copy = strdup(path);
+        int cap = 1;
+        for (char *p = copy; *p; p++) cap += *p == ':';
+
+        dirs = calloc(cap, sizeof(struct CompDir));
+        ndirs = 0;
+        for (char *save, *tok = strtok_r(copy, ":", &save); tok; tok = strtok_r(NULL, ":", &save)) {
+            int dup = 0;
+            for (int i = 0; i < ndirs; i++) dup |= strcmp(dirs[i].path, tok) == 0;
+            if (dup) continue;
+
+            struct CompDir *d = &dirs[ndirs++];
+            for (int i = 0; i < nold; i++) {
+                if (!old[i].seen && strcmp(old[i].path, tok) == 0) {
+                    *d = old[i];
+                    old[i].seen = 1;
+                    break;
+                }
+            }
+            if (!d->path) {
+                d->path = strdup(tok);
+                scan_dir(d);
+            }
+        }
+        for (int i = 0; i < nold; i++) {
+            if (old[i].seen) continue;
+            free(old[i].path);
+            free(old[i].names);
+        }
+        for (int i = 0; i < ndirs; i++) dirs[i].seen = 0;
+        free(old);
+        free(copy);
+        free(indexed_path);
+        indexed_path = strdup(path);
+        changed = 1;
+    }
+
+    for (int i = 0; i < ndirs; i++) {
+        if (dir_changed(&dirs[i])) {
+            scan_dir(&dirs[i]);
+            changed = 1;
+        }
+    }
+    if (changed) rebuild_entries();
+}
+
+static void *build_main(void *arg) {
+    refresh(arg);
+    free(arg);
+    return NULL;
+}
+
+// Start building the index in the background. The thread only touches
+// the index, which nothing else reads until complete_wait() joins it.
+void complete_init(void) {
+    char *path = strdup(current_path());
+    if (pthread_create(&build_thread, NULL, build_main, path) == 0) {
+        build_running = 1;
+    } else {
+        free(path);
+    }
+}
+
+static void complete_wait(void) {
+    if (build_running) {
+        pthread_join(build_thread, NULL);
+        build_running = 0;
+    }
+}
+
+// First index in entries that is >= prefix.
+static size_t lower_bound(const char *prefix) {
+    size_t lo = 0, hi = nentries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(entries[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static const char *sym_prefix;
+static size_t sym_prefix_len;
+
+static int sym_matches(const struct Symbol *sym) {
+    return (sym->builtin || sym->alias || sym->func) && strncmp(sym->name, sym_prefix, sym_prefix_len) == 0;
+}
+
+// readline generator: builtins and aliases, then programs on $PATH.
+char *complete_command(const char *text, int state) {
+    static size_t pos;
+    static size_t len;
+    static struct Symbol **syms;
+    static int nsyms, sym_pos;
+
+    if (!state) {
+        complete_wait();
+        refresh(current_path());
+        len = strlen(text);
+        pos = lower_bound(text);
+
+        free(syms);
+        sym_prefix = text;
+        sym_prefix_len = len;
+        nsyms = sym_collect(sym_matches, &syms);
+        sym_pos = 0;
+    }
+
+    if (sym_pos < nsyms) return strdup(syms[sym_pos++]->name);
+    if (pos < nentries && strncmp(entries[pos], text, len) == 0) return strdup(entries[pos++]);
+    return NULL;
+}
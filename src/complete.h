@@ -0,0 +1,7 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+void complete_init(void);
+char *complete_command(const char *text, int state);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <readline/readline.h>
+#include "eventloop.h"
+#include "jobs.h"
+
+// The prompt's event loop. Instead of blocking in readline(), the shell
+// polls the terminal together with a signalfd for SIGCHLD (and any other
+// descriptor registered with event_watch()), feeding keystrokes to
+// readline's callback interface. Background jobs are reaped the moment
+// they change state, and their notifications are printed above the
+// prompt line being edited.
+
+#define EVENT_MAX_WATCHES 16
+
+struct Watch {
+    int fd;
+    event_fn fn;
+    void *data;
+};
+
+static struct Watch watches[EVENT_MAX_WATCHES];
+static int nwatches;
+
+static sigset_t child_mask;     // signal mask the shell started with
+static int child_mask_set;
+static int sigchld_fd = -1;
+
+static char *ready_line;
+static int line_done;
+
+// Children must not inherit the blocked SIGCHLD.
+const sigset_t *event_child_sigmask(void) {
+    if (!child_mask_set) {
+        // No event loop (scripts, -c): nothing was blocked
+        sigprocmask(SIG_BLOCK, NULL, &child_mask);
+        child_mask_set = 1;
+    }
+    return &child_mask;
+}
+
+void event_watch(int fd, event_fn fn, void *data) {
+    for (int i = 0; i < nwatches; i++) {
+        if (watches[i].fd == fd) {
+            watches[i].fn = fn;
+            watches[i].data = data;
+            return;
+        }
+    }
+    if (nwatches == EVENT_MAX_WATCHES) {
+        fprintf(stderr, "myshell: too many event sources\n");
+        return;
+    }
+    watches[nwatches].fd = fd;
+    watches[nwatches].fn = fn;
+    watches[nwatches].data = data;
+    nwatches++;
+}
+
+void event_unwatch(int fd) {
+    for (int i = 0; i < nwatches; i++) {
+        if (watches[i].fd == fd) {
+            watches[i] = watches[--nwatches];
+            return;
+        }
+    }
+}
+
+static void on_sigchld(int fd, void *data) {
+    struct signalfd_siginfo si;
+    (void)data;
+
+    // Signals coalesce, so this is only a wakeup; waitpid() finds the children
+    while (read(fd, &si, sizeof(si)) == sizeof(si)) continue;
+    jobs_reap();
+
+    if (!jobs_notify_pending()) return;
+    rl_clear_visible_line();
+    jobs_notify(1);
+    rl_on_new_line();
+    rl_redisplay();
+}
+
+// Block SIGCHLD and route it through a signalfd. The waitpid() calls in
+// the shell do not depend on the signal, so nothing else changes.
+void event_init(void) {
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &child_mask);
+    child_mask_set = 1;
+
+    sigchld_fd = signalfd(-1, &block, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0) {
+        // Still correct, just reaped at the next prompt instead
+        perror("myshell: signalfd");
+        sigprocmask(SIG_SETMASK, &child_mask, NULL);
+        return;
+    }
+    event_watch(sigchld_fd, on_sigchld, NULL);
+}
+
+static void line_handler(char *line) {
+    ready_line = line;
+    line_done = 1;
+    rl_callback_handler_remove();
+}
+
+// Read one line like readline(prompt) does, servicing the other event
+// sources while the user types. Returns NULL on EOF.
+char *event_readline(const char *prompt) {
+    struct pollfd fds[EVENT_MAX_WATCHES + 1];
+
+    line_done = 0;
+    ready_line = NULL;
+    rl_callback_handler_install(prompt, line_handler);
+
+    while (!line_done) {
+        int n = 0;
+        fds[n].fd = fileno(rl_instream ? rl_instream : stdin);
+        fds[n++].events = POLLIN;
+        for (int i = 0; i < nwatches; i++) {
+            fds[n].fd = watches[i].fd;
+            fds[n++].events = POLLIN;
+        }
+
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("myshell: poll");
+            rl_callback_handler_remove();
+            return NULL;
+        }
+
+        // Watchers first: a job that finished while the user typed is
+        // reported before the keystroke that woke us is echoed
+        for (int i = n - 1; i > 0; i--) {
+            if (fds[i].revents && i - 1 < nwatches && watches[i - 1].fd == fds[i].fd) {
+                watches[i - 1].fn(fds[i].fd, watches[i - 1].data);
+            }
+        }
+        if (fds[0].revents) rl_callback_read_char();
+    }
+    return ready_line;
+}
@@ -0,0 +1,14 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <signal.h>
+
+typedef void (*event_fn)(int fd, void *data);
+
+void event_init(void);
+const sigset_t *event_child_sigmask(void);
+void event_watch(int fd, event_fn fn, void *data);
+void event_unwatch(int fd);
+char *event_readline(const char *prompt);
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,246 +7,1753 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fnmatch.h>
 #include "executor.h"
 #include "builtins.h"
+#include "pathcache.h"
+#include "options.h"
+#include "arena.h"
+#include "ast.h"
+#include "parser.h"
+#include "expand.h"
+#include "symtab.h"
+#include "jobs.h"
+#include "eventloop.h"
+#include "vars.h"
 
 int last_command_status = 0;
 pid_t shell_pgid = 0;
 int shell_terminal = STDIN_FILENO;
+int job_control = 1;
+pid_t last_bg_pid = 0;
+struct Arena cmd_arena;
+void (*launch_hook)(void);
+int pending_break = 0;
+int pending_continue = 0;
+int pending_return = 0;
+int loop_depth = 0;
+int func_depth = 0;
 
-void setup_redirection(char **args) {
-  char *input_file = NULL;
-  char *output_file = NULL;
-  char *err_file = NULL;
-  int append = 0;
-  int redirect_err = 0;
-  int cmd_end = -1;
-  
-  for (int i = 0; args[i] != NULL; i++) {
-    if (strcmp(args[i], "<") == 0) {
-      if (cmd_end == -1) cmd_end = i;
-      input_file = args[i+1];
-    } else if (strcmp(args[i], ">") == 0) {
-      if (cmd_end == -1) cmd_end = i;
-      output_file = args[i+1];
-    } else if (strcmp(args[i], ">>") == 0) {
-      if (cmd_end == -1) cmd_end = i;
-      output_file = args[i+1];
-      append = 1;
-    } else if (strcmp(args[i], "2>") == 0) {
-      if (cmd_end == -1) cmd_end = i;
-      err_file = args[i+1];
-    } else if (strcmp(args[i], "&>") == 0) {
-      if (cmd_end == -1) cmd_end = i;
-      output_file = args[i+1];
-      redirect_err = 1;
-    }
-  }
-  
-  if (cmd_end != -1) {
-    args[cmd_end] = NULL;
-  }
-
-  if (input_file) {
-    int fd_in = open(input_file, O_RDONLY);
-    if (fd_in < 0) { perror("myshell: input file"); exit(EXIT_FAILURE); }
-    dup2(fd_in, STDIN_FILENO);
-    close(fd_in);
-  }
-  
-  if (output_file) {
-    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
-    int fd_out = open(output_file, flags, 0644);
-    if (fd_out < 0) { perror("myshell: output file"); exit(EXIT_FAILURE); }
-    dup2(fd_out, STDOUT_FILENO);
-    if (redirect_err) {
-        dup2(fd_out, STDERR_FILENO);
-    }
-    close(fd_out);
-  }
-  
-  if (err_file && !redirect_err) {
-      int fd_err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-      if (fd_err < 0) { perror("myshell: err file"); exit(EXIT_FAILURE); }
-      dup2(fd_err, STDERR_FILENO);
-      close(fd_err);
-  }
-}
-
-int shell_launch(char **args, int run_bg)
-{
-  pid_t pid, wpid;
-  int status;
+// A break, continue or return is on its way out: stop running commands
+// until the loop or function it belongs to is reached.
+#define UNWINDING() (pending_break || pending_return)
+
+static int call_function(struct Function *f, char **argv);
+
+// Process substitutions made for the commands running now: the shell's end
+// of each pipe, which the command sees as /dev/fd/N, and the child at the
+// other end. They are closed once the command that used them is done.
+struct Subst {
+  int fd;
+  pid_t pid;
+};
+static struct Subst *substs;
+static int nsubsts, substs_cap;
+// Children of finished substitutions that had not exited yet
+static pid_t *lingering;
+static int nlingering, lingering_cap;
+
+// Append one descriptor operation to r.
+void redir_add(struct Redirs *r, int fd, int src, int owned) {
+  if (r->nops == r->cap) {
+    int cap = r->cap ? r->cap * 2 : 4;
+    r->ops = arena_grow(&cmd_arena, r->ops, r->cap * sizeof(struct FdOp), cap * sizeof(struct FdOp));
+    r->cap = cap;
+  }
+  r->ops[r->nops++] = (struct FdOp){ fd, src, owned };
+}
+
+// A here-document's contents as a file: a memfd, sealed and rewound. No
+// temporary file to clean up, and unlike a pipe the shell never blocks
+// writing a body larger than the pipe buffer. Returns -1 on failure.
+static int inline_fd(const char *data) {
+  int fd = memfd_create("myshell-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) return -1;
+  size_t len = strlen(data), off = 0;
+  while (off < len) {
+    ssize_t n = write(fd, data + off, len - off);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      close(fd);
+      return -1;
+    }
+    off += n;
+  }
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+// The descriptor a redirection reads its data from, opened close-on-exec
+// (dup2() clears that on the copy the child gets). -1 on failure.
+static int open_target(struct Redir *rd) {
+  if (rd->type == REDIR_HEREDOC || rd->type == REDIR_HEREDOC_STRIP || rd->type == REDIR_HERESTRING) {
+    char *data;
+    if (rd->type == REDIR_HERESTRING) {
+      // The expanded word plus a newline
+      char *word = expand_word_nosplit(&rd->target, &cmd_arena);
+      size_t n = strlen(word);
+      data = arena_alloc(&cmd_arena, n + 2);
+      memcpy(data, word, n);
+      memcpy(data + n, "\n", 2);
+    } else {
+      data = expand_heredoc(&rd->target, rd->type == REDIR_HEREDOC_STRIP, rd->literal, &cmd_arena);
+    }
+    int fd = inline_fd(data);
+    if (fd < 0) perror("myshell: here-document");
+    return fd;
+  }
+
+  int flags;
+  switch (rd->type) {
+  case REDIR_IN: flags = O_RDONLY; break;
+  case REDIR_RDWR: flags = O_RDWR | O_CREAT; break;
+  case REDIR_APPEND: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+  default: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+  }
+  char *file = expand_word_nosplit(&rd->target, &cmd_arena);
+  int fd = open(file, flags | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "myshell: ");
+    perror(file);
+  }
+  return fd;
+}
+
+static void pass_substs(struct Redirs *r, int from, int to);
+
+// Resolve a command's parsed redirections, in order, into descriptor
+// operations: files and here-documents are opened here, `N>&M` and `N<&-`
+// become a dup or a close. Returns 0 (with nothing left open) on error.
+int build_redirections(struct Redir *list, struct Redirs *r) {
+  int first_subst = nsubsts;
+  memset(r, 0, sizeof(*r));
+
+  for (struct Redir *rd = list; rd; rd = rd->next) {
+    if (rd->type == REDIR_DUP_IN || rd->type == REDIR_DUP_OUT) {
+      char *word = expand_word_nosplit(&rd->target, &cmd_arena);
+      char *end;
+      long src = strtol(word, &end, 10);
+      if (strcmp(word, "-") == 0) {
+        redir_add(r, rd->fd, -1, 0);
+      } else if (*word && !*end && src >= 0 && src < INT_MAX) {
+        redir_add(r, rd->fd, src, 0);
+      } else {
+        fprintf(stderr, "myshell: %s: ambiguous redirect\n", word);
+        close_redirections(r);
+        return 0;
+      }
+      continue;
+    }
+    int fd = open_target(rd);
+    if (fd < 0) {
+      close_redirections(r);
+      return 0;
+    }
+    redir_add(r, rd->fd, fd, 1);
+    if (rd->type == REDIR_OUT_ERR) redir_add(r, 2, 1, 0);
+  }
+
+  // A descriptor we opened must survive until its own dup2(): move it out
+  // of the way of every fd the list writes to (`4<a 3<b` may open a as 3)
+  for (int i = 0; i < r->nops; i++) {
+    if (!r->ops[i].owned) continue;
+    for (int j = 0; j < r->nops; j++) {
+      if (r->ops[j].fd != r->ops[i].src || i == j) continue;
+      int moved = fcntl(r->ops[i].src, F_DUPFD_CLOEXEC, 10);
+      close(r->ops[i].src);
+      r->ops[i].src = moved;
+      break;
+    }
+  }
+  // <(cmd) as a redirection target: the command needs the pipe too
+  pass_substs(r, first_subst, nsubsts);
+  return 1;
+}
+
+void close_redirections(struct Redirs *r) {
+  for (int i = 0; i < r->nops; i++) {
+    if (r->ops[i].owned && r->ops[i].src >= 0) close(r->ops[i].src);
+  }
+  r->nops = 0;
+}
+
+// Carry out the operations in a forked child. Returns 0 on failure.
+static int apply_redirections(struct Redirs *r) {
+  for (int i = 0; i < r->nops; i++) {
+    struct FdOp *op = &r->ops[i];
+    int ok;
+    if (op->src < 0) {
+      close(op->fd);
+      continue;
+    }
+    // dup2() onto itself would leave close-on-exec set
+    if (op->src == op->fd) ok = fcntl(op->fd, F_SETFD, 0) == 0;
+    else ok = dup2(op->src, op->fd) >= 0;
+    if (!ok) {
+      fprintf(stderr, "myshell: %d: %s\n", op->src, strerror(errno));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Hand substitutions from..to-1 to the command: the same descriptor,
+// without close-on-exec.
+static void pass_substs(struct Redirs *r, int from, int to) {
+  for (int i = from; i < to; i++) redir_add(r, substs[i].fd, substs[i].fd, 0);
+}
+
+static void close_foreign_substs(struct Redirs *r) {
+  for (int i = 0; i < nsubsts; i++) {
+    int passed = 0;
+    for (int j = 0; r && j < r->nops && !passed; j++) passed = r->ops[j].fd == substs[i].fd;
+    if (!passed) close(substs[i].fd);
+  }
+  // Not this process's to close or reap
+  nsubsts = 0;
+  nlingering = 0;
+}
+
+// The PATH=... entry of an environment, without the name; NULL if none.
+static const char *env_path(char **envp) {
+  for (; envp && *envp; envp++) {
+    if (strncmp(*envp, "PATH=", 5) == 0) return *envp + 5;
+  }
+  return NULL;
+}
+
+// Exec an already-resolved command in the child. Never returns.
+static void exec_resolved(const char *path, char **args, char **envp) {
+  if (path == NULL) {
+    fprintf(stderr, "myshell: %s: command not found\n", args[0]);
+    exit(127);
+  }
+  execve(path, args, envp);
+  if ((errno == ENOENT || errno == ENOTDIR) && !strchr(args[0], '/')) {
+    // The location found earlier is gone: search the command's PATH
+    // again, once, in case the program is also further along it
+    char *again = pathcache_search(args[0], env_path(envp));
+    if (!again) {
+      fprintf(stderr, "myshell: %s: command not found\n", args[0]);
+      exit(127);
+    }
+    if (strcmp(again, path) != 0) execve(path = again, args, envp);
+  }
+  if (errno == ENOEXEC) {
+    // No shebang: hand the file to /bin/sh like execvp() does
+    int argc = 0;
+    while (args[argc]) argc++;
+    char **sh_args = malloc((argc + 2) * sizeof(char*));
+    sh_args[0] = "/bin/sh";
+    sh_args[1] = (char *)path;
+    for (int i = 1; i <= argc; i++) sh_args[i + 1] = args[i];
+    execve("/bin/sh", sh_args, envp);
+  }
+  int err = errno;
+  fprintf(stderr, "myshell: %s: %s\n", path, strerror(err));
+  exit(err == ENOENT ? 127 : 126);
+}
+
+static const int child_default_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+#define NUM_CHILD_SIGNALS (int)(sizeof(child_default_signals) / sizeof(int))
 
-  pid = fork();
+// Children left in the shell's own process group only get SIGINT back;
+// job-control signals stay ignored since nobody could fg them.
+static int child_signal_count(struct LaunchSpec *ls) {
+  return ls->pgid >= 0 ? NUM_CHILD_SIGNALS : 1;
+}
+
+#define RELAY_CHUNK 65536
+
+// Body of a relay stage: move stdin to stdout with splice(). Both are pipes,
+// so pages change hands in the kernel and nothing is copied through user
+// space. With a rate, sleep whenever more has gone through than the rate
+// allows so far. Returns the exit status.
+static int relay(long rate) {
+  size_t chunk = RELAY_CHUNK;
+  int cap = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+  if (cap > 0 && (size_t)cap > chunk) chunk = cap;
+  // About ten wakeups a second at low rates, rather than one large burst
+  if (rate > 0 && (size_t)rate / 10 < chunk) chunk = rate / 10 ? rate / 10 : 1;
+  long long moved = 0;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (1) {
+    ssize_t n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return n < 0 && errno != EPIPE;
+    if (rate <= 0) continue;
+    moved += n;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ahead = (double)moved / rate - (now.tv_sec - start.tv_sec) - (now.tv_nsec - start.tv_nsec) / 1e9;
+    if (ahead > 0) {
+      struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+      while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    }
+  }
+}
+
+// Scheduling attributes and limits for the processes of one job, from
+// `@cpus=`, `@nice=` and `@mem=` words (and `set -o bgpin`).
+#define ATTR_CPUS 1
+#define ATTR_NICE 2
+#define ATTR_MEM  4
+
+struct ProcAttrs {
+  int set;            // ATTR_* bits: which of the fields below apply
+  cpu_set_t cpus;     // sched_setaffinity()
+  int nice;           // setpriority(), an absolute niceness
+  long mem;           // RLIMIT_AS, soft and hard, in bytes
+};
+
+// Apply a to the calling process, a child that has not exec'd yet. A
+// setting that cannot be applied stops the command rather than letting
+// it run unconstrained.
+static void apply_attrs(const struct ProcAttrs *a) {
+  if ((a->set & ATTR_CPUS) && sched_setaffinity(0, sizeof(a->cpus), &a->cpus) < 0) {
+    perror("myshell: @cpus");
+    exit(126);
+  }
+  if ((a->set & ATTR_NICE) && setpriority(PRIO_PROCESS, 0, a->nice) < 0) {
+    perror("myshell: @nice");
+    exit(126);
+  }
+  if (a->set & ATTR_MEM) {
+    struct rlimit rl = { (rlim_t)a->mem, (rlim_t)a->mem };
+    if (setrlimit(RLIMIT_AS, &rl) < 0) {
+      perror("myshell: @mem");
+      exit(126);
+    }
+  }
+}
+
+// Classic backend: fork() the whole shell and set the child up by hand.
+// This is also the only way to run a subshell (ls->node).
+static pid_t launch_fork(struct LaunchSpec *ls, char **envp) {
+  fflush(NULL);
+  pid_t pid = fork();
   if (pid == 0) {
     // Child process
-    pid_t cpid = getpid();
-    setpgid(cpid, cpid);
-    if (!run_bg) {
-        tcsetpgrp(shell_terminal, cpid);
+    if (ls->pgid >= 0) {
+      pid_t cpid = getpid();
+      setpgid(cpid, ls->pgid ? ls->pgid : cpid);
+      if (ls->foreground) {
+        tcsetpgrp(shell_terminal, ls->pgid ? ls->pgid : cpid);
+      }
     }
-    
+
     // Restore default signal handlers for the child
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
-    
-    setup_redirection(args);
-    if (execvp(args[0], args) == -1) {
-      perror("myshell");
-    }
-    exit(EXIT_FAILURE);
+    for (int i = 0; i < (ls->node ? NUM_CHILD_SIGNALS : child_signal_count(ls)); i++) {
+      signal(child_default_signals[i], SIG_DFL);
+    }
+    sigprocmask(SIG_SETMASK, event_child_sigmask(), NULL);
+    if (ls->attrs) apply_attrs(ls->attrs);
+
+    if (ls->in_fd >= 0) dup2(ls->in_fd, STDIN_FILENO);
+    if (ls->out_fd >= 0) dup2(ls->out_fd, STDOUT_FILENO);
+    if (ls->redir && !apply_redirections(ls->redir)) exit(1);
+
+    if (ls->relay) {
+      // Nothing of the shell's is needed past stdin, stdout and stderr
+      close_range(3, ~0U, 0);
+      exit(relay(ls->rate));
+    }
+    if (ls->node || ls->builtin || ls->func) {
+      // Subshell: no job control of its own, children stay in its group.
+      // It never execs, so close-on-exec does not keep it from holding
+      // other commands' substitution pipes open; close those.
+      job_control = 0;
+      close_foreign_substs(ls->redir);
+      if (ls->node) {
+        shell_execute_node(ls->node);
+      } else {
+        for (char **a = ls->assigns; a && *a; a++) {
+          char *eq = strchr(*a, '=');
+          var_setn(*a, eq - *a, eq + 1, VAR_EXPORT);
+        }
+        if (ls->func) {
+          call_function(ls->func, ls->args);
+        } else {
+          execute_builtin(ls->args);
+          set_simple_status(builtin_status);
+        }
+      }
+      exit(last_command_status);
+    }
+    exec_resolved(ls->path, ls->args, envp);
   } else if (pid < 0) {
-    // Error forking
-    perror("myshell");
-  } else {
-    // Parent process
-    setpgid(pid, pid); // Prevent race condition
-    
-    // Copy the command for display
-    char cmd[1024] = {0};
-    for(int j=0; args[j]!=NULL; j++) {
-        strcat(cmd, args[j]);
-        if(args[j+1]!=NULL) strcat(cmd, " ");
-    }
-    
-    if (!run_bg) {
-      tcsetpgrp(shell_terminal, pid);
-      add_job(pid, 0, cmd);
-      struct Job *j = find_job_by_pid(pid);
-      if (j) wait_for_job(j);
+    perror("myshell: fork");
+  }
+  return pid;
+}
+
+// posix_spawn() backend. glibc implements it with clone(CLONE_VM|CLONE_VFORK),
+// so the shell's page tables are never copied. Everything the fork path does
+// in the child is expressed as spawn attributes and file actions; the
+// terminal hand-off for foreground jobs is done by the parent instead.
+// Returns -1 with errno set, and nothing printed, if the program could
+// not be started.
+static pid_t launch_spawn(struct LaunchSpec *ls, char **envp) {
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  sigset_t defaults;
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  pid_t pid;
+
+  posix_spawnattr_init(&attr);
+  posix_spawn_file_actions_init(&actions);
+
+  sigemptyset(&defaults);
+  for (int i = 0; i < child_signal_count(ls); i++) {
+    sigaddset(&defaults, child_default_signals[i]);
+  }
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, event_child_sigmask());
+
+  if (ls->pgid >= 0) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, ls->pgid);
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  if (ls->in_fd >= 0) posix_spawn_file_actions_adddup2(&actions, ls->in_fd, STDIN_FILENO);
+  if (ls->out_fd >= 0) posix_spawn_file_actions_adddup2(&actions, ls->out_fd, STDOUT_FILENO);
+  for (int i = 0; ls->redir && i < ls->redir->nops; i++) {
+    struct FdOp *op = &ls->redir->ops[i];
+    if (op->src < 0) posix_spawn_file_actions_addclose(&actions, op->fd);
+    else posix_spawn_file_actions_adddup2(&actions, op->src, op->fd);
+  }
+
+  int err = posix_spawn(&pid, ls->path, &actions, &attr, ls->args, envp);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+// After a failed launch: if ls->path came from the command cache and the
+// file is gone, forget it and look the name up on PATH again. Returns 1
+// if that found another location to try.
+static int stale_location(struct LaunchSpec *ls) {
+  int found;
+  if ((errno != ENOENT && errno != ENOTDIR) || strchr(ls->args[0], '/')) return 0;
+  if (pathcache_peek(ls->args[0], &found) != ls->path) return 0;
+  pathcache_forget(ls->args[0]);
+  ls->path = pathcache_lookup(ls->args[0]);
+  return ls->path != NULL;
+}
+
+// Start one external process as described by ls, using the backend selected
+// with `set -o spawn`. Returns the child's pid, or -1 if nothing was started.
+pid_t launch_process(struct LaunchSpec *ls) {
+  if (launch_hook) launch_hook();
+  // Builtins, functions and subshells apply ls->assigns to the shell's
+  // own variables
+  if (ls->node || ls->builtin || ls->func || ls->relay) return launch_fork(ls, NULL);
+
+  // Nothing to spawn; let the fork path report it from a child, under
+  // the command's redirections and with status 127, so pipelines still
+  // see a process on each stage
+  if (ls->path == NULL) return launch_fork(ls, NULL);
+
+  // Cached until the exported variables change; only per-command
+  // assignments need an array of their own
+  char **envp = ls->assigns ? vars_environ_with(ls->assigns) : vars_environ();
+  pid_t pid = -1;
+  int spawned = 0;
+  // posix_spawn() has no attributes for CPUs, niceness or limits, and
+  // setting them in the shell around the call would not be undoable
+  if (shell_options[OPT_SPAWN] && !ls->attrs) {
+    pid = launch_spawn(ls, envp);
+    if (pid < 0 && stale_location(ls)) pid = launch_spawn(ls, envp);
+    // Scripts without a #! line need the /bin/sh fallback in exec_resolved(),
+    // and other errors are reported from the child, like `command not found`
+    spawned = pid >= 0;
+  }
+  if (!spawned) pid = launch_fork(ls, envp);
+  if (ls->assigns) free(envp);
+  return pid;
+}
+
+int *pipe_status = NULL;
+int pipe_status_count = 0;
+
+static int exit_code(int wstatus) {
+  if (WIFEXITED(wstatus)) return WEXITSTATUS(wstatus);
+  if (WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+  if (WIFSTOPPED(wstatus)) return 128 + WSTOPSIG(wstatus);
+  return 0;
+}
+
+// Publish a finished (or stopped) foreground job as $? and $PIPESTATUS.
+void record_job_status(struct Job *job) {
+  int n = 0;
+  pipe_status = realloc(pipe_status, (job->nprocs ? job->nprocs : 1) * sizeof(int));
+  for (struct Process *p = job->procs; p; p = p->next) {
+    if (p->relay) continue;
+    if (p->stopped && !p->completed) {
+      pipe_status[n++] = 128 + SIGTSTP;
     } else {
-      add_job(pid, 1, cmd);
-      struct Job *j = find_job_by_pid(pid);
-      if (j) printf("[%d] %d\n", j->id, pid);
+      pipe_status[n++] = exit_code(p->status);
     }
   }
+  pipe_status_count = n;
+  last_command_status = n ? pipe_status[n - 1] : 0;
+}
 
-  return 1;
+// Status of anything that ran without a job (builtins, syntax errors).
+void set_simple_status(int status) {
+  pipe_status = realloc(pipe_status, sizeof(int));
+  pipe_status[0] = status;
+  pipe_status_count = 1;
+  last_command_status = status;
 }
 
-int shell_execute(char **args)
-{
-  int i;
-  int run_bg = 0;
+// Aliases being expanded right now, so `alias ls='ls -F'` terminates.
+#define ALIAS_DEPTH_MAX 32
+static const char *alias_stack[ALIAS_DEPTH_MAX];
+static int alias_depth = 0;
+
+// If the command's first word is an unquoted alias name, splice the alias
+// text into the command's source and parse the result. Returns NULL when
+// there is nothing to expand.
+static struct Node *expand_alias(struct Node *cmd) {
+  if (cmd->cmd.argc == 0 || alias_depth == ALIAS_DEPTH_MAX) return NULL;
+
+  struct Word *w = &cmd->cmd.argv[0];
+  for (int i = 0; i < w->len; i++) {
+    if (strchr("'\"\\$", w->text[i])) return NULL;
+  }
+
+  // Looked up straight from the source span: no copy unless it is an alias
+  struct Symbol *sym = sym_lookupn(w->text, w->len);
+  if (!sym || !sym->alias) return NULL;
+  for (int i = 0; i < alias_depth; i++) {
+    if (alias_stack[i] == sym->name) return NULL;
+  }
+  const char *value = sym->alias;
+
+  const char *src_end = cmd->src.text + cmd->src.len;
+  size_t prefix = w->text - cmd->src.text;
+  size_t vlen = strlen(value);
+  size_t rest = src_end - (w->text + w->len);
+  char *text = arena_alloc(&cmd_arena, prefix + vlen + rest + 2);
+  memcpy(text, cmd->src.text, prefix);
+  memcpy(text + prefix, value, vlen);
+  text[prefix + vlen] = ' ';
+  memcpy(text + prefix + vlen + 1, w->text + w->len, rest);
+  text[prefix + vlen + 1 + rest] = '\0';
+
+  int status;
+  struct Node *n = parse_spliced(text, &cmd_arena, &status, cmd->cmd.redirs);
+  if (!n) {
+    set_simple_status(status == PARSE_OK ? 0 : 2);
+    return NULL;
+  }
+  alias_stack[alias_depth++] = sym->name;
+  return n;
+}
+
+// Follow aliases on a command node until there is nothing left to expand.
+// Returns the node to run in its place (n itself if no alias applies).
+// The caller restores alias_depth once it is done with the result.
+static struct Node *resolve_command(struct Node *n) {
+  struct Node *expanded;
+  while (n->type == NODE_COMMAND && (expanded = expand_alias(n)) != NULL) n = expanded;
+  return n;
+}
+
+// Settings for a whole pipeline, from `@name=value` words in front of
+// its first command: `@pipesize=1M zcat big.gz | sort`. The process
+// attributes can also be given to a later stage, for that stage alone.
+struct LaunchOpts {
+  long pipesize;      // capacity of the pipes between stages, 0: $PIPESIZE
+  int packet;         // O_DIRECT pipes (or `set -o pipepacket`)
+  int relay;          // a splice() relay process between every two stages
+  long rate;          // relay: bytes a second at most, 0 for no limit
+  struct ProcAttrs attrs;
+};
+
+// One stage of a pipeline, ready to launch: an external command, builtin
+// or function (argv), or a node that has to run in a forked subshell.
+struct Stage {
+  char **argv;
+  char **assigns;     // leading NAME=value words, expanded; NULL if none
+  struct Node *node;
+  struct Redir *redirs;
+  int builtin;
+  struct Function *func;
+  int subst_from;     // the process substitutions in its words, as indexes
+  int subst_to;       // into substs[]
+  struct LaunchOpts opts;
+  int failed;         // an expansion failed: not run, status 1
+};
+
+static int is_assignment(const char *text, int len) {
+  int name_len = var_name_len(text, len);
+  return name_len > 0 && name_len < len && text[name_len] == '=';
+}
+
+// A byte count: digits with an optional K, M or G (powers of 1024).
+// Returns -1 if s is not one.
+static long parse_size(const char *s) {
+  char *end;
+  errno = 0;
+  long n = strtol(s, &end, 10);
+  if (end == s || n < 0 || errno) return -1;
+  int shift = 0;
+  switch (*end) {
+  case 'k': case 'K': shift = 10; end++; break;
+  case 'm': case 'M': shift = 20; end++; break;
+  case 'g': case 'G': shift = 30; end++; break;
+  }
+  if (*end || n > LONG_MAX >> shift) return -1;
+  return n << shift;
+}
+
+// A CPU list as taskset takes it: "0-3,8,10-11". Returns 0 if s is not one.
+static int parse_cpus(const char *s, cpu_set_t *set) {
+  CPU_ZERO(set);
+  do {
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end == s || lo < 0) return 0;
+    if (*end == '-') {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s || hi < lo) return 0;
+    }
+    if (hi >= CPU_SETSIZE) return 0;
+    for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+    s = end;
+  } while (*s++ == ',');
+  return s[-1] == '\0';
+}
+
+static const char *const launch_opt_names[] = {
+  "pipesize", "packet", "relay", "rate", "cpus", "nice", "mem", NULL
+};
 
-  if (args[0] == NULL) {
-    // An empty command was entered.
+// If w is an unquoted `@name=value` (or `@name`) for a known name, apply it
+// to o and return 1. Any other word is left to be the command.
+static int launch_opt(struct Word *w, struct LaunchOpts *o) {
+  int len = 1;
+  if (w->len < 2 || w->text[0] != '@') return 0;
+  while (len < w->len && w->text[len] >= 'a' && w->text[len] <= 'z') len++;
+  if (len < w->len && w->text[len] != '=') return 0;
+  int i = 0;
+  while (launch_opt_names[i] && (strncmp(launch_opt_names[i], w->text + 1, len - 1) != 0 ||
+                                 launch_opt_names[i][len - 1] != '\0')) i++;
+  if (!launch_opt_names[i]) return 0;
+
+  char *word = expand_word_nosplit(w, &cmd_arena);
+  const char *value = word[len] == '=' ? word + len + 1 : NULL;
+  long n = 1;
+  cpu_set_t cpus;
+  char *end;
+  int ok = value || i == 1 || i == 2;   // only @packet and @relay go without
+  if (value && i == 4) {
+    ok = parse_cpus(value, &cpus);
+  } else if (value && i == 5) {
+    n = strtol(value, &end, 10);
+    ok = end != value && *end == '\0' && n >= -20 && n <= 19;
+  } else if (value) {
+    ok = (n = parse_size(value)) >= 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "myshell: %s: invalid value, ignored\n", word);
     return 1;
   }
+  switch (i) {
+  case 0: o->pipesize = n; break;
+  case 1: o->packet = n != 0; break;
+  case 2: o->relay = n != 0; break;
+  case 3: o->rate = n; o->relay = n > 0; break;
+  case 4: o->attrs.cpus = cpus; o->attrs.set |= ATTR_CPUS; break;
+  case 5: o->attrs.nice = n; o->attrs.set |= ATTR_NICE; break;
+  case 6: o->attrs.mem = n; o->attrs.set |= ATTR_MEM; break;
+  }
+  return 1;
+}
+
+// Where the program `name` is. With a `PATH=...` among the command's own
+// assignments, that PATH is searched, without the cache (which belongs to
+// the shell's PATH); otherwise the cache is used.
+static const char *command_path(char **assigns, const char *name) {
+  const char *path = NULL;
+  for (char **a = assigns; a && *a; a++) {
+    if (strncmp(*a, "PATH=", 5) == 0) path = *a + 5;   // the last one wins
+  }
+  if (!path || strchr(name, '/')) return pathcache_lookup(name);
+  char *found = pathcache_search(name, path);
+  char *copy = found ? arena_strdup(&cmd_arena, found) : NULL;
+  free(found);
+  return copy;
+}
+
+static void prepare_stage(struct Node *n, struct Stage *st) {
+  memset(st, 0, sizeof(*st));
+  st->subst_from = nsubsts;
+  expand_error = 0;
+  switch (n->type) {
+  case NODE_COMMAND: {
+    // @name=value words come first, then NAME=value assignments
+    int nopts = 0;
+    while (nopts < n->cmd.argc && launch_opt(&n->cmd.argv[nopts], &st->opts)) nopts++;
+    struct Word *words = n->cmd.argv + nopts;
+    int nwords = n->cmd.argc - nopts;
+    int nassign = 0;
+    while (nassign < nwords && is_assignment(words[nassign].text, words[nassign].len)) nassign++;
+    // $? after `x=$(cmd)` is cmd's, so start from 0 and let substitutions set it
+    if (nassign > 0 && nassign == nwords) set_simple_status(0);
+    if (nassign > 0) {
+      st->assigns = arena_alloc(&cmd_arena, (nassign + 1) * sizeof(char *));
+      for (int i = 0; i < nassign; i++) {
+        st->assigns[i] = expand_word_nosplit(&words[i], &cmd_arena);
+      }
+      st->assigns[nassign] = NULL;
+    }
+    st->argv = expand_words(words + nassign, nwords - nassign, &cmd_arena);
+    st->redirs = n->cmd.redirs;
+    // Functions come before builtins of the same name
+    struct Symbol *sym = st->argv[0] ? sym_lookup(st->argv[0]) : NULL;
+    st->func = sym ? sym->func : NULL;
+    st->builtin = sym && !sym->func && sym->builtin;
+    // `command name` runs the binary even where a builtin or function shadows it
+    if (st->argv[0] && strcmp(st->argv[0], "command") == 0 &&
+        st->argv[1] && st->argv[1][0] != '-') {
+      st->argv++;
+      st->func = NULL;
+      st->builtin = is_builtin(st->argv[0]) && !command_path(st->assigns, st->argv[0]);
+    }
+    break;
+  }
+  case NODE_SUBSHELL:
+    st->node = n->sub.body;
+    st->redirs = n->sub.redirs;
+    break;
+  default:
+    st->node = n;
+    break;
+  }
+  st->subst_to = nsubsts;
+  st->failed = expand_error;
+}
+
+// The most F_SETPIPE_SZ accepts without privileges, read once.
+static long pipe_max_size(void) {
+  static long max;
+  if (!max) {
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "re");
+    if (!f || fscanf(f, "%ld", &max) != 1 || max <= 0) max = 1048576;
+    if (f) fclose(f);
+  }
+  return max;
+}
+
+// Open a pipe between two stages, close-on-exec. size, when set, is the
+// capacity to ask for, capped at pipe-max-size; the kernel rounds it up to
+// a power-of-two number of pages and keeps its default if it cannot grant
+// it. packet pipes keep each write() a separate read().
+static int open_pipe(int fds[2], long size, int packet) {
+  if (pipe2(fds, O_CLOEXEC | (packet ? O_DIRECT : 0)) < 0) return -1;
+  if (size > 0) fcntl(fds[1], F_SETPIPE_SZ, (int)(size < pipe_max_size() ? size : pipe_max_size()));
+  return 0;
+}
+
+// $PIPESIZE, the capacity for pipes whose pipeline sets none. 0 if unset.
+static long pipesize_setting(void) {
+  const char *v = var_get("PIPESIZE");
+  if (!v || !*v) return 0;
+  long n = parse_size(v);
+  if (n < 0) {
+    fprintf(stderr, "myshell: PIPESIZE: %s: invalid size\n", v);
+    return 0;
+  }
+  return n;
+}
+
+static unsigned bg_pin_next;
 
-  // Check for background process
-  int last_idx = 0;
-  while (args[last_idx] != NULL) last_idx++;
-  if (last_idx > 0 && strcmp(args[last_idx-1], "&") == 0) {
-    run_bg = 1;
-    args[last_idx-1] = NULL;
+// The CPUs for the next background job under `set -o bgpin`: the CPU
+// lists in $BGCPUS ("0-3 4-7") in turn, or else each CPU the shell may
+// run on, one at a time. Returns 0 if there is nothing to pin to.
+static int next_bg_cpus(cpu_set_t *set) {
+  const char *v = var_get("BGCPUS");
+  if (v && *v) {
+    int n = 0;
+    for (const char *p = v; *p; ) {
+      p += strspn(p, " \t");
+      if (*p) n++;
+      p += strcspn(p, " \t");
+    }
+    if (n == 0) return 0;
+    int k = bg_pin_next++ % n;
+    const char *p = v + strspn(v, " \t");
+    while (k-- > 0) {
+      p += strcspn(p, " \t");
+      p += strspn(p, " \t");
+    }
+    char *list = strndup(p, strcspn(p, " \t"));
+    int ok = parse_cpus(list, set);
+    if (!ok) fprintf(stderr, "myshell: BGCPUS: %s: invalid CPU list\n", list);
+    free(list);
+    return ok;
   }
 
-  // Check for pipe
-  int pipe_idx = -1;
-  for (i = 0; args[i] != NULL; i++) {
-    if (strcmp(args[i], "|") == 0) {
-      pipe_idx = i;
+  cpu_set_t own;
+  if (sched_getaffinity(0, sizeof(own), &own) < 0 || CPU_COUNT(&own) == 0) return 0;
+  int k = bg_pin_next++ % CPU_COUNT(&own);
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (CPU_ISSET(c, &own) && k-- == 0) {
+      CPU_ZERO(set);
+      CPU_SET(c, set);
       break;
     }
   }
+  return 1;
+}
 
-  if (pipe_idx != -1) {
-    args[pipe_idx] = NULL;
-    char **left_args = args;
-    char **right_args = &args[pipe_idx + 1];
+// Add a started process to the job, in its process group.
+static void join_job(struct Job *job, pid_t pid) {
+  if (job_control) {
+    if (job->pgid == 0) job->pgid = pid;
+    setpgid(pid, job->pgid); // Prevent race condition
+  }
+  add_process(job, pid, 0);
+}
 
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
+// Put a relay process after the pipe read end in_fd. Returns the read end
+// of the relay's own output pipe, which takes in_fd's place, or in_fd if no
+// relay could be started.
+static int start_relay(struct Job *job, int in_fd, struct LaunchOpts *opts, const struct ProcAttrs *attrs,
+                       long pipesize, int packet) {
+  int pipefd[2];
+  if (open_pipe(pipefd, pipesize, packet) < 0) {
+    perror("myshell: pipe");
+    return in_fd;
+  }
+  struct LaunchSpec ls = {
+    .in_fd = in_fd,
+    .out_fd = pipefd[1],
+    .pgid = job_control ? job->pgid : -1,
+    .relay = 1,
+    .rate = opts->rate,
+    .attrs = attrs->set ? attrs : NULL
+  };
+  pid_t pid = launch_process(&ls);
+  close(pipefd[1]);
+  if (pid < 0) {
+    close(pipefd[0]);
+    return in_fd;
+  }
+  join_job(job, pid);
+  job->last_proc->relay = 1;
+  close(in_fd);
+  return pipefd[0];
+}
+
+// Run `a | b | ... | z` as a single job. Every stage joins the process
+// group of the first one, so the terminal, Ctrl+Z, fg and bg treat the
+// pipeline as one unit.
+static void run_stages(struct Stage *stages, int nstages, struct Word *src, int run_bg)
+{
+  char *cmd = strndup(src->text, src->len);
+  struct Job *job = add_job(run_bg, cmd);
+  free(cmd);
+
+  int in_fd = -1;
+  pid_t last_pid = 0;
+  // The first stage's @ words set up the pipes for the whole pipeline
+  struct LaunchOpts *opts = &stages[0].opts;
+  long pipesize = 0;
+  int packet = 0;
+  if (nstages > 1) {
+    pipesize = opts->pipesize ? opts->pipesize : pipesize_setting();
+    packet = opts->packet || shell_options[OPT_PIPEPACKET];
+  }
+  // ... and the attributes of every process in it
+  struct ProcAttrs job_attrs = opts->attrs;
+  if (run_bg && shell_options[OPT_BGPIN] && !(job_attrs.set & ATTR_CPUS) &&
+      next_bg_cpus(&job_attrs.cpus)) {
+    job_attrs.set |= ATTR_CPUS;
+  }
+
+  for (int s = 0; s < nstages; s++) {
+    struct Stage *st = &stages[s];
+
+    int pipefd[2] = { -1, -1 };
+    if (s < nstages - 1 && open_pipe(pipefd, pipesize, packet) < 0) {
       perror("myshell: pipe");
-      return 1;
+      if (in_fd >= 0) close(in_fd);
+      break;
     }
 
-    pid_t p1 = fork();
-    if (p1 == 0) {
-      // Child 1 (Left)
-      signal(SIGINT, SIG_DFL);
-      dup2(pipefd[1], STDOUT_FILENO);
-      close(pipefd[0]);
-      close(pipefd[1]);
-      setup_redirection(left_args);
-      if (execvp(left_args[0], left_args) == -1) {
-        perror("myshell");
+    struct Redirs redir;
+    pid_t pid = -1;
+    int failed_status = W_EXITCODE(1, 0);
+
+    // A later stage's own @cpus/@nice/@mem replace the pipeline's
+    struct ProcAttrs attrs = job_attrs;
+    const struct ProcAttrs *own = &st->opts.attrs;
+    if (s > 0 && (own->set & ATTR_CPUS)) attrs.cpus = own->cpus;
+    if (s > 0 && (own->set & ATTR_NICE)) attrs.nice = own->nice;
+    if (s > 0 && (own->set & ATTR_MEM)) attrs.mem = own->mem;
+    if (s > 0) attrs.set |= own->set;
+
+    if (!st->failed && build_redirections(st->redirs, &redir)) {
+      pass_substs(&redir, st->subst_from, st->subst_to);
+      struct LaunchSpec ls = {
+        .args = st->argv,
+        .assigns = st->assigns,
+        .path = NULL,
+        .node = st->node,
+        .builtin = st->builtin,
+        .func = st->func,
+        .redir = &redir,
+        .in_fd = in_fd,
+        .out_fd = pipefd[1],
+        .pgid = job_control ? job->pgid : -1,
+        .foreground = !run_bg,
+        .attrs = attrs.set ? &attrs : NULL
+      };
+      if (!st->node && st->argv[0] == NULL) {
+        failed_status = 0;      // redirections only
+      } else {
+        if (!st->node && !st->builtin && !st->func) {
+          ls.path = command_path(st->assigns, st->argv[0]);
+          if (ls.path == NULL) failed_status = W_EXITCODE(127, 0);
+        }
+        pid = launch_process(&ls);
       }
-      exit(EXIT_FAILURE);
+      close_redirections(&redir);
     }
 
-    pid_t p2 = fork();
-    if (p2 == 0) {
-      // Child 2 (Right)
-      signal(SIGINT, SIG_DFL);
-      dup2(pipefd[0], STDIN_FILENO);
-      close(pipefd[0]);
-      close(pipefd[1]);
-      setup_redirection(right_args);
-      if (execvp(right_args[0], right_args) == -1) {
-        perror("myshell");
-      }
-      exit(EXIT_FAILURE);
+    if (pid > 0) {
+      join_job(job, pid);
+      last_pid = pid;
+    } else {
+      add_process(job, 0, failed_status);
     }
 
-    close(pipefd[0]);
-    close(pipefd[1]);
+    if (in_fd >= 0) close(in_fd);
+    if (pipefd[1] >= 0) close(pipefd[1]);
+    in_fd = pipefd[0];
+    if (in_fd >= 0 && opts->relay) in_fd = start_relay(job, in_fd, opts, &job_attrs, pipesize, packet);
+  }
 
-    if (!run_bg) {
-      waitpid(p1, NULL, 0);
-      waitpid(p2, NULL, 0);
+  if (!run_bg) {
+    wait_for_job(job);
+  } else if (last_pid > 0) {
+    printf("[%d] %d\n", job->id, last_pid);
+    last_bg_pid = last_pid;
+  } else {
+    record_job_status(job);
+    remove_job(job);
+  }
+}
+
+static void run_pipeline(struct Node *n, int run_bg) {
+  struct Stage *stages = arena_alloc(&cmd_arena, n->pipe.n * sizeof(struct Stage));
+  int alias_mark = alias_depth;
+  for (int i = 0; i < n->pipe.n; i++) {
+    // A stage whose alias expands to more than a simple command runs as a subshell
+    prepare_stage(resolve_command(n->pipe.stages[i]), &stages[i]);
+    alias_depth = alias_mark;
+  }
+  run_stages(stages, n->pipe.n, &n->src, run_bg);
+}
+
+static int exec_node(struct Node *n, int run_bg);
+
+static void restore_shell(struct Redirs *redir);
+
+// Apply redirections to the shell's own descriptors, remembering what each
+// one was for restore_shell(). Returns 0 (status set) on error.
+static int redirect_shell(struct Redir *redirs, struct Redirs *redir) {
+  if (!build_redirections(redirs, redir)) {
+    set_simple_status(1);
+    return 0;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  redir->saved = arena_alloc(&cmd_arena, redir->nops * sizeof(struct FdOp));
+  for (int i = 0; i < redir->nops; i++) {
+    struct FdOp *op = &redir->ops[i];
+    int seen = 0;
+    for (int j = 0; j < redir->nsaved && !seen; j++) seen = redir->saved[j].fd == op->fd;
+    if (!seen) {
+      // -1 (EBADF): it was closed, and is closed again afterwards
+      struct FdOp *sv = &redir->saved[redir->nsaved++];
+      sv->fd = op->fd;
+      sv->src = fcntl(op->fd, F_DUPFD_CLOEXEC, 10);
+      sv->owned = 1;
+    }
+    if (op->src < 0) {
+      close(op->fd);
+    } else if (op->src != op->fd && dup2(op->src, op->fd) < 0) {
+      fprintf(stderr, "myshell: %d: %s\n", op->src, strerror(errno));
+      restore_shell(redir);
+      set_simple_status(1);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void restore_shell(struct Redirs *redir) {
+  fflush(stdout);
+  fflush(stderr);
+  while (redir->nsaved > 0) {
+    struct FdOp *sv = &redir->saved[--redir->nsaved];
+    if (sv->src >= 0) {
+      dup2(sv->src, sv->fd);
+      close(sv->src);
     } else {
-      printf("[Started background processes %d, %d]\n", p1, p2);
+      close(sv->fd);
+    }
+  }
+  close_redirections(redir);
+}
+
+// Run a builtin or function in the shell itself. Its redirections are
+// applied to the shell's own descriptors for the duration of the call and
+// undone after.
+static int run_in_shell(struct Stage *st) {
+  struct Redirs redir;
+  int res;
+
+  if (st->redirs && !redirect_shell(st->redirs, &redir)) return 1;
+
+  // `NAME=value builtin` changes the variable only while the builtin runs
+  struct VarSave *vars = st->assigns ? vars_push(st->assigns) : NULL;
+  if (st->func) {
+    res = call_function(st->func, st->argv);
+  } else {
+    res = execute_builtin(st->argv);
+    set_simple_status(builtin_status);
+  }
+  if (vars) vars_pop(vars);
+  // Anything the builtin printed must land before the next command's output
+  fflush(stdout);
+
+  if (st->redirs) restore_shell(&redir);
+  return res;
+}
+
+static int exec_command(struct Node *n, int run_bg) {
+  int alias_mark = alias_depth;
+  struct Node *target = resolve_command(n);
+  struct Stage st;
+  int res = 1;
+
+  if (target->type != NODE_COMMAND) {
+    res = exec_node(target, run_bg);
+    alias_depth = alias_mark;
+    return res;
+  }
+  prepare_stage(target, &st);
+  alias_depth = alias_mark;
+  if (st.failed) {
+    set_simple_status(1);
+    return res;
+  }
+
+  // Only assignments: they set shell variables, keeping the export flag of
+  // ones already exported
+  if (!st.argv[0] && st.assigns && !run_bg) {
+    for (char **a = st.assigns; *a; a++) {
+      char *eq = strchr(*a, '=');
+      var_setn(*a, eq - *a, eq + 1, 0);
+    }
+    if (st.redirs) run_stages(&st, 1, &n->src, 0);
+    return res;
+  }
+  // With @cpus/@nice/@mem they run in a child, not in the shell itself
+  if ((st.builtin || st.func) && !run_bg && !st.opts.attrs.set) return run_in_shell(&st);
+
+  run_stages(&st, 1, &n->src, run_bg);
+  return res;
+}
+
+static double seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void print_time(const char *label, double secs) {
+  fprintf(stderr, "%s\t%dm%.3fs\n", label, (int)(secs / 60), secs - (int)(secs / 60) * 60);
+}
+
+// `time body`: run it and report on stderr how long it took and what it
+// used. Its processes are measured by the usage wait4() returned for
+// them, builtins by what the shell itself used meanwhile.
+static int run_timed(struct Node *body) {
+  struct rusage outer = reaped_usage, self0, self1;
+  struct timespec t0, t1;
+  int res = 1;
+
+  memset(&reaped_usage, 0, sizeof(reaped_usage));
+  getrusage(RUSAGE_SELF, &self0);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (body) res = exec_node(body, 0);
+  else set_simple_status(0);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  getrusage(RUSAGE_SELF, &self1);
+
+  struct rusage ru = reaped_usage;
+  reaped_usage = outer;
+  rusage_add(&reaped_usage, &ru);
+
+  double real = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  double user = seconds(&ru.ru_utime) + seconds(&self1.ru_utime) - seconds(&self0.ru_utime);
+  double sys = seconds(&ru.ru_stime) + seconds(&self1.ru_stime) - seconds(&self0.ru_stime);
+  // Only builtins ran: the shell's own peak is the best there is
+  long maxrss = ru.ru_maxrss ? ru.ru_maxrss : self1.ru_maxrss;
+
+  print_time("\nreal", real);
+  print_time("user", user);
+  print_time("sys", sys);
+  fprintf(stderr, "maxrss\t%ldk\n", maxrss);
+  fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n",
+          ru.ru_nvcsw + self1.ru_nvcsw - self0.ru_nvcsw,
+          ru.ru_nivcsw + self1.ru_nivcsw - self0.ru_nivcsw);
+  fprintf(stderr, "faults\t%ld major, %ld minor\n",
+          ru.ru_majflt + self1.ru_majflt - self0.ru_majflt,
+          ru.ru_minflt + self1.ru_minflt - self0.ru_minflt);
+  return res;
+}
+
+// Called by a loop after its condition and after its body. Returns 1 when
+// the loop has to stop: a return, or a break for this loop or one around
+// it. A continue for this loop is used up here and the loop carries on.
+static int loop_done(void) {
+  if (pending_return) return 1;
+  if (!pending_break) return 0;
+  if (pending_break-- > 1) return 1;
+  if (pending_continue) {
+    pending_continue = 0;
+    return 0;
+  }
+  return 1;
+}
+
+static int run_if(struct Node *n) {
+  int res = exec_node(n->ctl.cond, 0);
+  if (!res || UNWINDING()) return res;
+  if (last_command_status == 0) return exec_node(n->ctl.body, 0);
+  if (n->ctl.orelse) return exec_node(n->ctl.orelse, 0);
+  set_simple_status(0);
+  return 1;
+}
+
+// while and until. The status is the last body's, 0 if it never ran. A
+// command killed by Ctrl+C ends the loop too, or `while :; do sleep 1;
+// done` could not be interrupted.
+static int run_loop(struct Node *n) {
+  int res, status = 0;
+  loop_depth++;
+  while (1) {
+    if (!(res = exec_node(n->ctl.cond, 0)) || loop_done()) break;
+    if ((last_command_status == 0) != (n->type == NODE_WHILE)) break;
+    if (!(res = exec_node(n->ctl.body, 0))) break;
+    status = last_command_status;
+    if (loop_done() || status == 128 + SIGINT) break;
+  }
+  loop_depth--;
+  if (res && !pending_return) set_simple_status(status);
+  return res;
+}
+
+static int run_for(struct Node *n) {
+  char **values;
+  int res = 1, status = 0;
+  if (n->loop.nwords >= 0) {
+    expand_error = 0;
+    values = expand_words(n->loop.words, n->loop.nwords, &cmd_arena);
+    if (expand_error) {
+      set_simple_status(1);
+      return 1;
+    }
+  } else {
+    // No `in`: "$@", as it was when the loop started
+    values = arena_alloc(&cmd_arena, (pos_count + 1) * sizeof(char *));
+    memcpy(values, pos_params, pos_count * sizeof(char *));
+    values[pos_count] = NULL;
+  }
+  loop_depth++;
+  for (char **v = values; *v; v++) {
+    var_setn(n->loop.name.text, n->loop.name.len, *v, 0);
+    if (!(res = exec_node(n->loop.body, 0))) break;
+    status = last_command_status;
+    if (loop_done() || status == 128 + SIGINT) break;
+  }
+  loop_depth--;
+  if (res && !pending_return) set_simple_status(status);
+  return res;
+}
+
+// Runs the body of the first item with a pattern matching the word.
+static int run_case(struct Node *n) {
+  expand_error = 0;
+  char *word = expand_word_nosplit(&n->match.word, &cmd_arena);
+  if (expand_error) {
+    set_simple_status(1);
+    return 1;
+  }
+  for (int i = 0; i < n->match.n; i++) {
+    struct CaseItem *item = &n->match.items[i];
+    for (int j = 0; j < item->npatterns; j++) {
+      if (fnmatch(expand_pattern(&item->patterns[j], &cmd_arena), word, 0) != 0) continue;
+      if (item->body) return exec_node(item->body, 0);
+      set_simple_status(0);
+      return 1;
+    }
+  }
+  set_simple_status(0);
+  return 1;
+}
+
+// if, while, until, for, case and { ...; } run in the shell itself, so the
+// variables they set stay set. Their redirections apply to all of them.
+static struct Redir *compound_redirs(struct Node *n) {
+  switch (n->type) {
+  case NODE_GROUP: return n->sub.redirs;
+  case NODE_FOR: return n->loop.redirs;
+  case NODE_CASE: return n->match.redirs;
+  default: return n->ctl.redirs;
+  }
+}
+
+static int run_compound(struct Node *n) {
+  struct Redir *redirs = compound_redirs(n);
+  struct Redirs redir;
+  int res = 1;
+
+  if (redirs && !redirect_shell(redirs, &redir)) return 1;
+  switch (n->type) {
+  case NODE_IF: res = run_if(n); break;
+  case NODE_WHILE:
+  case NODE_UNTIL: res = run_loop(n); break;
+  case NODE_FOR: res = run_for(n); break;
+  case NODE_CASE: res = run_case(n); break;
+  default: res = exec_node(n->sub.body, 0); break;
+  }
+  if (redirs) restore_shell(&redir);
+  return res;
+}
+
+// Copying a function definition out of its line. Words inside the
+// definition's own text keep their place in a copy of that text, which
+// alias expansion relies on; anything else (a here-document body that
+// follows the line) gets a copy of its own.
+struct TreeCopy {
+  const char *from;
+  int len;
+  char *to;
+  struct Arena *arena;
+};
+
+static void copy_word(struct TreeCopy *c, struct Word *w) {
+  if (!w->text) return;
+  if (w->text >= c->from && w->text + w->len <= c->from + c->len) {
+    w->text = c->to + (w->text - c->from);
+  } else {
+    w->text = arena_strndup(c->arena, w->text, w->len);
+  }
+}
+
+static struct Word *copy_words(struct TreeCopy *c, const struct Word *words, int n) {
+  if (n <= 0) return NULL;
+  struct Word *out = arena_alloc(c->arena, n * sizeof(struct Word));
+  memcpy(out, words, n * sizeof(struct Word));
+  for (int i = 0; i < n; i++) copy_word(c, &out[i]);
+  return out;
+}
+
+static struct Redir *copy_redirs(struct TreeCopy *c, const struct Redir *r) {
+  struct Redir *head = NULL, **tail = &head;
+  for (; r; r = r->next) {
+    *tail = arena_alloc(c->arena, sizeof(struct Redir));
+    **tail = *r;
+    copy_word(c, &(*tail)->target);
+    tail = &(*tail)->next;
+  }
+  return head;
+}
+
+static struct Node *copy_node(struct TreeCopy *c, const struct Node *n) {
+  if (!n) return NULL;
+  struct Node *m = arena_alloc(c->arena, sizeof(struct Node));
+  *m = *n;
+  copy_word(c, &m->src);
+  switch (n->type) {
+  case NODE_COMMAND:
+    m->cmd.argv = copy_words(c, n->cmd.argv, n->cmd.argc);
+    m->cmd.redirs = copy_redirs(c, n->cmd.redirs);
+    break;
+  case NODE_PIPELINE:
+    m->pipe.stages = arena_alloc(c->arena, n->pipe.n * sizeof(struct Node *));
+    for (int i = 0; i < n->pipe.n; i++) m->pipe.stages[i] = copy_node(c, n->pipe.stages[i]);
+    break;
+  case NODE_AND:
+  case NODE_OR:
+  case NODE_SEQ:
+    m->pair.left = copy_node(c, n->pair.left);
+    m->pair.right = copy_node(c, n->pair.right);
+    break;
+  case NODE_BACKGROUND:
+  case NODE_SUBSHELL:
+  case NODE_TIME:
+  case NODE_NOT:
+  case NODE_GROUP:
+    m->sub.body = copy_node(c, n->sub.body);
+    m->sub.redirs = copy_redirs(c, n->sub.redirs);
+    break;
+  case NODE_IF:
+  case NODE_WHILE:
+  case NODE_UNTIL:
+    m->ctl.cond = copy_node(c, n->ctl.cond);
+    m->ctl.body = copy_node(c, n->ctl.body);
+    m->ctl.orelse = copy_node(c, n->ctl.orelse);
+    m->ctl.redirs = copy_redirs(c, n->ctl.redirs);
+    break;
+  case NODE_FOR:
+    copy_word(c, &m->loop.name);
+    m->loop.words = copy_words(c, n->loop.words, n->loop.nwords);
+    m->loop.body = copy_node(c, n->loop.body);
+    m->loop.redirs = copy_redirs(c, n->loop.redirs);
+    break;
+  case NODE_CASE:
+    copy_word(c, &m->match.word);
+    m->match.items = arena_alloc(c->arena, (n->match.n ? n->match.n : 1) * sizeof(struct CaseItem));
+    for (int i = 0; i < n->match.n; i++) {
+      struct CaseItem *item = &m->match.items[i];
+      *item = n->match.items[i];
+      item->patterns = copy_words(c, item->patterns, item->npatterns);
+      item->body = copy_node(c, item->body);
     }
+    m->match.redirs = copy_redirs(c, n->match.redirs);
+    break;
+  case NODE_FUNCTION:
+    copy_word(c, &m->func.name);
+    m->func.body = copy_node(c, n->func.body);
+    break;
+  }
+  return m;
+}
+
+static void free_function(struct Function *f) {
+  if (f->calls > 0) {
+    f->replaced = 1;     // call_function() frees it once the last call returns
+    return;
+  }
+  arena_free(&f->arena);
+  free(f);
+}
+
+// `name() body`: the body is parsed once, here, and every call runs the
+// same tree.
+static void define_function(struct Node *n) {
+  struct Function *f = calloc(1, sizeof(struct Function));
+  struct Node *body = n->func.body;
+  struct TreeCopy c = { body->src.text, body->src.len, NULL, &f->arena };
+  c.to = arena_strndup(&f->arena, body->src.text, body->src.len);
+  f->body = copy_node(&c, body);
+
+  char *name = strndup(n->func.name.text, n->func.name.len);
+  struct Symbol *sym = sym_intern(name);
+  free(name);
+  if (sym->func) free_function(sym->func);
+  sym->func = f;
+  set_simple_status(0);
+}
+
+// Make body the function `name` as it is, without a copy: it belongs to
+// something that stays for the life of the shell (a mapped snapshot).
+void function_adopt(const char *name, struct Node *body) {
+  struct Function *f = calloc(1, sizeof(struct Function));
+  f->body = body;
+  struct Symbol *sym = sym_intern(name);
+  if (sym->func) free_function(sym->func);
+  sym->func = f;
+}
+
+void unset_function(const char *name) {
+  struct Symbol *sym = sym_lookup(name);
+  if (!sym || !sym->func) return;
+  free_function(sym->func);
+  sym->func = NULL;
+  sym_release(sym);
+}
+
+#define FUNC_DEPTH_MAX 1000
+
+// Run a function with argv[1..] as its positional parameters. `local`
+// variables are put back and `return` is used up when it finishes.
+static int call_function(struct Function *f, char **argv) {
+  if (func_depth == FUNC_DEPTH_MAX) {
+    fprintf(stderr, "myshell: %s: maximum function nesting level exceeded (%d)\n",
+            argv[0], FUNC_DEPTH_MAX);
+    set_simple_status(1);
+    return 1;
+  }
+  char **params = pos_params;
+  int count = pos_count, loops = loop_depth, frame = vars_frame(), argc = 0;
+  while (argv[argc]) argc++;
+
+  set_positional(NULL, argc - 1, argv + 1);
+  loop_depth = 0;         // break and continue do not reach the caller's loops
+  func_depth++;
+  f->calls++;
+  int res = exec_node(f->body, 0);
+  f->calls--;
+  func_depth--;
+  pending_return = 0;
+  loop_depth = loops;
+  vars_unwind(frame);
+  set_positional(NULL, count, params);
+  if (f->replaced && f->calls == 0) free_function(f);
+  return res;
+}
+
+// Close the shell's end of the substitutions made since `mark` and reap
+// their children. One still running (a >(...) draining what it was sent)
+// is left for a later call to reap.
+static void finish_substs(int mark) {
+  if (nsubsts == mark && nlingering == 0) return;
+  struct rusage ru;
+  while (nsubsts > mark) {
+    struct Subst *sb = &substs[--nsubsts];
+    close(sb->fd);
+    pid_t r = sb->pid > 0 ? wait4(sb->pid, NULL, WNOHANG, &ru) : -1;
+    if (r > 0) rusage_add(&reaped_usage, &ru);
+    if (r != 0) continue;
+    if (nlingering == lingering_cap) {
+      lingering_cap = lingering_cap ? lingering_cap * 2 : 8;
+      lingering = realloc(lingering, lingering_cap * sizeof(pid_t));
+    }
+    lingering[nlingering++] = sb->pid;
+  }
+  for (int i = 0; i < nlingering; ) {
+    pid_t r = wait4(lingering[i], NULL, WNOHANG, &ru);
+    if (r == 0) {
+      i++;
+      continue;
+    }
+    if (r > 0) rusage_add(&reaped_usage, &ru);
+    lingering[i] = lingering[--nlingering];
+  }
+}
+
+// Walk the tree. Returns 0 once `exit` has been run, 1 otherwise; the
+// command status is left in last_command_status.
+static int exec_node(struct Node *n, int run_bg) {
+  struct ArenaMark mark = arena_mark(&cmd_arena);
+  int subst_mark = nsubsts;
+  int res = 1;
+
+  // Anything more than a pipeline goes to the background as a subshell job
+  if (run_bg && n->type != NODE_COMMAND && n->type != NODE_PIPELINE) {
+    struct Stage st;
+    prepare_stage(n, &st);
+    run_stages(&st, 1, &n->src, 1);
+    finish_substs(subst_mark);
+    arena_release(&cmd_arena, mark);
     return 1;
   }
 
-  int builtin_res = execute_builtin(args);
-  if (builtin_res != -1) {
-    last_command_status = 0;
-    return builtin_res;
-  }
-
-  return shell_launch(args, run_bg);
-}
-
-int shell_execute_line(char **args) {
-    if (args[0] == NULL) return 1;
-
-    int i = 0;
-    int start = 0;
-    int loop_status = 1;
-    int skip_next = 0;
-    
-    while (args[i] != NULL) {
-        if (strcmp(args[i], "&&") == 0 || strcmp(args[i], "||") == 0) {
-            char *op = args[i];
-            args[i] = NULL;
-            
-            if (!skip_next && args[start] != NULL) {
-                loop_status = shell_execute(&args[start]);
-                if (loop_status == 0) return 0; // Exit shell
-            }
-            
-            if (strcmp(op, "&&") == 0) {
-                skip_next = (last_command_status != 0);
-            } else if (strcmp(op, "||") == 0) {
-                skip_next = (last_command_status == 0);
-            }
-            
-            start = i + 1;
+  switch (n->type) {
+  case NODE_SEQ:
+    while (n->type == NODE_SEQ) {
+      if (!exec_node(n->pair.left, 0)) return 0;
+      // Scripts never reach a prompt, so reap background jobs as we go
+      if (first_job) jobs_reap();
+      if (UNWINDING()) break;
+      n = n->pair.right;
+    }
+    if (!UNWINDING()) res = exec_node(n, 0);
+    break;
+  case NODE_AND:
+  case NODE_OR:
+    res = exec_node(n->pair.left, 0);
+    if (res && !UNWINDING() && (last_command_status == 0) == (n->type == NODE_AND)) {
+      res = exec_node(n->pair.right, 0);
+    }
+    break;
+  case NODE_BACKGROUND:
+    res = exec_node(n->sub.body, 1);
+    break;
+  case NODE_PIPELINE:
+    run_pipeline(n, run_bg);
+    break;
+  case NODE_SUBSHELL: {
+    struct Stage st;
+    prepare_stage(n, &st);
+    run_stages(&st, 1, &n->src, 0);
+    break;
+  }
+  case NODE_COMMAND:
+    res = exec_command(n, run_bg);
+    break;
+  case NODE_TIME:
+    res = run_timed(n->sub.body);
+    break;
+  case NODE_NOT:
+    res = exec_node(n->sub.body, 0);
+    if (!UNWINDING()) last_command_status = !last_command_status;
+    break;
+  case NODE_GROUP:
+  case NODE_IF:
+  case NODE_WHILE:
+  case NODE_UNTIL:
+  case NODE_FOR:
+  case NODE_CASE:
+    res = run_compound(n);
+    break;
+  case NODE_FUNCTION:
+    define_function(n);
+    break;
+  }
+
+  finish_substs(subst_mark);
+  arena_release(&cmd_arena, mark);
+  return res;
+}
+
+int shell_execute_node(struct Node *n) {
+  if (!n) return 1;
+  return exec_node(n, 0);
+}
+
+// Builtins that only print: a substitution made of nothing else, or of
+// functions made of nothing else, runs in the shell itself. Anything that could change the shell's state (cd,
+// exit, alias, set, ...) still gets a subshell of its own.
+static const char *const pure_builtins[] = {
+  "echo", "printf", "test", "[", "true", "false", ":", "pwd", "basename", "dirname",
+  "type", "dirs", "jobs", "help", NULL
+};
+
+// Functions are looked into this many calls deep; past that (recursion,
+// most likely) the substitution gets a subshell.
+#define SUBST_FUNC_DEPTH 8
+
+static int subst_in_process_at(struct Node *n, int depth) {
+  if (!n) return 1;
+  switch (n->type) {
+  case NODE_COMMAND: {
+    if (n->cmd.argc == 0) return 0;
+    struct Word *w = &n->cmd.argv[0];
+    for (int i = 0; i < w->len; i++) {
+      if (strchr("'\"\\$`", w->text[i])) return 0;
+    }
+    struct Symbol *sym = sym_lookupn(w->text, w->len);
+    if (!sym || sym->alias) return 0;
+    // A function qualifies when everything in its body does
+    if (sym->func) return depth < SUBST_FUNC_DEPTH && subst_in_process_at(sym->func->body, depth + 1);
+    if (!sym->builtin) return 0;
+    for (int i = 0; pure_builtins[i]; i++) {
+      if (strcmp(sym->name, pure_builtins[i]) == 0) return 1;
+    }
+    return 0;
+  }
+  case NODE_AND:
+  case NODE_OR:
+  case NODE_SEQ:
+    return subst_in_process_at(n->pair.left, depth) && subst_in_process_at(n->pair.right, depth);
+  case NODE_GROUP:
+    return !n->sub.redirs && subst_in_process_at(n->sub.body, depth);
+  case NODE_IF:
+    return !n->ctl.redirs && subst_in_process_at(n->ctl.cond, depth) &&
+           subst_in_process_at(n->ctl.body, depth) && subst_in_process_at(n->ctl.orelse, depth);
+  default:
+    return 0;
+  }
+}
+
+static int subst_in_process(struct Node *n) {
+  return subst_in_process_at(n, 0);
+}
+
+// Run the tree with stdout captured in a memfd, without forking.
+static void subst_capture(struct Node *tree, char **buf, size_t *len) {
+  int fd = memfd_create("myshell-subst", MFD_CLOEXEC);
+  if (fd < 0) {
+    perror("myshell: command substitution");
+    return;
+  }
+  fflush(stdout);
+  int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  dup2(fd, STDOUT_FILENO);
+  exec_node(tree, 0);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  off_t size = lseek(fd, 0, SEEK_CUR);
+  if (size > 0) {
+    *buf = malloc(size);
+    *len = pread(fd, *buf, size, 0) == size ? (size_t)size : 0;
+  }
+  close(fd);
+}
+
+// Start the tree in a child reading in_fd and writing to out_fd (-1 for
+// the shell's own). A single external command is launched directly, like
+// a pipeline stage; anything else runs in a forked subshell. Returns the
+// child's pid, or -1.
+static pid_t subst_launch(struct Node *tree, int in_fd, int out_fd) {
+  int alias_mark = alias_depth;
+  struct Node *target = tree->type == NODE_COMMAND ? resolve_command(tree) : tree;
+  struct LaunchSpec ls = { .in_fd = in_fd, .out_fd = out_fd, .pgid = -1 };
+  struct Redirs redir;
+  pid_t pid = -1;
+
+  if (target->type == NODE_COMMAND) {
+    struct Stage st;
+    prepare_stage(target, &st);
+    alias_depth = alias_mark;
+    if (!st.argv[0] && !st.redirs) return -1;
+    if (build_redirections(st.redirs, &redir)) {
+      pass_substs(&redir, st.subst_from, st.subst_to);
+      ls.redir = &redir;
+      ls.args = st.argv;
+      ls.assigns = st.assigns;
+      ls.builtin = st.builtin;
+      ls.func = st.func;
+      if (st.argv[0] && !st.builtin && !st.func) ls.path = command_path(st.assigns, st.argv[0]);
+      if (st.argv[0]) pid = launch_process(&ls);
+      close_redirections(&redir);
+    } else {
+      set_simple_status(1);
+    }
+    return pid;
+  }
+  alias_depth = alias_mark;
+  ls.node = target;
+  return launch_process(&ls);
+}
+
+#define SUBST_READ_SIZE 65536
+
+// Command substitution: run the command text of a $(...) (or, with
+// backquote set, a `...`) and return what it wrote to stdout, without the
+// trailing newlines, in `arena`. $? is left at the command's status.
+char *command_subst(const char *text, size_t len, int backquote, struct Arena *arena, size_t *out_len) {
+  struct ArenaMark mark = arena_mark(&cmd_arena);
+  char *src = arena_alloc(&cmd_arena, len + 1);
+  char *buf = NULL;
+  size_t n = 0;
+
+  // Inside backquotes, \ only escapes $, ` and itself
+  size_t k = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (backquote && text[i] == '\\' && i + 1 < len && strchr("$`\\", text[i + 1])) i++;
+    src[k++] = text[i];
+  }
+  src[k] = '\0';
+
+  int status;
+  struct Node *tree = parse_line(src, &cmd_arena, &status);
+  if (!tree) {
+    set_simple_status(status == PARSE_OK ? 0 : 2);
+  } else if (subst_in_process(tree)) {
+    subst_capture(tree, &buf, &n);
+  } else {
+    int pipefd[2];
+    pid_t pid = -1;
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+      perror("myshell: pipe");
+    } else {
+      pid = subst_launch(tree, -1, pipefd[1]);
+      close(pipefd[1]);
+
+      // Large reads into a buffer that doubles as it fills
+      size_t cap = 0;
+      while (pid > 0) {
+        if (cap - n < SUBST_READ_SIZE) {
+          cap = cap ? cap * 2 : SUBST_READ_SIZE;
+          buf = realloc(buf, cap);
         }
-        i++;
+        ssize_t r = read(pipefd[0], buf + n, cap - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        n += r;
+      }
+      close(pipefd[0]);
     }
-    
-    if (args[start] != NULL && !skip_next) {
-        loop_status = shell_execute(&args[start]);
+    if (pid > 0) {
+      int wstatus;
+      struct rusage ru;
+      while (wait4(pid, &wstatus, 0, &ru) < 0 && errno == EINTR);
+      rusage_add(&reaped_usage, &ru);
+      set_simple_status(exit_code(wstatus));
     }
-    
-    return loop_status;
+  }
+
+  arena_release(&cmd_arena, mark);
+  while (n > 0 && buf[n - 1] == '\n') n--;
+  char *out = arena_alloc(arena, n + 1);
+  if (n) memcpy(out, buf, n);
+  out[n] = '\0';
+  free(buf);
+  *out_len = n;
+  return out;
+}
+
+// Process substitution: start the command text of a <(...) (or, with
+// output set, a >(...)) on one end of a pipe and return the name of the
+// shell's end, /dev/fd/N, in `arena`. The command that gets the name
+// inherits the descriptor; it is closed once that command is done.
+char *process_subst(const char *text, size_t len, int output, struct Arena *arena) {
+  struct ArenaMark mark = arena_mark(&cmd_arena);
+  char *src = arena_alloc(&cmd_arena, len + 1);
+  char *name = arena_alloc(arena, 32);
+  memcpy(src, text, len);
+  src[len] = '\0';
+  strcpy(name, "/dev/null");
+
+  int status, pipefd[2];
+  struct Node *tree = parse_line(src, &cmd_arena, &status);
+  if (!tree) {
+    set_simple_status(status == PARSE_OK ? 0 : 2);
+  } else if (pipe2(pipefd, O_CLOEXEC) < 0) {
+    perror("myshell: pipe");
+  } else {
+    // Above the low numbers a command's own `3<file` would use
+    int mine = output ? pipefd[1] : pipefd[0];
+    int theirs = output ? pipefd[0] : pipefd[1];
+    int fd = fcntl(mine, F_DUPFD_CLOEXEC, 10);
+    close(mine);
+
+    // Registered before the launch, so a forked child closes it
+    if (nsubsts == substs_cap) {
+      substs_cap = substs_cap ? substs_cap * 2 : 8;
+      substs = realloc(substs, substs_cap * sizeof(*substs));
+    }
+    struct Subst *sb = &substs[nsubsts++];
+    sb->fd = fd;
+    sb->pid = -1;
+    pid_t pid = output ? subst_launch(tree, theirs, -1) : subst_launch(tree, -1, theirs);
+    close(theirs);
+    // subst_launch() may have made substitutions of its own meanwhile
+    for (int i = nsubsts - 1; i >= 0; i--) {
+      if (substs[i].fd == fd) substs[i].pid = pid;
+    }
+    snprintf(name, 32, "/dev/fd/%d", fd);
+  }
+  arena_release(&cmd_arena, mark);
+  return name;
 }
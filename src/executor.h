@@ -2,13 +2,88 @@
 #define EXECUTOR_H
 
 #include <sys/types.h>
+#include "arena.h"
 
-int shell_execute(char **args);
-int shell_execute_line(char **args);
+struct Node;
+struct Redir;
+struct Job;
+struct ProcAttrs;
+
+// One descriptor operation for a child, applied in order once the pipe
+// ends are in place: dup2(src, fd), or close(fd) when src is -1.
+struct FdOp {
+  int fd;
+  int src;
+  int owned;          // src was opened for this command; closed after launching
+};
+
+// Redirections of a command, resolved once in the shell: targets are
+// expanded and opened before launching, leaving the child (or the shell,
+// for builtins) a short list of dup2() and close() calls.
+struct Redirs {
+  struct FdOp *ops;   // in cmd_arena
+  int nops;
+  int cap;
+  struct FdOp *saved; // redirect_shell(): what each fd was before, src -1 if closed
+  int nsaved;
+};
+
+// A shell function. The definition is copied out of the line it was parsed
+// from into an arena of its own, so it outlives that line.
+struct Function {
+  struct Arena arena;
+  struct Node *body;
+  int calls;          // calls running right now, recursion included
+  int replaced;       // redefined or unset while running: freed after the last call
+};
+
+// Everything needed to start one child process.
+struct LaunchSpec {
+  char **args;
+  char **assigns;     // NAME=value strings for this command only, NULL if none
+  const char *path;   // resolved by pathcache_lookup(), NULL if not found
+  struct Node *node;  // run this in a forked subshell instead of exec'ing args
+  int builtin;        // args is a builtin to run in a forked child
+  struct Function *func;  // args calls this function, in a forked child
+  struct Redirs *redir;
+  int in_fd;          // pipe end to install as stdin, -1 if none
+  int out_fd;         // pipe end to install as stdout, -1 if none
+  pid_t pgid;         // 0: lead a new group, >0: join that group, -1: stay in ours
+  int foreground;
+  int relay;          // copy stdin to stdout instead of running anything
+  long rate;          // relay: bytes a second at most, 0 for no limit
+  const struct ProcAttrs *attrs;  // CPUs, niceness and limits to set first; NULL if none
+};
+
+int build_redirections(struct Redir *list, struct Redirs *r);
+void redir_add(struct Redirs *r, int fd, int src, int owned);
+void close_redirections(struct Redirs *r);
+pid_t launch_process(struct LaunchSpec *ls);
+
+void record_job_status(struct Job *job);
+void set_simple_status(int status);
+
+int shell_execute_node(struct Node *n);
+void unset_function(const char *name);
+void function_adopt(const char *name, struct Node *body);
+char *command_subst(const char *text, size_t len, int backquote, struct Arena *arena, size_t *out_len);
+char *process_subst(const char *text, size_t len, int output, struct Arena *arena);
 
 extern int last_command_status;
+extern int *pipe_status;
+extern int pipe_status_count;
 extern pid_t shell_pgid;
 extern int shell_terminal;
+extern int job_control;
+extern pid_t last_bg_pid;
+extern struct Arena cmd_arena;
+// Set by break, continue and return; see loop_done() in executor.c.
+extern int pending_break;
+extern int pending_continue;
+extern int pending_return;
+extern int loop_depth;
+extern int func_depth;
+// Called before a child is started, if set (see shell_run_stream()).
+extern void (*launch_hook)(void);
 
 #endif
-
@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <glob.h>
+#include <pwd.h>
+#include "expand.h"
+#include "arena.h"
+#include "ast.h"
+#include "executor.h"
+#include "options.h"
+#include "globstar.h"
+#include "lexer.h"
+#include "vars.h"
+#include "arith.h"
+
+// Word expansion: tilde, $parameters, quote removal and pathname globbing,
+// done in one pass over the raw word text. Two strings are built side by
+// side: the literal value, and a glob pattern in which every quoted
+// character is backslash-escaped so that '*.c' stays literal.
+
+struct Buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void buf_putn(struct Arena *a, struct Buf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        while (cap < b->len + n + 1) cap *= 2;
+        b->data = arena_grow(a, b->data, b->cap, cap);
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+}
+
+static void buf_putc(struct Arena *a, struct Buf *b, char c) {
+    buf_putn(a, b, &c, 1);
+}
+
+// $0 and the positional parameters $1..$N (pos_params[0..pos_count-1]).
+char *shell_name = "myshell";
+char **pos_params;
+int pos_count;
+
+void set_positional(char *name, int argc, char **argv) {
+    if (name) shell_name = name;
+    pos_params = argv;
+    pos_count = argc;
+}
+
+static int is_special_param(char c) {
+    return c == '?' || c == '$' || c == '#' || c == '@' || c == '*' || isdigit((unsigned char)c);
+}
+
+// Expanded value of a parameter, or NULL if unset.
+const char *shell_getvar(const char *name, struct Arena *arena) {
+    char num[32];
+    if (isdigit((unsigned char)name[0])) {
+        int k = atoi(name);
+        if (k == 0) return shell_name;
+        return k <= pos_count ? pos_params[k - 1] : NULL;
+    }
+    if (strcmp(name, "#") == 0) {
+        snprintf(num, sizeof(num), "%d", pos_count);
+        return arena_strdup(arena, num);
+    }
+    if (strcmp(name, "@") == 0 || strcmp(name, "*") == 0) {
+        struct Buf b = {0};
+        buf_putn(arena, &b, "", 0);
+        for (int k = 1; k <= pos_count; k++) {
+            if (k > 1) buf_putc(arena, &b, ' ');
+            buf_putn(arena, &b, pos_params[k - 1], strlen(pos_params[k - 1]));
+        }
+        return b.data;
+    }
+    if (strcmp(name, "?") == 0) {
+        snprintf(num, sizeof(num), "%d", last_command_status);
+        return arena_strdup(arena, num);
+    }
+    if (strcmp(name, "$") == 0) {
+        snprintf(num, sizeof(num), "%d", (int)shell_pgid);
+        return arena_strdup(arena, num);
+    }
+    if (strcmp(name, "PIPESTATUS") == 0) {
+        struct Buf b = {0};
+        buf_putn(arena, &b, "", 0);
+        for (int k = 0; k < pipe_status_count; k++) {
+            snprintf(num, sizeof(num), k ? " %d" : "%d", pipe_status[k]);
+            buf_putn(arena, &b, num, strlen(num));
+        }
+        return b.data;
+    }
+    return var_get(name);
+}
+
+struct ArgList;
+
+struct WordState {
+    struct Arena *arena;
+    struct ArgList *out;    // where finished fields go, NULL: one word only
+    struct Buf value;
+    struct Buf pattern;
+    int quoted;         // some part of the word was quoted
+    int expanded;       // some part came from a parameter
+    int has_glob;       // an unquoted glob metacharacter was seen
+    int empty_at;       // "$@" expanded to nothing
+    int split_pending;  // IFS whitespace seen: the next character starts a field
+};
+
+static void field_break(struct WordState *ws, int quoted);
+
+static void put_literal(struct WordState *ws, char c, int quoted) {
+    if (ws->split_pending) {
+        ws->split_pending = 0;
+        if (ws->value.len) field_break(ws, quoted);
+    }
+    buf_putc(ws->arena, &ws->value, c);
+    if (quoted && (c == '*' || c == '?' || c == '[' || c == '\\')) {
+        buf_putc(ws->arena, &ws->pattern, '\\');
+    }
+    buf_putc(ws->arena, &ws->pattern, c);
+}
+
+// Expand the parameter reference that starts after a '$' at p.
+// Returns the number of characters consumed (0 if it was a literal '$').
+static int expand_param(struct WordState *ws, const char *p, const char *end, int quoted) {
+    char name[256];
+    int used = 0, n = 0;
+
+    if (p < end && *p == '{') {
+        const char *close = memchr(p, '}', end - p);
+        if (!close) return 0;
+        n = close - p - 1;
+        used = n + 2;
+        if (n <= 0 || n >= (int)sizeof(name)) return used;
+        memcpy(name, p + 1, n);
+    } else if (p < end && is_special_param(*p)) {
+        name[0] = *p;
+        n = used = 1;
+    } else {
+        while (p + n < end && (isalnum((unsigned char)p[n]) || p[n] == '_') && n < (int)sizeof(name) - 1) n++;
+        if (n == 0) return 0;
+        memcpy(name, p, n);
+        used = n;
+    }
+    name[n] = '\0';
+
+    // "$@" (and unquoted $*) make one field per positional parameter
+    if ((strcmp(name, "@") == 0 || (strcmp(name, "*") == 0 && !quoted)) && pos_count != 1) {
+        ws->expanded = 1;
+        if (pos_count == 0) ws->empty_at = 1;
+        for (int k = 1; k <= pos_count; k++) {
+            if (k > 1) field_break(ws, quoted);
+            for (const char *v = pos_params[k - 1]; *v; v++) {
+                if (!quoted && (*v == '*' || *v == '?' || *v == '[')) ws->has_glob = 1;
+                put_literal(ws, *v, quoted);
+            }
+        }
+        return used;
+    }
+
+    const char *val = shell_getvar(name, ws->arena);
+    ws->expanded = 1;
+    for (; val && *val; val++) {
+        // Unquoted expansion results are still subject to globbing
+        if (!quoted && (*val == '*' || *val == '?' || *val == '[')) ws->has_glob = 1;
+        put_literal(ws, *val, quoted);
+    }
+    return used;
+}
+
+static void expand_tilde(struct WordState *ws, const char **pp, const char *end) {
+    const char *p = *pp + 1;
+    const char *user_end = p;
+    while (user_end < end && *user_end != '/') {
+        // A quoted user name is not a tilde prefix
+        if (*user_end == '\'' || *user_end == '"' || *user_end == '\\' || *user_end == '$') return;
+        user_end++;
+    }
+
+    const char *home = NULL;
+    if (user_end == p) {
+        home = var_get("HOME");
+    } else {
+        char *user = arena_strndup(ws->arena, p, user_end - p);
+        struct passwd *pw = getpwnam(user);
+        if (pw) home = pw->pw_dir;
+    }
+    if (!home) return;
+
+    for (; *home; home++) put_literal(ws, *home, 1);
+    *pp = user_end;
+}
+
+// Insert the output of a command substitution. Unquoted, it is split
+// into fields at $IFS characters: runs of IFS whitespace separate fields
+// and are dropped at either end, other IFS characters each end a field.
+static void put_subst(struct WordState *ws, const char *text, size_t len, int backquote, int quoted) {
+    size_t out_len;
+    char *out = command_subst(text, len, backquote, ws->arena, &out_len);
+    ws->expanded = 1;
+
+    const char *ifs = var_get("IFS");
+    if (!ifs) ifs = " \t\n";
+    for (size_t i = 0; i < out_len; i++) {
+        char c = out[i];
+        if (!quoted && ws->out && c && strchr(ifs, c)) {
+            if (c == ' ' || c == '\t' || c == '\n') {
+                ws->split_pending = 1;
+            } else {
+                ws->split_pending = 0;
+                field_break(ws, 0);
+            }
+            continue;
+        }
+        if (!quoted && (c == '*' || c == '?' || c == '[')) ws->has_glob = 1;
+        put_literal(ws, c, quoted);
+    }
+}
+
+static void start_field(struct WordState *ws);
+static void expand_raw(struct WordState *ws, struct Word *w);
+
+// Set when an expansion fails (so far only arithmetic: `$((1/0))`). The
+// executor clears it before expanding a command's words and, if it is set
+// afterwards, does not run the command and sets $? to 1.
+int expand_error;
+
+// Insert the value of an arithmetic expansion. Parameters and command
+// substitutions in the expression are expanded first.
+static void put_arith(struct WordState *ws, const char *text, size_t len, int quoted) {
+    struct WordState inner = { .arena = ws->arena };
+    struct Word w = { text, len };
+    char num[32];
+    int ok;
+
+    start_field(&inner);
+    expand_raw(&inner, &w);
+    snprintf(num, sizeof(num), "%ld", arith_eval(inner.value.data, &ok));
+    if (!ok) expand_error = 1;
+    ws->expanded = 1;
+    for (const char *c = num; *c; c++) put_literal(ws, *c, quoted);
+}
+
+// Run the $(...) or `...` starting at p and insert its output, or the
+// value of the $((...)) there. Returns the position after it.
+static const char *expand_subst(struct WordState *ws, const char *p, const char *end, int quoted) {
+    int backquote = *p == '`';
+    const char *body = p + (backquote ? 1 : 2);
+    const char *close = lexer_skip_subst(body, backquote);
+    if (!close || close > end) close = end;
+    size_t len = close - body;
+    if (len && close[-1] == (backquote ? '`' : ')')) len--;
+    if (!backquote && len >= 2 && body[0] == '(' && body[len - 1] == ')') {
+        put_arith(ws, body + 1, len - 2, quoted);
+    } else {
+        put_subst(ws, body, len, backquote, quoted);
+    }
+    return close;
+}
+
+// Start the <(...) or >(...) at p and insert the /dev/fd name it gets,
+// as one quoted field. Returns the position after it.
+static const char *expand_process_subst(struct WordState *ws, const char *p, const char *end) {
+    const char *body = p + 2;
+    const char *close = lexer_skip_subst(body, 0);
+    if (!close || close > end) close = end;
+    size_t len = close - body;
+    if (len && close[-1] == ')') len--;
+    char *name = process_subst(body, len, *p == '>', ws->arena);
+    ws->expanded = 1;
+    for (; *name; name++) put_literal(ws, *name, 1);
+    return close;
+}
+
+static void expand_raw(struct WordState *ws, struct Word *w) {
+    const char *p = w->text;
+    const char *end = w->text + w->len;
+
+    if (p < end && *p == '~') expand_tilde(ws, &p, end);
+
+    while (p < end) {
+        char c = *p;
+        if (c == '\\') {
+            p++;
+            if (p < end && *p == '\n') { p++; continue; }
+            if (p < end) put_literal(ws, *p++, 1);
+            ws->quoted = 1;
+        } else if (c == '\'') {
+            const char *close = memchr(p + 1, '\'', end - p - 1);
+            if (!close) close = end;
+            for (p++; p < close; p++) put_literal(ws, *p, 1);
+            p = close < end ? close + 1 : end;
+            ws->quoted = 1;
+        } else if (c == '"') {
+            ws->quoted = 1;
+            for (p++; p < end && *p != '"'; ) {
+                if (*p == '\\' && p + 1 < end && strchr("$`\"\\\n", p[1])) {
+                    if (p[1] != '\n') put_literal(ws, p[1], 1);
+                    p += 2;
+                } else if (*p == '`' || (*p == '$' && p + 1 < end && p[1] == '(')) {
+                    p = expand_subst(ws, p, end, 1);
+                } else if (*p == '$') {
+                    int used = expand_param(ws, p + 1, end, 1);
+                    if (!used) put_literal(ws, '$', 1);
+                    p += 1 + used;
+                } else {
+                    put_literal(ws, *p++, 1);
+                }
+            }
+            if (p < end) p++;
+        } else if (c == '`' || (c == '$' && p + 1 < end && p[1] == '(')) {
+            p = expand_subst(ws, p, end, 0);
+        } else if ((c == '<' || c == '>') && p + 1 < end && p[1] == '(') {
+            p = expand_process_subst(ws, p, end);
+        } else if (c == '$') {
+            int used = expand_param(ws, p + 1, end, 0);
+            if (!used) put_literal(ws, '$', 0);
+            p += 1 + used;
+        } else {
+            if (c == '*' || c == '?' || c == '[') ws->has_glob = 1;
+            put_literal(ws, c, 0);
+            p++;
+        }
+    }
+}
+
+struct ArgList {
+    char **argv;
+    int argc;
+    int cap;
+};
+
+static void argv_push(struct Arena *a, struct ArgList *l, char *s) {
+    if (l->argc + 1 >= l->cap) {
+        int cap = l->cap ? l->cap * 2 : 16;
+        l->argv = arena_grow(a, l->argv, l->cap * sizeof(char *), cap * sizeof(char *));
+        l->cap = cap;
+    }
+    l->argv[l->argc++] = s;
+    l->argv[l->argc] = NULL;
+}
+
+static void start_field(struct WordState *ws) {
+    memset(&ws->value, 0, sizeof(ws->value));
+    memset(&ws->pattern, 0, sizeof(ws->pattern));
+    buf_putn(ws->arena, &ws->value, "", 0);
+    buf_putn(ws->arena, &ws->pattern, "", 0);
+}
+
+// Whether a pattern can match anything but itself: an unescaped * or ?,
+// or a [ closed by a later ]. `[ $a = $b ]` then never reads the directory.
+static int is_glob(const char *p) {
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) p++;
+        else if (*p == '*' || *p == '?') return 1;
+        else if (*p == '[' && strchr(p + 1, ']')) return 1;
+    }
+    return 0;
+}
+
+// Push the field built so far onto the argument list.
+static void finish_field(struct WordState *ws) {
+    struct Arena *arena = ws->arena;
+
+    // An unquoted expansion that came out empty produces no word at all
+    if (ws->value.len == 0 && ws->expanded && (!ws->quoted || ws->empty_at)) return;
+
+    // Only words with an unquoted metacharacter go through glob()
+    if (ws->has_glob && !is_glob(ws->pattern.data)) ws->has_glob = 0;
+    if (ws->has_glob && shell_options[OPT_GLOBSTAR] && globstar_pattern(ws->pattern.data)) {
+        size_t n;
+        char **matches = globstar_expand(ws->pattern.data, arena, &n);
+        if (n) {
+            for (size_t j = 0; j < n; j++) argv_push(arena, ws->out, matches[j]);
+            return;
+        }
+    } else if (ws->has_glob) {
+        glob_t g;
+        memset(&g, 0, sizeof(g));
+        if (glob(ws->pattern.data, 0, NULL, &g) == 0) {
+            for (size_t j = 0; j < g.gl_pathc; j++) {
+                argv_push(arena, ws->out, arena_strdup(arena, g.gl_pathv[j]));
+            }
+            globfree(&g);
+            return;
+        }
+        globfree(&g);
+    }
+    argv_push(arena, ws->out, ws->value.data);
+}
+
+// End the current field in the middle of a word ("$@"). Where only one
+// word is wanted (redirection targets) the fields are joined with spaces.
+static void field_break(struct WordState *ws, int quoted) {
+    if (!ws->out) {
+        put_literal(ws, ' ', quoted);
+        return;
+    }
+    finish_field(ws);
+    start_field(ws);
+    ws->quoted = quoted;
+    ws->has_glob = 0;
+    ws->empty_at = 0;
+}
+
+static void expand_one(struct Word *w, struct Arena *arena, struct ArgList *out) {
+    struct WordState ws = { .arena = arena, .out = out };
+    start_field(&ws);
+    expand_raw(&ws, w);
+    finish_field(&ws);
+}
+
+// Expand a command's words into a NULL-terminated argv in the arena.
+char **expand_words(struct Word *words, int count, struct Arena *arena) {
+    struct ArgList out = {0};
+    argv_push(arena, &out, NULL);
+    out.argc = 0;
+    for (int i = 0; i < count; i++) {
+        expand_one(&words[i], arena, &out);
+    }
+    return out.argv;
+}
+
+// Expansion for redirection targets: no field removal, no globbing.
+char *expand_word_nosplit(struct Word *word, struct Arena *arena) {
+    struct WordState ws = { .arena = arena };
+    start_field(&ws);
+    expand_raw(&ws, word);
+    return ws.value.data;
+}
+
+// Expansion for case patterns: the result is a fnmatch() pattern in which
+// quoted characters only match themselves.
+char *expand_pattern(struct Word *word, struct Arena *arena) {
+    struct WordState ws = { .arena = arena };
+    start_field(&ws);
+    expand_raw(&ws, word);
+    return ws.pattern.data;
+}
+
+// Here-document bodies: only $parameters, command substitutions and the
+// backslashes in front of $, `, \ and newline are special, and quotes are
+// ordinary characters. A body whose delimiter was quoted is taken as is.
+// <<- bodies lose the leading tabs of every line.
+char *expand_heredoc(struct Word *body, int strip_tabs, int literal, struct Arena *arena) {
+    struct Buf out = {0};
+    struct WordState ws = { .arena = arena };
+    const char *p = body->text;
+    const char *end = body->text + body->len;
+    int line_start = 1;
+
+    buf_putn(arena, &out, "", 0);
+    start_field(&ws);
+    while (p < end) {
+        if (line_start && strip_tabs) {
+            while (p < end && *p == '\t') p++;
+            line_start = 0;
+            continue;
+        }
+        // Copy the literal run up to the next special character at once
+        const char *q = p;
+        while (q < end && *q != '\n' && (literal || !strchr("$\\`", *q))) q++;
+        if (q < end && *q == '\n') q++;
+        if (q > p) {
+            line_start = q[-1] == '\n';
+            buf_putn(arena, &out, p, q - p);
+            p = q;
+            continue;
+        }
+        if (*p == '\\') {
+            if (p + 1 < end && strchr("$`\\\n", p[1])) {
+                if (p[1] != '\n') buf_putc(arena, &out, p[1]);
+                p += 2;
+            } else {
+                buf_putc(arena, &out, *p++);
+            }
+        } else if (*p == '`' || (p + 1 < end && p[1] == '(')) {
+            ws.value.len = ws.pattern.len = 0;
+            p = expand_subst(&ws, p, end, 1);
+            buf_putn(arena, &out, ws.value.data, ws.value.len);
+        } else {
+            ws.value.len = ws.pattern.len = 0;
+            int used = expand_param(&ws, p + 1, end, 1);
+            if (used) buf_putn(arena, &out, ws.value.data, ws.value.len);
+            else buf_putc(arena, &out, '$');
+            p += 1 + used;
+        }
+    }
+    return out.data;
+}
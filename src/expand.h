@@ -0,0 +1,19 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+struct Arena;
+struct Word;
+
+char **expand_words(struct Word *words, int count, struct Arena *arena);
+char *expand_word_nosplit(struct Word *word, struct Arena *arena);
+char *expand_pattern(struct Word *word, struct Arena *arena);
+char *expand_heredoc(struct Word *body, int strip_tabs, int literal, struct Arena *arena);
+const char *shell_getvar(const char *name, struct Arena *arena);
+void set_positional(char *name, int argc, char **argv);
+
+extern char *shell_name;
+extern char **pos_params;
+extern int pos_count;
+extern int expand_error;
+
+#endif
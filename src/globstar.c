@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "globstar.h"
+#include "arena.h"
+
+// Recursive globbing: a `**` path component matches any number of
+// directories, so `src/**/*.c` finds every .c file below src. glob()
+// cannot do this, and a big tree is too slow to walk on one thread, so
+// the walk is spread over a small pool of threads that share a stack of
+// directories still to read. Each directory is read with getdents64()
+// in large batches; the entry types it reports save a stat() per entry.
+//
+// As in bash, `**` does not descend into hidden directories or follow
+// symlinks, and the matches are returned sorted.
+
+#define GLOBSTAR_MAX_THREADS 8
+#define DENTS_BUF_SIZE 65536
+
+enum { COMP_LITERAL, COMP_PATTERN, COMP_STARSTAR };
+
+struct Component {
+    int kind;
+    char *text;         // the pattern, or the unescaped name for literals
+};
+
+struct Task {
+    char *dir;          // "" for the current directory
+    int idx;            // component to match inside dir
+    int below;          // dir is below where the `**` at idx started
+};
+
+// Matches found by one thread, packed back to back with their NULs.
+struct Worker {
+    pthread_t thread;
+    struct Walk *walk;
+    char *buf;
+    size_t len, cap;
+    size_t count;
+    char dents[DENTS_BUF_SIZE];
+};
+
+struct Walk {
+    struct Component *comps;
+    int ncomps;
+    int dirs_only;      // the pattern ended in '/'
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct Task *stack;
+    size_t depth, cap;
+    size_t pending;     // tasks queued or being worked on
+};
+
+struct linux_dirent64 {
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Does the pattern have a `**` component (unescaped, between slashes)?
+int globstar_pattern(const char *pattern) {
+    for (const char *p = pattern; (p = strstr(p, "**")) != NULL; p += 2) {
+        int start = p == pattern || p[-1] == '/';
+        if (start && p > pattern + 1 && p[-2] == '\\') start = 0;
+        if (start && (p[2] == '/' || p[2] == '\0')) return 1;
+    }
+    return 0;
+}
+
+static int has_meta(const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) s++;
+        else if (*s == '*' || *s == '?' || *s == '[') return 1;
+    }
+    return 0;
+}
+
+static char *unescape(const char *s) {
+    char *out = malloc(strlen(s) + 1), *o = out;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) s++;
+        *o++ = *s;
+    }
+    *o = '\0';
+    return out;
+}
+
+static char *join(const char *dir, const char *name) {
+    size_t dl = strlen(dir), nl = strlen(name);
+    char *path = malloc(dl + nl + 2);
+    memcpy(path, dir, dl);
+    if (dl && dir[dl - 1] != '/') path[dl++] = '/';
+    memcpy(path + dl, name, nl + 1);
+    return path;
+}
+
+static void push(struct Walk *w, char *dir, int idx, int below) {
+    pthread_mutex_lock(&w->lock);
+    if (w->depth == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 64;
+        w->stack = realloc(w->stack, w->cap * sizeof(struct Task));
+    }
+    w->stack[w->depth].dir = dir;
+    w->stack[w->depth].idx = idx;
+    w->stack[w->depth].below = below;
+    w->depth++;
+    w->pending++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void emit(struct Worker *wk, const char *dir, const char *name) {
+    size_t dl = strlen(dir), nl = strlen(name);
+    size_t need = dl + nl + 3;
+    if (wk->len + need > wk->cap) {
+        while (wk->len + need > wk->cap) wk->cap = wk->cap ? wk->cap * 2 : 4096;
+        wk->buf = realloc(wk->buf, wk->cap);
+    }
+    char *p = wk->buf + wk->len;
+    memcpy(p, dir, dl);
+    if (dl && dir[dl - 1] != '/') p[dl++] = '/';
+    memcpy(p + dl, name, nl);
+    dl += nl;
+    if (wk->walk->dirs_only) p[dl++] = '/';
+    p[dl++] = '\0';
+    wk->len += dl;
+    wk->count++;
+}
+
+// A directory itself as a match, always with a trailing '/'.
+static void emit_dir(struct Worker *wk, const char *dir) {
+    size_t dl = strlen(dir);
+    if (wk->len + dl + 2 > wk->cap) {
+        while (wk->len + dl + 2 > wk->cap) wk->cap = wk->cap ? wk->cap * 2 : 4096;
+        wk->buf = realloc(wk->buf, wk->cap);
+    }
+    char *p = wk->buf + wk->len;
+    memcpy(p, dir, dl);
+    if (dir[dl - 1] != '/') p[dl++] = '/';
+    p[dl++] = '\0';
+    wk->len += dl;
+    wk->count++;
+}
+
+static int is_dir_at(int dirfd, const char *name, int follow) {
+    struct stat st;
+    return fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Match one entry of dir against component j: report it if j is the last
+// component, otherwise queue it to be searched for the next one.
+static void match_entry(struct Worker *wk, int dirfd, const char *dir,
+                        const char *name, int type, int j) {
+    struct Walk *w = wk->walk;
+    struct Component *c = &w->comps[j];
+
+    if (c->kind == COMP_LITERAL ? strcmp(c->text, name) != 0
+                                : fnmatch(c->text, name, FNM_PERIOD) != 0) {
+        return;
+    }
+    if (j == w->ncomps - 1) {
+        if (!w->dirs_only || type == DT_DIR ||
+            ((type == DT_LNK || type == DT_UNKNOWN) && is_dir_at(dirfd, name, 1))) {
+            emit(wk, dir, name);
+        }
+    } else if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN) {
+        push(w, join(dir, name), j + 1, 0);
+    }
+}
+
+static void run_task(struct Worker *wk, struct Task *t) {
+    struct Walk *w = wk->walk;
+    struct Component *c = &w->comps[t->idx];
+    int last = t->idx == w->ncomps - 1;
+
+    if (c->kind == COMP_LITERAL) {
+        // No need to read the directory for a plain name
+        if (!last) {
+            push(w, join(t->dir, c->text), t->idx + 1, 0);
+        } else {
+            char *path = join(t->dir, c->text);
+            struct stat st;
+            int found = w->dirs_only ? stat(path, &st) == 0 && S_ISDIR(st.st_mode)
+                                     : lstat(path, &st) == 0;
+            if (found) emit(wk, t->dir, c->text);
+            free(path);
+        }
+        return;
+    }
+
+    int fd = open(t->dir[0] ? t->dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    // A final `**` matches the directory it starts in too, as in bash:
+    // `src/**` lists src/ before what is below it
+    if (c->kind == COMP_STARSTAR && last && !t->below && t->dir[0]) emit_dir(wk, t->dir);
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, wk->dents, sizeof(wk->dents))) > 0) {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(wk->dents + off);
+            const char *name = d->d_name;
+            int type = d->d_type;
+            off += d->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            if (c->kind == COMP_PATTERN) {
+                match_entry(wk, fd, t->dir, name, type, t->idx);
+                continue;
+            }
+
+            // `**`: descend into every visible directory, and try the
+            // next component right here (** matching no directory)
+            int hidden = name[0] == '.';
+            if (type == DT_UNKNOWN) type = is_dir_at(fd, name, 0) ? DT_DIR : DT_REG;
+            if (!hidden && type == DT_DIR) push(w, join(t->dir, name), t->idx, 1);
+            if (last) {
+                if (!hidden && (!w->dirs_only || type == DT_DIR)) emit(wk, t->dir, name);
+            } else {
+                match_entry(wk, fd, t->dir, name, type, t->idx + 1);
+            }
+        }
+    }
+    close(fd);
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *wk = arg;
+    struct Walk *w = wk->walk;
+
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->depth == 0 && w->pending > 0) pthread_cond_wait(&w->cond, &w->lock);
+        if (w->depth == 0) break;
+        struct Task t = w->stack[--w->depth];
+        pthread_mutex_unlock(&w->lock);
+
+        run_task(wk, &t);
+        free(t.dir);
+
+        pthread_mutex_lock(&w->lock);
+        if (--w->pending == 0) pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static int walk_threads(void) {
+    cpu_set_t set;
+    int n = 1;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) n = CPU_COUNT(&set);
+    if (n < 1) n = 1;
+    return n > GLOBSTAR_MAX_THREADS ? GLOBSTAR_MAX_THREADS : n;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Expand a pattern with a `**` component. Returns a sorted array of
+// matches in the arena (NULL-terminated), or NULL if nothing matched.
+char **globstar_expand(const char *pattern, struct Arena *arena, size_t *count) {
+    struct Walk w;
+    memset(&w, 0, sizeof(w));
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    *count = 0;
+
+    // Split into components; consecutive `**` are the same as one
+    const char *root = pattern[0] == '/' ? "/" : "";
+    w.comps = malloc((strlen(pattern) / 2 + 2) * sizeof(struct Component));
+    for (const char *p = pattern; *p; ) {
+        while (*p == '/') p++;
+        const char *end = p;
+        while (*end && *end != '/') end++;
+        if (end == p) break;
+        char *text = strndup(p, end - p);
+        int kind = strcmp(text, "**") == 0 ? COMP_STARSTAR
+                 : has_meta(text) ? COMP_PATTERN : COMP_LITERAL;
+        if (kind == COMP_STARSTAR && w.ncomps && w.comps[w.ncomps - 1].kind == COMP_STARSTAR) {
+            free(text);
+        } else {
+            if (kind == COMP_LITERAL) {
+                char *lit = unescape(text);
+                free(text);
+                text = lit;
+            }
+            w.comps[w.ncomps].kind = kind;
+            w.comps[w.ncomps++].text = text;
+        }
+        p = end;
+    }
+    size_t plen = strlen(pattern);
+    w.dirs_only = plen > 1 && pattern[plen - 1] == '/';
+
+    int nthreads = walk_threads();
+    struct Worker *workers = calloc(nthreads, sizeof(struct Worker));
+    if (w.ncomps) push(&w, strdup(root), 0, 0);
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].walk = &w;
+        if (i > 0 && pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            workers[i].walk = NULL;
+        }
+    }
+    // The calling thread works too
+    worker_main(&workers[0]);
+
+    size_t total = 0;
+    for (int i = 0; i < nthreads; i++) {
+        if (i > 0 && workers[i].walk) pthread_join(workers[i].thread, NULL);
+        total += workers[i].count;
+    }
+
+    char **matches = NULL;
+    if (total) {
+        // One copy of each thread's packed buffer, then sort the pointers
+        matches = arena_alloc(arena, (total + 1) * sizeof(char *));
+        size_t n = 0;
+        for (int i = 0; i < nthreads; i++) {
+            if (!workers[i].count) continue;
+            char *p = arena_alloc(arena, workers[i].len);
+            memcpy(p, workers[i].buf, workers[i].len);
+            for (size_t k = 0; k < workers[i].count; k++) {
+                matches[n++] = p;
+                p += strlen(p) + 1;
+            }
+        }
+        qsort(matches, n, sizeof(char *), cmp_str);
+
+        // `a/**/b/**/c` can reach the same path along different splits
+        size_t out = 0;
+        for (size_t k = 0; k < n; k++) {
+            if (out == 0 || strcmp(matches[out - 1], matches[k]) != 0) matches[out++] = matches[k];
+        }
+        matches[out] = NULL;
+        *count = out;
+    }
+
+    for (int i = 0; i < nthreads; i++) free(workers[i].buf);
+    free(workers);
+    for (int i = 0; i < w.ncomps; i++) free(w.comps[i].text);
+    free(w.comps);
+    free(w.stack);
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    return matches;
+}
@@ -0,0 +1,11 @@
+#ifndef GLOBSTAR_H
+#define GLOBSTAR_H
+
+#include <stddef.h>
+
+struct Arena;
+
+int globstar_pattern(const char *pattern);
+char **globstar_expand(const char *pattern, struct Arena *arena, size_t *count);
+
+#endif
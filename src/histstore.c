@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include "histstore.h"
+#include "vars.h"
+
+// Persistent command history (~/.myshell_history, or $HISTFILE).
+//
+// The file is a header followed by append-only records. Each record is
+// written with one write() on an O_APPEND descriptor, under flock(), so
+// any number of shells can add to the same file at once. Every record
+// starts and ends with a magic number and its size, so it can be walked
+// in both directions:
+//
+//   [magic len time] text NUL padding [size magic]
+//
+// Nothing is parsed at startup. The file is mmap()ed, and only the last
+// `window` commands are walked backwards from the end and handed to
+// readline for Up/Down (the in-memory history is capped at that size).
+// The offset index over all records, used by Ctrl-R, is built on the
+// first search. Later searches extend it with the records other shells
+// appended since. A torn record from a crash is skipped by scanning for
+// the next header.
+
+#define HIST_FILE_MAGIC "MSHIST01"
+#define HIST_HEAD_MAGIC 0x31524d48u     // "HMR1"
+#define HIST_TAIL_MAGIC 0x3152544du     // "MTR1"
+#define HIST_MAX_RECORD (1u << 20)
+
+struct RecordHead {
+    uint32_t magic;
+    uint32_t len;           // text length, without the NUL
+    int64_t time;
+};
+
+struct RecordTail {
+    uint32_t size;          // whole record, head to tail
+    uint32_t magic;
+};
+
+static int write_fd = -1;
+static int read_fd = -1;
+static char *map;
+static size_t map_len;
+
+static uint64_t *offsets;       // record offsets, oldest first
+static size_t noffsets, offsets_cap;
+static size_t indexed_to;       // file offset the index covers
+
+static char *last_added;        // for dropping immediate repeats
+
+static size_t record_size(uint32_t len) {
+    return (sizeof(struct RecordHead) + len + 1 + 7) / 8 * 8 + sizeof(struct RecordTail);
+}
+
+// Is there a complete, well-formed record at off?
+static int record_at(size_t off, size_t limit) {
+    if (off % 8 || off + sizeof(struct RecordHead) > limit) return 0;
+    struct RecordHead *h = (struct RecordHead *)(map + off);
+    if (h->magic != HIST_HEAD_MAGIC || h->len > HIST_MAX_RECORD) return 0;
+    size_t size = record_size(h->len);
+    if (off + size > limit) return 0;
+    struct RecordTail *t = (struct RecordTail *)(map + off + size - sizeof(struct RecordTail));
+    return t->magic == HIST_TAIL_MAGIC && t->size == size;
+}
+
+static const char *record_text(size_t off, size_t *len) {
+    struct RecordHead *h = (struct RecordHead *)(map + off);
+    if (len) *len = h->len;
+    return map + off + sizeof(struct RecordHead);
+}
+
+// Map (or re-map) the file as it is now. Returns 0 if there is nothing to read.
+static int remap(void) {
+    struct stat st;
+    if (read_fd < 0 || fstat(read_fd, &st) != 0) return 0;
+    size_t size = st.st_size;
+    if (size == map_len) return map != NULL;
+
+    if (map) munmap(map, map_len);
+    map = NULL;
+    map_len = 0;
+    if (size < sizeof(HIST_FILE_MAGIC) - 1) return 0;
+    void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, read_fd, 0);
+    if (m == MAP_FAILED) return 0;
+    map = m;
+    map_len = size;
+    return 1;
+}
+
+// Extend the offset index to the end of the file.
+static void index_update(void) {
+    if (!remap()) return;
+    size_t off = indexed_to ? indexed_to : sizeof(HIST_FILE_MAGIC) - 1;
+
+    while (off + sizeof(struct RecordHead) <= map_len) {
+        if (!record_at(off, map_len)) {
+            off += 8;           // torn or foreign bytes: look for the next record
+            continue;
+        }
+        if (noffsets == offsets_cap) {
+            offsets_cap = offsets_cap ? offsets_cap * 2 : 4096;
+            offsets = realloc(offsets, offsets_cap * sizeof(uint64_t));
+        }
+        offsets[noffsets++] = off;
+        off += record_size(((struct RecordHead *)(map + off))->len);
+    }
+    indexed_to = off;
+}
+
+// Hand the newest `window` commands to readline, walking back from the end.
+static void load_window(int window) {
+    if (!remap()) return;
+    size_t *starts = malloc(window * sizeof(size_t));
+    size_t end = map_len, header = sizeof(HIST_FILE_MAGIC) - 1;
+    int n = 0;
+
+    while (n < window && end >= header + sizeof(struct RecordHead) + sizeof(struct RecordTail)) {
+        struct RecordTail *t = (struct RecordTail *)(map + end - sizeof(struct RecordTail));
+        if (t->magic != HIST_TAIL_MAGIC || t->size > end - header || !record_at(end - t->size, end)) {
+            break;              // damaged tail: Ctrl-R's forward scan still finds the rest
+        }
+        end -= t->size;
+        starts[n++] = end;
+    }
+
+    const char *prev = NULL;
+    for (int i = n - 1; i >= 0; i--) {
+        const char *text = record_text(starts[i], NULL);
+        if (prev && strcmp(prev, text) == 0) continue;
+        add_history(text);
+        prev = text;
+    }
+    free(starts);
+}
+
+static int ctrl_r_search(int count, int key);
+
+// Open the history file, creating it if needed, and load the window.
+void histstore_init(int window) {
+    const char *path = var_get("HISTFILE");
+    char buf[4096];
+    if (!path) {
+        const char *home = var_get("HOME");
+        if (!home) return;
+        snprintf(buf, sizeof(buf), "%s/.myshell_history", home);
+        path = buf;
+    }
+
+    if (write_fd >= 0) close(write_fd);
+    if (read_fd >= 0) close(read_fd);
+    write_fd = read_fd = -1;
+    stifle_history(window);
+    rl_bind_keyseq("\\C-r", ctrl_r_search);
+
+    write_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    read_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (write_fd < 0 || read_fd < 0) {
+        if (write_fd >= 0) close(write_fd);
+        if (read_fd >= 0) close(read_fd);
+        write_fd = read_fd = -1;
+        return;
+    }
+
+    // A new file gets its header; a file in some other format is left alone
+    char magic[sizeof(HIST_FILE_MAGIC) - 1];
+    flock(write_fd, LOCK_EX);
+    ssize_t n = pread(read_fd, magic, sizeof(magic), 0);
+    if (n == 0) {
+        if (write(write_fd, HIST_FILE_MAGIC, sizeof(magic)) != (ssize_t)sizeof(magic)) n = -1;
+        else n = sizeof(magic);
+    } else if (n != (ssize_t)sizeof(magic) || memcmp(magic, HIST_FILE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "myshell: %s: not a myshell history file, history will not be saved\n", path);
+        n = -1;
+    }
+    flock(write_fd, LOCK_UN);
+    if (n < 0) {
+        close(write_fd);
+        close(read_fd);
+        write_fd = read_fd = -1;
+        return;
+    }
+
+    load_window(window);
+}
+
+// Record a command line in readline's window and in the file.
+void histstore_add(const char *line) {
+    if (last_added && strcmp(last_added, line) == 0) return;
+    free(last_added);
+    last_added = strdup(line);
+    add_history(line);
+    if (write_fd < 0) return;
+
+    size_t len = strlen(line);
+    if (len > HIST_MAX_RECORD) return;
+    size_t size = record_size(len);
+    char *rec = calloc(1, size);
+    struct RecordHead *h = (struct RecordHead *)rec;
+    struct RecordTail *t = (struct RecordTail *)(rec + size - sizeof(struct RecordTail));
+    h->magic = HIST_HEAD_MAGIC;
+    h->len = len;
+    h->time = time(NULL);
+    memcpy(rec + sizeof(*h), line, len);
+    t->size = size;
+    t->magic = HIST_TAIL_MAGIC;
+
+    // One write() per record: with O_APPEND and the lock, records from
+    // concurrent shells never interleave
+    flock(write_fd, LOCK_EX);
+    if (write(write_fd, rec, size) != (ssize_t)size) perror("myshell: history");
+    flock(write_fd, LOCK_UN);
+    free(rec);
+}
+
+// Records seen during one search, so each command is offered only once.
+#define SEEN_MIN 1024
+static uint64_t *seen;
+static size_t seen_cap, seen_count;
+
+static uint64_t text_hash(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+static void seen_reset(void) {
+    if (!seen) {
+        seen_cap = SEEN_MIN;
+        seen = malloc(seen_cap * sizeof(uint64_t));
+    }
+    memset(seen, 0, seen_cap * sizeof(uint64_t));
+    seen_count = 0;
+}
+
+// Returns 1 if h was already there.
+static int seen_insert(uint64_t h) {
+    if ((seen_count + 1) * 2 > seen_cap) {
+        uint64_t *old = seen;
+        size_t old_cap = seen_cap;
+        seen_cap *= 2;
+        seen = calloc(seen_cap, sizeof(uint64_t));
+        seen_count = 0;
+        for (size_t i = 0; i < old_cap; i++) if (old[i]) seen_insert(old[i]);
+        free(old);
+    }
+    size_t i = h & (seen_cap - 1);
+    while (seen[i]) {
+        if (seen[i] == h) return 1;
+        i = (i + 1) & (seen_cap - 1);
+    }
+    seen[i] = h;
+    seen_count++;
+    return 0;
+}
+
+// Newest record at or before index `from` whose text contains query and
+// that was not offered yet. Returns its index, or -1.
+long histstore_search(const char *query, long from) {
+    size_t qlen = strlen(query);
+    for (long i = from; i >= 0; i--) {
+        size_t len;
+        const char *text = record_text(offsets[i], &len);
+        if (!memmem(text, len, query, qlen)) continue;
+        if (seen_insert(text_hash(text, len))) continue;
+        return i;
+    }
+    return -1;
+}
+
+// Make every record in the file searchable. Returns the number of records.
+long histstore_index(void) {
+    index_update();
+    return noffsets;
+}
+
+const char *histstore_text(long idx) {
+    return record_text(offsets[idx], NULL);
+}
+
+void histstore_search_start(void) {
+    seen_reset();
+}
+
+// Ctrl-R: incremental reverse search over the whole file. Typing narrows
+// the match, Ctrl-R steps to older matches, Backspace widens it again,
+// Ctrl-G restores the original line. Any other key accepts the match and
+// is then handled as usual (Enter runs it, arrows start editing it).
+static int ctrl_r_search(int count, int key) {
+    char query[256] = "";
+    size_t qlen = 0;
+    char *original = strdup(rl_line_buffer);
+    int orig_point = rl_point;
+    long total = histstore_index();
+    long match = -1;
+    int failed = 0;
+    (void)count;
+    (void)key;
+
+    histstore_search_start();
+    rl_save_prompt();
+    while (1) {
+        rl_message("(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+        rl_redisplay();
+
+        int c = rl_read_key();
+        if (c == 18) {                          // Ctrl-R: older
+            long m = qlen ? histstore_search(query, match - 1) : -1;
+            if (match >= 0 && m >= 0) match = m;
+            failed = qlen && m < 0;
+        } else if (c == 127 || c == 8) {        // Backspace: widen from the newest
+            if (qlen) query[--qlen] = '\0';
+            histstore_search_start();
+            match = qlen ? histstore_search(query, total - 1) : -1;
+            failed = qlen && match < 0;
+        } else if (c >= 32 && c < 127 && qlen + 1 < sizeof(query)) {
+            query[qlen++] = c;
+            query[qlen] = '\0';
+            histstore_search_start();
+            long m = histstore_search(query, match >= 0 ? match : total - 1);
+            if (m >= 0) match = m;
+            failed = m < 0;
+        } else if (c == 7) {                    // Ctrl-G: give up
+            rl_replace_line(original, 0);
+            rl_point = orig_point;
+            break;
+        } else {
+            if (c == '\r') c = '\n';
+            rl_execute_next(c);
+            break;
+        }
+
+        if (match >= 0) {
+            const char *text = histstore_text(match);
+            rl_replace_line(text, 0);
+            const char *at = qlen ? strstr(text, query) : NULL;
+            rl_point = at ? at - text : (int)strlen(text);
+        }
+    }
+    rl_restore_prompt();
+    rl_clear_message();
+    free(original);
+    return 0;
+}
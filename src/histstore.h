@@ -0,0 +1,16 @@
+#ifndef HISTSTORE_H
+#define HISTSTORE_H
+
+// Commands kept in readline's in-memory history (Up/Down) unless
+// $HISTSIZE says otherwise. The file keeps everything.
+#define HISTORY_WINDOW 1000
+
+void histstore_init(int window);
+void histstore_add(const char *line);
+
+long histstore_index(void);
+void histstore_search_start(void);
+long histstore_search(const char *query, long from);
+const char *histstore_text(long idx);
+
+#endif
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "jobs.h"
+#include "executor.h"
+#include "arena.h"
+
+// The job table. Jobs stay on a doubly linked list in creation order for
+// `jobs`, and are also indexed by job id (a slot array, since ids are small
+// and dense) and by pid (a chained hash over every started process), so
+// starting, reaping and removing a job never walks the other jobs.
+
+struct Job *first_job = NULL;
+static struct Job *last_job = NULL;
+static struct Pool job_pool = POOL_INIT(struct Job);
+static struct Pool process_pool = POOL_INIT(struct Process);
+
+// Set once the shell prompts; until then (rc file, scripts) finished
+// background jobs are dropped as soon as they are reaped.
+int jobs_interactive = 0;
+
+// Usage of every child reaped so far, summed (ru_maxrss: the largest).
+// `time` reads it around the command it measures.
+struct rusage reaped_usage;
+
+// Jobs indexed by id. Like bash, a new job gets one more than the highest
+// id in use, so the array never grows past the number of live jobs by much.
+static struct Job **job_slots;
+static int job_slots_cap;
+static int next_job_id = 1;
+
+// Processes indexed by pid.
+static struct Process **pid_buckets;
+static size_t pid_nbuckets;
+static size_t pid_count;
+
+// Background jobs whose state changed, oldest first.
+static struct Job *notify_head, *notify_tail;
+
+static size_t pid_bucket(pid_t pid) {
+    return ((size_t)pid * 2654435761u) & (pid_nbuckets - 1);
+}
+
+static void pid_table_grow(void) {
+    size_t old_n = pid_nbuckets;
+    struct Process **old = pid_buckets;
+
+    pid_nbuckets = old_n ? old_n * 2 : 64;
+    pid_buckets = calloc(pid_nbuckets, sizeof(struct Process *));
+    if (!pid_buckets) {
+        fprintf(stderr, "myshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < old_n; i++) {
+        struct Process *p = old[i];
+        while (p) {
+            struct Process *next = p->hash_next;
+            size_t b = pid_bucket(p->pid);
+            p->hash_next = pid_buckets[b];
+            pid_buckets[b] = p;
+            p = next;
+        }
+    }
+    free(old);
+}
+
+static struct Process *find_process(pid_t pid) {
+    if (!pid_count) return NULL;
+    for (struct Process *p = pid_buckets[pid_bucket(pid)]; p; p = p->hash_next) {
+        if (p->pid == pid) return p;
+    }
+    return NULL;
+}
+
+static void unhash_process(struct Process *proc) {
+    struct Process **pp = &pid_buckets[pid_bucket(proc->pid)];
+    while (*pp != proc) pp = &(*pp)->hash_next;
+    *pp = proc->hash_next;
+    pid_count--;
+}
+
+struct Job *add_job(int bg, const char *cmd) {
+    struct Job *new_job = pool_alloc(&job_pool);
+    memset(new_job, 0, sizeof(*new_job));
+    new_job->id = next_job_id++;
+    new_job->cmd = strdup(cmd);
+    new_job->state = bg ? JOB_RUNNING : JOB_FOREGROUND;
+
+    if (new_job->id >= job_slots_cap) {
+        int cap = job_slots_cap ? job_slots_cap * 2 : 64;
+        while (cap <= new_job->id) cap *= 2;
+        job_slots = realloc(job_slots, cap * sizeof(struct Job *));
+        memset(job_slots + job_slots_cap, 0, (cap - job_slots_cap) * sizeof(struct Job *));
+        job_slots_cap = cap;
+    }
+    job_slots[new_job->id] = new_job;
+
+    new_job->prev = last_job;
+    if (last_job) last_job->next = new_job;
+    else first_job = new_job;
+    last_job = new_job;
+    return new_job;
+}
+
+// Append a pipeline stage to the job. pid 0 records a stage that never
+// started (e.g. command not found); it is born completed with `status`.
+void add_process(struct Job *job, pid_t pid, int status) {
+    struct Process *p = pool_alloc(&process_pool);
+    memset(p, 0, sizeof(*p));
+    p->pid = pid;
+    p->status = status;
+    p->completed = (pid == 0);
+    p->job = job;
+
+    if (job->last_proc) job->last_proc->next = p;
+    else job->procs = p;
+    job->last_proc = p;
+    job->nprocs++;
+
+    if (pid > 0) {
+        if (pid_count + 1 > pid_nbuckets) pid_table_grow();
+        size_t b = pid_bucket(pid);
+        p->hash_next = pid_buckets[b];
+        pid_buckets[b] = p;
+        pid_count++;
+    }
+}
+
+void remove_job(struct Job *job) {
+    if (job->notify) {
+        struct Job **pp = &notify_head, *prev = NULL;
+        while (*pp != job) {
+            prev = *pp;
+            pp = &(*pp)->notify_next;
+        }
+        *pp = job->notify_next;
+        if (notify_tail == job) notify_tail = prev;
+    }
+
+    if (job->prev) job->prev->next = job->next;
+    else first_job = job->next;
+    if (job->next) job->next->prev = job->prev;
+    else last_job = job->prev;
+
+    job_slots[job->id] = NULL;
+    if (job->id == next_job_id - 1) {
+        while (next_job_id > 1 && job_slots[next_job_id - 1] == NULL) next_job_id--;
+    }
+
+    struct Process *p = job->procs;
+    while (p) {
+        struct Process *next = p->next;
+        if (p->pid > 0) unhash_process(p);
+        pool_free(&process_pool, p);
+        p = next;
+    }
+    free(job->cmd);
+    pool_free(&job_pool, job);
+}
+
+struct Job *find_job_by_pid(pid_t pid) {
+    struct Process *p = find_process(pid);
+    return p ? p->job : NULL;
+}
+
+struct Job *find_job_by_id(int id) {
+    if (id <= 0 || id >= job_slots_cap) return NULL;
+    return job_slots[id];
+}
+
+static void queue_notify(struct Job *job) {
+    if (job->notify) return;
+    job->notify = 1;
+    job->notify_next = NULL;
+    if (notify_tail) notify_tail->notify_next = job;
+    else notify_head = job;
+    notify_tail = job;
+}
+
+static void timeval_add(struct timeval *to, const struct timeval *tv) {
+    to->tv_sec += tv->tv_sec;
+    to->tv_usec += tv->tv_usec;
+    if (to->tv_usec >= 1000000) {
+        to->tv_sec++;
+        to->tv_usec -= 1000000;
+    }
+}
+
+// Add one process's usage to a total. Peak memory is not additive, so
+// ru_maxrss keeps the largest seen.
+void rusage_add(struct rusage *to, const struct rusage *ru) {
+    timeval_add(&to->ru_utime, &ru->ru_utime);
+    timeval_add(&to->ru_stime, &ru->ru_stime);
+    if (ru->ru_maxrss > to->ru_maxrss) to->ru_maxrss = ru->ru_maxrss;
+    to->ru_minflt += ru->ru_minflt;
+    to->ru_majflt += ru->ru_majflt;
+    to->ru_nvcsw += ru->ru_nvcsw;
+    to->ru_nivcsw += ru->ru_nivcsw;
+}
+
+// Record a wait4() result on the process it belongs to. ru is the
+// child's usage, or NULL if it is not known.
+// Returns the owning job, or NULL if the pid is not one of ours.
+// Background jobs that finish, stop or resume are queued for jobs_notify().
+struct Job *mark_process_status(pid_t pid, int status, const struct rusage *ru) {
+    int exited = !WIFSTOPPED(status) && !WIFCONTINUED(status);
+    if (exited && ru) rusage_add(&reaped_usage, ru);
+
+    struct Process *p = find_process(pid);
+    if (!p) return NULL;
+    struct Job *job = p->job;
+
+    if (WIFSTOPPED(status)) {
+        p->stopped = 1;
+    } else if (WIFCONTINUED(status)) {
+        p->stopped = 0;
+    } else {
+        p->status = status;
+        p->completed = 1;
+        if (ru) {
+            p->usage = *ru;
+            rusage_add(&job->usage, ru);
+        }
+    }
+
+    // wait_for_job() reports on foreground jobs itself
+    if (job->state == JOB_FOREGROUND) return job;
+
+    if (job_is_completed(job)) {
+        queue_notify(job);
+    } else if (WIFSTOPPED(status) && job_is_stopped(job)) {
+        if (job->state != JOB_STOPPED) {
+            job->state = JOB_STOPPED;
+            queue_notify(job);
+        }
+    } else if (WIFCONTINUED(status) && job->state == JOB_STOPPED) {
+        job->state = JOB_RUNNING;
+        queue_notify(job);
+    }
+    return job;
+}
+
+// CPU seconds and peak RSS (KiB) of one stage: from wait4() once it is
+// done, read from /proc while it still runs.
+void process_usage(const struct Process *p, double *cpu, long *maxrss) {
+    *cpu = 0;
+    *maxrss = 0;
+    if (p->completed) {
+        *cpu = p->usage.ru_utime.tv_sec + p->usage.ru_stime.tv_sec +
+               (p->usage.ru_utime.tv_usec + p->usage.ru_stime.tv_usec) / 1e6;
+        *maxrss = p->usage.ru_maxrss;
+        return;
+    }
+    if (p->pid <= 0) return;
+
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)p->pid);
+    FILE *f = fopen(path, "re");
+    if (f) {
+        // The command name may contain spaces; the fields after it do not
+        char *end = fgets(buf, sizeof(buf), f) ? strrchr(buf, ')') : NULL;
+        unsigned long utime, stime;
+        if (end && sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                          &utime, &stime) == 2) {
+            *cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)p->pid);
+    f = fopen(path, "re");
+    if (f) {
+        while (fgets(buf, sizeof(buf), f)) {
+            if (sscanf(buf, "VmHWM: %ld", maxrss) == 1) break;
+        }
+        fclose(f);
+    }
+}
+
+int job_is_completed(struct Job *job) {
+    for (struct Process *p = job->procs; p; p = p->next) {
+        if (!p->completed) return 0;
+    }
+    return 1;
+}
+
+int job_is_stopped(struct Job *job) {
+    int any_stopped = 0;
+    for (struct Process *p = job->procs; p; p = p->next) {
+        if (!p->completed && !p->stopped) return 0;
+        if (p->stopped) any_stopped = 1;
+    }
+    return any_stopped;
+}
+
+void continue_job(struct Job *job) {
+    for (struct Process *p = job->procs; p; p = p->next) p->stopped = 0;
+    kill(-job->pgid, SIGCONT);
+}
+
+void wait_for_job(struct Job *job) {
+    int status;
+    pid_t pid;
+    struct rusage ru;
+
+    if (job->pgid > 0) tcsetpgrp(shell_terminal, job->pgid);
+
+    // Without job control (subshells) the stages share our process group
+    pid_t target = job->pgid > 0 ? -job->pgid : -1;
+    while (!job_is_completed(job) && !job_is_stopped(job)) {
+        pid = wait4(target, &status, WUNTRACED, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            // Nothing left to wait for in the group
+            for (struct Process *p = job->procs; p; p = p->next) p->completed = 1;
+            break;
+        }
+        // A spawned child can touch the terminal before the parent's
+        // tcsetpgrp() lands. It owns the terminal now, so just resume it.
+        if (WIFSTOPPED(status) && isatty(shell_terminal) &&
+            (WSTOPSIG(status) == SIGTTIN || WSTOPSIG(status) == SIGTTOU)) {
+            kill(pid, SIGCONT);
+            continue;
+        }
+        mark_process_status(pid, status, &ru);
+    }
+
+    if (job->pgid > 0) tcsetpgrp(shell_terminal, shell_pgid);
+
+    record_job_status(job);
+    if (job_is_stopped(job)) {
+        job->state = JOB_STOPPED;
+        printf("\n[%d]+  Stopped                 %s\n", job->id, job->cmd);
+    } else {
+        remove_job(job);
+    }
+}
+
+// Collect every child that changed state, without blocking. Cheap enough
+// to call between commands: one wait4() when nothing happened.
+void jobs_reap(void) {
+    int wstat;
+    pid_t wpid;
+    struct rusage ru;
+
+    if (!first_job) return;
+    while ((wpid = wait4(-1, &wstat, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        mark_process_status(wpid, wstat, &ru);
+    }
+    if (!jobs_interactive) jobs_notify(0);
+}
+
+int jobs_notify_pending(void) {
+    return notify_head != NULL;
+}
+
+// Tell the user about queued background job changes (if `print`) and drop
+// the jobs that are finished. Returns the number of jobs reported.
+int jobs_notify(int print) {
+    int n = 0;
+    while (notify_head) {
+        struct Job *j = notify_head;
+        notify_head = j->notify_next;
+        if (!notify_head) notify_tail = NULL;
+        j->notify = 0;
+
+        if (job_is_completed(j)) {
+            if (print && j->state == JOB_RUNNING) {
+                printf("[%d]+  Done                    %s\n", j->id, j->cmd);
+                n++;
+            }
+            remove_job(j);
+        } else if (print && j->state == JOB_STOPPED) {
+            printf("[%d]+  Stopped                 %s\n", j->id, j->cmd);
+            n++;
+        } else if (print) {
+            printf("[%d]+  Continued               %s\n", j->id, j->cmd);
+            n++;
+        }
+    }
+    if (n) fflush(stdout);
+    return n;
+}
@@ -0,0 +1,61 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef enum {
+    JOB_FOREGROUND,
+    JOB_RUNNING,
+    JOB_STOPPED
+} JobState;
+
+// One stage of a job's pipeline.
+struct Process {
+    pid_t pid;          // 0 if the stage never started
+    int status;         // wait status once completed
+    int completed;
+    int stopped;
+    int relay;          // a relay between two stages (@rate), not in $PIPESTATUS
+    struct rusage usage;        // from wait4() once completed
+    struct Job *job;
+    struct Process *next;       // next stage of the same job
+    struct Process *hash_next;  // next process in the same pid bucket
+};
+
+struct Job {
+    int id;
+    pid_t pgid;
+    char *cmd;
+    JobState state;
+    struct Process *procs;
+    struct Process *last_proc;
+    int nprocs;
+    struct rusage usage;        // summed over the completed stages
+    int notify;                 // changed state since the user was last told
+    struct Job *notify_next;
+    struct Job *next;
+    struct Job *prev;
+};
+
+extern struct Job *first_job;
+extern int jobs_interactive;
+extern struct rusage reaped_usage;
+
+struct Job *add_job(int bg, const char *cmd);
+void add_process(struct Job *job, pid_t pid, int status);
+void remove_job(struct Job *job);
+struct Job *find_job_by_pid(pid_t pid);
+struct Job *find_job_by_id(int id);
+struct Job *mark_process_status(pid_t pid, int status, const struct rusage *ru);
+void rusage_add(struct rusage *to, const struct rusage *ru);
+void process_usage(const struct Process *p, double *cpu, long *maxrss);
+int job_is_completed(struct Job *job);
+int job_is_stopped(struct Job *job);
+void continue_job(struct Job *job);
+void wait_for_job(struct Job *job);
+void jobs_reap(void);
+int jobs_notify(int print);
+int jobs_notify_pending(void);
+
+#endif
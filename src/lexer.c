@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "lexer.h"
+
+// Single-pass tokenizer. Tokens are (type, start, len) spans into the
+// caller's buffer, which is never modified, so the same buffer can be
+// lexed again (alias splices, cached scripts) and words keep their quotes
+// for the expander to interpret.
+
+void lexer_init(struct Lexer *lx, const char *src) {
+    lx->src = src;
+    lx->pos = src;
+}
+
+static int is_meta(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&' ||
+           c == ';' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+static void set_tok(struct Token *tok, TokenType type, const char *start, int len) {
+    tok->type = type;
+    tok->start = start;
+    tok->len = len;
+}
+
+static const char *skip_dquote(const char *p);
+
+// Skip a command substitution. p points just past the "$(" or the opening
+// backquote. Returns the position after the closing ) or `, or NULL if
+// the input ends first. Quotes, escapes and nested substitutions inside
+// are skipped whole, so their parentheses do not count.
+const char *lexer_skip_subst(const char *p, int backquote) {
+    int depth = 0;
+    while (*p) {
+        if (*p == '\\') {
+            p++;
+            if (*p) p++;
+        } else if (backquote) {
+            if (*p++ == '`') return p;
+        } else if (*p == '\'') {
+            p = strchr(p + 1, '\'');
+            if (!p) return NULL;
+            p++;
+        } else if (*p == '"') {
+            p = skip_dquote(p + 1);
+            if (!p) return NULL;
+        } else if (*p == '`') {
+            p = lexer_skip_subst(p + 1, 1);
+            if (!p) return NULL;
+        } else if (*p == '$' && p[1] == '(') {
+            p = lexer_skip_subst(p + 2, 0);
+            if (!p) return NULL;
+        } else if (*p == '(') {
+            depth++;
+            p++;
+        } else if (*p == ')') {
+            p++;
+            if (depth-- == 0) return p;
+        } else {
+            p++;
+        }
+    }
+    return NULL;
+}
+
+// Skip the inside of a double-quoted string, p just past the opening quote.
+static const char *skip_dquote(const char *p) {
+    while (*p && *p != '"') {
+        if (*p == '\\' && p[1]) {
+            p += 2;
+        } else if (*p == '`' || (*p == '$' && p[1] == '(')) {
+            p = lexer_skip_subst(p + (*p == '`' ? 1 : 2), *p == '`');
+            if (!p) return NULL;
+        } else {
+            p++;
+        }
+    }
+    return *p ? p + 1 : NULL;
+}
+
+// Scan the rest of a word starting at p. Returns the end of the word, or
+// NULL if a quote or command substitution is left open.
+static const char *scan_word(const char *p) {
+    while (*p && !is_meta(*p)) {
+        if (*p == '\\') {
+            p++;
+            if (*p) p++;
+        } else if (*p == '\'') {
+            p = strchr(p + 1, '\'');
+            if (!p) return NULL;
+            p++;
+        } else if (*p == '"') {
+            p = skip_dquote(p + 1);
+            if (!p) return NULL;
+        } else if (*p == '`' || (*p == '$' && p[1] == '(')) {
+            p = lexer_skip_subst(p + (*p == '`' ? 1 : 2), *p == '`');
+            if (!p) return NULL;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+void lexer_next(struct Lexer *lx, struct Token *tok) {
+    const char *p = lx->pos;
+
+    // Skip blanks, line continuations and comments
+    while (1) {
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+        } else if (*p == '\\' && p[1] == '\n') {
+            p += 2;
+        } else if (*p == '#') {
+            while (*p && *p != '\n') p++;
+        } else {
+            break;
+        }
+    }
+
+    const char *s = p;
+    switch (*p) {
+    case '\0':
+        set_tok(tok, TOK_EOF, s, 0);
+        break;
+    case '\n':
+        set_tok(tok, TOK_NEWLINE, s, 1);
+        p++;
+        break;
+    case '|':
+        if (p[1] == '|') { set_tok(tok, TOK_OR_IF, s, 2); p += 2; }
+        else { set_tok(tok, TOK_PIPE, s, 1); p++; }
+        break;
+    case '&':
+        if (p[1] == '&') { set_tok(tok, TOK_AND_IF, s, 2); p += 2; }
+        else if (p[1] == '>') { set_tok(tok, TOK_AND_GREAT, s, 2); p += 2; }
+        else { set_tok(tok, TOK_AMP, s, 1); p++; }
+        break;
+    case ';':
+        if (p[1] == ';') { set_tok(tok, TOK_DSEMI, s, 2); p += 2; }
+        else { set_tok(tok, TOK_SEMI, s, 1); p++; }
+        break;
+    case '<':
+        if (p[1] == '(') goto word;
+        if (p[1] == '<' && p[2] == '<') { set_tok(tok, TOK_TLESS, s, 3); p += 3; }
+        else if (p[1] == '<' && p[2] == '-') { set_tok(tok, TOK_DLESSDASH, s, 3); p += 3; }
+        else if (p[1] == '<') { set_tok(tok, TOK_DLESS, s, 2); p += 2; }
+        else if (p[1] == '&') { set_tok(tok, TOK_LESSAND, s, 2); p += 2; }
+        else if (p[1] == '>') { set_tok(tok, TOK_LESSGREAT, s, 2); p += 2; }
+        else { set_tok(tok, TOK_LESS, s, 1); p++; }
+        break;
+    case '>':
+        if (p[1] == '(') goto word;
+        if (p[1] == '>') { set_tok(tok, TOK_DGREAT, s, 2); p += 2; }
+        else if (p[1] == '&') { set_tok(tok, TOK_GREATAND, s, 2); p += 2; }
+        else { set_tok(tok, TOK_GREAT, s, 1); p++; }
+        break;
+    case '(':
+        set_tok(tok, TOK_LPAREN, s, 1);
+        p++;
+        break;
+    case ')':
+        set_tok(tok, TOK_RPAREN, s, 1);
+        p++;
+        break;
+    default:
+    word: {
+        // <(cmd) and >(cmd), process substitution, start a word
+        const char *end = p;
+        if ((*p == '<' || *p == '>') && p[1] == '(') {
+            end = lexer_skip_subst(p + 2, 0);
+        }
+        if (end) end = scan_word(end);
+        if (!end) {
+            set_tok(tok, TOK_ERROR, s, strlen(s));
+            p = s + tok->len;
+            break;
+        }
+        TokenType type = TOK_WORD;
+        if (*end == '<' || *end == '>') {
+            // "2>" style: an all-digit word glued to a redirection operator
+            const char *q = s;
+            while (q < end && isdigit((unsigned char)*q)) q++;
+            if (q == end) type = TOK_IO_NUMBER;
+        }
+        set_tok(tok, type, s, end - s);
+        p = end;
+        break;
+    }
+    }
+
+    lx->pos = p;
+}
+
+// Printable form of a token for syntax error messages.
+const char *token_name(const struct Token *tok) {
+    static char buf[64];
+    if (tok->type == TOK_EOF || tok->type == TOK_NEWLINE) return "newline";
+    snprintf(buf, sizeof(buf), "%.*s", tok->len, tok->start);
+    return buf;
+}
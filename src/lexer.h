@@ -0,0 +1,47 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+typedef enum {
+    TOK_WORD,
+    TOK_IO_NUMBER,      // digits directly in front of a redirection, e.g. the 2 in 2>
+    TOK_PIPE,           // |
+    TOK_AND_IF,         // &&
+    TOK_OR_IF,          // ||
+    TOK_AMP,            // &
+    TOK_SEMI,           // ;
+    TOK_DSEMI,          // ;; (ends a case item)
+    TOK_NEWLINE,
+    TOK_LESS,           // <
+    TOK_GREAT,          // >
+    TOK_DGREAT,         // >>
+    TOK_AND_GREAT,      // &>
+    TOK_DLESS,          // <<
+    TOK_DLESSDASH,      // <<-
+    TOK_TLESS,          // <<<
+    TOK_LESSAND,        // <&
+    TOK_GREATAND,       // >&
+    TOK_LESSGREAT,      // <>
+    TOK_LPAREN,         // (
+    TOK_RPAREN,         // )
+    TOK_EOF,
+    TOK_ERROR           // unterminated quote or command substitution
+} TokenType;
+
+// A token is a span of the input buffer; nothing is copied.
+struct Token {
+    TokenType type;
+    const char *start;
+    int len;
+};
+
+struct Lexer {
+    const char *src;
+    const char *pos;
+};
+
+void lexer_init(struct Lexer *lx, const char *src);
+void lexer_next(struct Lexer *lx, struct Token *tok);
+const char *token_name(const struct Token *tok);
+const char *lexer_skip_subst(const char *p, int backquote);
+
+#endif
@@ -1,24 +1,124 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "shell.h"
+#include "builtins.h"
+#include "eventloop.h"
+#include "executor.h"
+#include "expand.h"
+#include "options.h"
+#include "vars.h"
+#include "snapshot.h"
+
+extern char **environ;
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: myshell [--norc | --restore snapshot] [-o option] [+o option] "
+          "[-c command [name [arg ...]] | script [arg ...]]\n");
+  exit(2);
+}
 
 int main(int argc, char **argv)
 {
-  (void)argc;
-  (void)argv;
+  const char *command = NULL;
+  const char *restore = NULL;
+  int norc = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--norc") == 0) {
+      norc = 1;
+    } else if (strcmp(argv[i], "--restore") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "myshell: --restore: option requires an argument\n");
+        usage();
+      }
+      restore = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "myshell: -c: option requires an argument\n");
+        usage();
+      }
+      command = argv[++i];
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "+o") == 0) {
+      int opt = i + 1 < argc ? option_index(argv[i + 1]) : -1;
+      if (opt < 0) {
+        fprintf(stderr, "myshell: %s: invalid option name\n", i + 1 < argc ? argv[i + 1] : argv[i]);
+        usage();
+      }
+      shell_options[opt] = argv[i][0] == '-';
+      i++;
+    } else if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      fprintf(stderr, "myshell: %s: invalid option\n", argv[i]);
+      usage();
+    } else {
+      break;
+    }
+  }
+
+  // -c 'cmd' name args...: name becomes $0. A script gets its own path as $0.
+  const char *script = NULL;
+  if (command) {
+    if (i < argc) {
+      set_positional(argv[i], argc - i - 1, argv + i + 1);
+    } else {
+      set_positional(argv[0], 0, argv + i);
+    }
+  } else if (i < argc) {
+    script = argv[i];
+    set_positional(argv[i], argc - i - 1, argv + i + 1);
+  } else {
+    set_positional(argv[0], 0, argv + i);
+  }
+
+  // Interactive only when reading commands from a terminal. Everything
+  // else runs without readline, prompts or job control.
+  int interactive = !command && !script && isatty(STDIN_FILENO);
+  builtins_init();
+  vars_init(environ);
+  shell_pgid = getpid();
+  if (interactive) {
+    event_init();
+  } else {
+    job_control = 0;
+  }
+
+  // A snapshot stands in for .myshellrc; if it cannot be used, the rc
+  // file is run after all
+  if (restore && snapshot_restore(restore)) norc = 1;
 
   // Run .myshellrc if it exists
-  char *home = getenv("HOME");
-  if (home) {
+  const char *home = var_get("HOME");
+  if (home && !norc) {
       char *rc_path = malloc(strlen(home) + 12);
       sprintf(rc_path, "%s/.myshellrc", home);
-      shell_run_file(rc_path);
+      int res = shell_run_file(rc_path);
       free(rc_path);
+      if (!res) return last_command_status;
   }
 
-  // Run command loop.
-  shell_loop();
+  if (command) {
+    shell_run_string(command);
+  } else if (script) {
+    if (access(script, R_OK) != 0) {
+      fprintf(stderr, "myshell: ");
+      perror(script);
+      return 127;
+    }
+    shell_run_file(script);
+  } else if (!interactive) {
+    shell_run_stream(STDIN_FILENO);
+  } else {
+    // Run command loop.
+    shell_loop();
+  }
 
-  return EXIT_SUCCESS;
+  return last_command_status;
 }
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <string.h>
+#include "options.h"
+
+static const char *option_names[OPT_COUNT] = {
+    "spawn",
+    "scriptcache",
+    "cachestats",
+    "globstar",
+    "pipepacket",
+    "bgpin"
+};
+
+int shell_options[OPT_COUNT] = {
+    1, // spawn: launch external commands with posix_spawn()
+    1, // scriptcache: keep compiled .mshc files next to sourced scripts
+    0, // cachestats: report script cache hits/misses and time saved
+    1, // globstar: `**` in a pattern matches any number of directories
+    0, // pipepacket: pipes between stages are O_DIRECT, one read() per write()
+    0  // bgpin: each background job runs on the next CPU set in turn ($BGCPUS)
+};
+
+int option_index(const char *name) {
+    for (int i = 0; i < OPT_COUNT; i++) {
+        if (strcmp(option_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+void option_print(void) {
+    for (int i = 0; i < OPT_COUNT; i++) {
+        printf("%-15s %s\n", option_names[i], shell_options[i] ? "on" : "off");
+    }
+}
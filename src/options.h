@@ -0,0 +1,20 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Shell options toggled with `set -o name` / `set +o name`.
+enum {
+    OPT_SPAWN,
+    OPT_SCRIPTCACHE,
+    OPT_CACHESTATS,
+    OPT_GLOBSTAR,
+    OPT_PIPEPACKET,
+    OPT_BGPIN,
+    OPT_COUNT
+};
+
+extern int shell_options[OPT_COUNT];
+
+int option_index(const char *name);
+void option_print(void);
+
+#endif
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+#include "builtins.h"
+#include "executor.h"
+#include "pathcache.h"
+#include "parser.h"
+#include "arena.h"
+#include "jobs.h"
+
+// parallel [-j N] [-k] command [arg ...] [::: item ...]
+//
+// Runs command once per item, with at most N copies running at a time
+// (default: the CPUs this shell may run on). Items come from the
+// arguments after `:::`, or one per line from stdin. `{}` in the command
+// is replaced by the item, or the item is appended as the last argument.
+// A new job starts as soon as any running one exits.
+//
+// Each job's stdout and stderr go to memfds and are copied out in one
+// piece when it finishes, so the output of different jobs never
+// interleaves. With -k it is released in input order instead of
+// completion order. The status is the number of failed jobs (101 for more
+// than 100), like GNU parallel.
+
+// With -k, how far jobs may run ahead of the oldest one whose output is
+// still held back. Bounds the number of open memfds.
+#define KEEP_WINDOW 256
+
+struct Slot {
+    pid_t pid;          // 0 if free
+    long seq;
+    int out, err;       // memfds holding the job's output
+};
+
+// Output of a finished job waiting for its turn (-k).
+struct Held {
+    int out, err;
+    int done;
+};
+
+struct ItemSource {
+    char **argv;        // items from ::: or NULL to read fd
+    int fd;
+    char *buf;
+    size_t pos, len, cap;
+    int eof;
+};
+
+struct Parallel {
+    char **tmpl;        // the command template
+    int ntmpl;
+    int shell_mode;     // one quoted word with spaces: run it as shell code
+    int in_fd;          // stdin for the jobs, -1 to share ours
+};
+
+static volatile sig_atomic_t parallel_interrupted;
+
+static void parallel_on_sigint(int sig) {
+    (void)sig;
+    parallel_interrupted = 1;
+}
+
+// The CPUs we are allowed to run on, which respects taskset and cpusets,
+// falling back to every online CPU.
+static int online_cpus(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Next item, malloc'd, or NULL when there are no more. Empty lines are skipped.
+static char *next_item(struct ItemSource *src) {
+    if (src->argv) {
+        return *src->argv ? strdup(*src->argv++) : NULL;
+    }
+    while (1) {
+        char *start = src->buf + src->pos;
+        char *nl = memchr(start, '\n', src->len - src->pos);
+        if (nl || (src->eof && src->len > src->pos)) {
+            size_t n = nl ? (size_t)(nl - start) : src->len - src->pos;
+            src->pos += n + (nl != NULL);
+            if (n == 0) continue;
+            return strndup(start, n);
+        }
+        if (src->eof || parallel_interrupted) return NULL;
+
+        // Keep the partial line, make room behind it and read more
+        memmove(src->buf, start, src->len - src->pos);
+        src->len -= src->pos;
+        src->pos = 0;
+        if (src->len == src->cap) {
+            src->cap *= 2;
+            src->buf = realloc(src->buf, src->cap);
+        }
+        ssize_t r = read(src->fd, src->buf + src->len, src->cap - src->len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) src->eof = 1;
+        else src->len += r;
+    }
+}
+
+static void buf_append(char **buf, size_t *len, size_t *cap, const char *s, size_t n) {
+    if (*len + n + 1 > *cap) {
+        while (*len + n + 1 > *cap) *cap *= 2;
+        *buf = realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+// Append s, single-quoted when it is going to be parsed as shell code.
+static void append_item(char **buf, size_t *len, size_t *cap, const char *s, size_t n, int quote) {
+    if (!quote) {
+        buf_append(buf, len, cap, s, n);
+        return;
+    }
+    buf_append(buf, len, cap, "'", 1);
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\'') buf_append(buf, len, cap, "'\\''", 4);
+        else buf_append(buf, len, cap, &s[i], 1);
+    }
+    buf_append(buf, len, cap, "'", 1);
+}
+
+// Replace {} (item), {.} (without extension), {/} (basename), {//}
+// (dirname), {/.} (basename without extension) and {#} (job number) in
+// word. Sets *used if any of them appeared. Returns a malloc'd string.
+static char *substitute(const char *word, const char *item, long seq, int quote, int *used) {
+    size_t cap = strlen(word) + strlen(item) + 16, len = 0;
+    char *buf = malloc(cap);
+    const char *slash = strrchr(item, '/');
+    const char *base = slash ? slash + 1 : item;
+    const char *dot = strrchr(base, '.');
+    size_t ilen = strlen(item);
+    size_t noext = dot && dot != base ? (size_t)(dot - item) : ilen;
+
+    buf[0] = '\0';
+    for (const char *p = word; *p; ) {
+        const char *s = NULL;
+        size_t n = 0, skip = 0;
+        char num[24];
+        if (p[0] == '{') {
+            if (strncmp(p, "{}", 2) == 0) { s = item; n = ilen; skip = 2; }
+            else if (strncmp(p, "{.}", 3) == 0) { s = item; n = noext; skip = 3; }
+            else if (strncmp(p, "{/}", 3) == 0) { s = base; n = item + ilen - base; skip = 3; }
+            else if (strncmp(p, "{//}", 4) == 0) {
+                s = slash ? item : ".";
+                n = slash ? (size_t)(slash - item) : 1;
+                if (slash == item) n = 1;
+                skip = 4;
+            }
+            else if (strncmp(p, "{/.}", 4) == 0) { s = base; n = item + noext - base; skip = 4; }
+            else if (strncmp(p, "{#}", 3) == 0) {
+                n = snprintf(num, sizeof(num), "%ld", seq + 1);
+                s = num;
+                skip = 3;
+            }
+        }
+        if (s) {
+            append_item(&buf, &len, &cap, s, n, quote && s != num);
+            *used = 1;
+            p += skip;
+        } else {
+            buf_append(&buf, &len, &cap, p, 1);
+            p++;
+        }
+    }
+    return buf;
+}
+
+// Start the command for one item with its output going to fresh memfds.
+// Returns 0 if nothing was started.
+static int start_job(struct Parallel *par, const char *item, long seq, struct Slot *slot) {
+    int out = memfd_create("parallel-stdout", MFD_CLOEXEC);
+    int err = out >= 0 ? memfd_create("parallel-stderr", MFD_CLOEXEC) : -1;
+    if (err < 0) {
+        perror("myshell: parallel: memfd_create");
+        if (out >= 0) close(out);
+        return 0;
+    }
+
+    struct FdOp ops[2] = { { 1, out, 0 }, { 2, err, 0 } };
+    struct Redirs redir = { .ops = ops, .nops = 2, .cap = 2 };
+    struct LaunchSpec ls = {
+        .redir = &redir,
+        .in_fd = par->in_fd,
+        .out_fd = -1,
+        .pgid = -1,
+        .foreground = 0
+    };
+
+    struct ArenaMark mark = arena_mark(&cmd_arena);
+    char **argv = NULL;
+    char *text = NULL;
+    int used = 0;
+    pid_t pid = -1;
+
+    if (par->shell_mode) {
+        int status;
+        text = substitute(par->tmpl[0], item, seq, 1, &used);
+        if (!used) {
+            size_t len = strlen(text), cap = len + 1;
+            buf_append(&text, &len, &cap, " ", 1);
+            append_item(&text, &len, &cap, item, strlen(item), 1);
+        }
+        ls.node = parse_line(text, &cmd_arena, &status);
+        if (ls.node) pid = launch_process(&ls);
+    } else {
+        argv = malloc((par->ntmpl + 2) * sizeof(char *));
+        for (int i = 0; i < par->ntmpl; i++) {
+            argv[i] = substitute(par->tmpl[i], item, seq, 0, &used);
+        }
+        argv[par->ntmpl] = used ? NULL : strdup(item);
+        argv[par->ntmpl + 1] = NULL;
+        ls.args = argv;
+        ls.builtin = is_builtin(argv[0]);
+        if (!ls.builtin) ls.path = pathcache_lookup(argv[0]);
+        pid = launch_process(&ls);
+    }
+
+    if (argv) {
+        for (char **a = argv; *a; a++) free(*a);
+        free(argv);
+    }
+    free(text);
+    arena_release(&cmd_arena, mark);
+
+    if (pid <= 0) {
+        close(out);
+        close(err);
+        return 0;
+    }
+    slot->pid = pid;
+    slot->seq = seq;
+    slot->out = out;
+    slot->err = err;
+    return 1;
+}
+
+// Copy everything written to memfd `from` onto `to`, then close it.
+static void drain(int from, int to) {
+    off_t off = 0;
+    ssize_t n;
+
+    while ((n = sendfile(to, from, &off, 1 << 20)) != 0) {
+        if (n > 0) continue;
+        if (errno == EINTR) continue;
+        if (errno != EINVAL && errno != ENOSYS) break;
+
+        // Destinations sendfile() cannot write to
+        char buf[65536];
+        while ((n = pread(from, buf, sizeof(buf), off)) > 0) {
+            for (ssize_t done = 0, w; done < n; done += w) {
+                w = write(to, buf + done, n - done);
+                if (w < 0 && errno == EINTR) w = 0;
+                if (w < 0) goto out;
+            }
+            off += n;
+        }
+        break;
+    }
+out:
+    close(from);
+}
+
+static void emit(int out, int err) {
+    fflush(stdout);
+    fflush(stderr);
+    drain(out, STDOUT_FILENO);
+    drain(err, STDERR_FILENO);
+}
+
+int shell_parallel(char **args) {
+    int njobs = online_cpus();
+    int keep = 0;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-k") == 0) {
+            keep = 1;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char *v = args[i][2] ? args[i] + 2 : args[++i];
+            char *end;
+            long n = v ? strtol(v, &end, 10) : 0;
+            if (!v || *end || end == v || n < 1 || n > 65536) {
+                fprintf(stderr, "myshell: parallel: -j: expected a job count\n");
+                builtin_status = 2;
+                return 1;
+            }
+            njobs = n;
+        } else {
+            fprintf(stderr, "myshell: parallel: %s: invalid option\n", args[i]);
+            fprintf(stderr, "usage: parallel [-j N] [-k] command [arg ...] [::: item ...]\n");
+            builtin_status = 2;
+            return 1;
+        }
+    }
+
+    struct Parallel par = { .tmpl = args + i, .in_fd = -1 };
+    while (args[i] && strcmp(args[i], ":::") != 0) i++;
+    par.ntmpl = args + i - par.tmpl;
+    if (par.ntmpl == 0) {
+        fprintf(stderr, "myshell: parallel: missing command\n");
+        builtin_status = 2;
+        return 1;
+    }
+    par.shell_mode = par.ntmpl == 1 && strpbrk(par.tmpl[0], " \t") != NULL;
+
+    struct ItemSource src = { .fd = STDIN_FILENO };
+    if (args[i]) {
+        src.argv = args + i + 1;
+    } else {
+        // Items come from stdin, so the jobs must not read it
+        src.cap = 65536;
+        src.buf = malloc(src.cap);
+        par.in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        // A script being read from stdin hands its read-ahead back first
+        if (launch_hook) launch_hook();
+    }
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = parallel_on_sigint;
+    sigemptyset(&sa.sa_mask);
+    parallel_interrupted = 0;
+    sigaction(SIGINT, &sa, &old);
+
+    struct Slot *slots = calloc(njobs, sizeof(struct Slot));
+    struct Held held[KEEP_WINDOW] = { { 0 } };
+    int running = 0, failed = 0;
+    long next_seq = 0, emitted = 0;
+    int more = 1;
+
+    while (1) {
+        while (more && !parallel_interrupted && running < njobs &&
+               (!keep || next_seq - emitted < KEEP_WINDOW)) {
+            char *item = next_item(&src);
+            if (!item) {
+                more = 0;
+                break;
+            }
+            int k = 0;
+            while (slots[k].pid) k++;
+            long seq = next_seq++;
+            if (start_job(&par, item, seq, &slots[k])) {
+                running++;
+            } else {
+                failed++;
+                if (keep) held[seq % KEEP_WINDOW] = (struct Held){ -1, -1, 1 };
+            }
+            free(item);
+        }
+        if (keep) {
+            // Release finished output in input order
+            while (emitted < next_seq && held[emitted % KEEP_WINDOW].done) {
+                struct Held *h = &held[emitted % KEEP_WINDOW];
+                if (h->out >= 0) emit(h->out, h->err);
+                h->done = 0;
+                emitted++;
+            }
+        }
+        if (running == 0) break;
+
+        int wstatus;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &wstatus, 0, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int k = 0;
+        while (k < njobs && slots[k].pid != pid) k++;
+        if (k == njobs) {
+            // One of the shell's background jobs
+            mark_process_status(pid, wstatus, &ru);
+            continue;
+        }
+        rusage_add(&reaped_usage, &ru);
+
+        struct Slot *slot = &slots[k];
+        running--;
+        slot->pid = 0;
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) failed++;
+        if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT) parallel_interrupted = 1;
+        if (keep) {
+            held[slot->seq % KEEP_WINDOW] = (struct Held){ slot->out, slot->err, 1 };
+        } else {
+            emit(slot->out, slot->err);
+        }
+    }
+
+    sigaction(SIGINT, &old, NULL);
+    if (keep) {
+        // Interrupted: whatever is still held back is printed as it stands
+        for (; emitted < next_seq; emitted++) {
+            struct Held *h = &held[emitted % KEEP_WINDOW];
+            if (h->done && h->out >= 0) emit(h->out, h->err);
+        }
+    }
+    free(slots);
+    free(src.buf);
+    if (par.in_fd >= 0) close(par.in_fd);
+
+    if (parallel_interrupted) {
+        builtin_status = 130;
+    } else {
+        builtin_status = failed > 100 ? 101 : failed;
+    }
+    return 1;
+}
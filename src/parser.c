@@ -1,37 +1,27 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "parser.h"
+#include "arena.h"
 
-#define LSH_TOK_BUFSIZE 64
-#define LSH_TOK_DELIM " \t\r\n\a"
-
+#include "lexer.h"
+#include "ast.h"
 #include "builtins.h"
+#include "eventloop.h"
+#include "complete.h"
+#include "histstore.h"
+#include "vars.h"
 
-// Generator function for command completion
-char *command_generator(const char *text, int state)
+// Is the word starting at `start` in command position (the start of the
+// line or right after |, ;, & or ()?
+static int command_position(int start)
 {
-  static int list_index, len;
-  char *name;
-
-  // If this is a new word to complete, initialize now.
-  if (!state) {
-    list_index = 0;
-    len = strlen(text);
-  }
-
-  // Return the next name which partially matches from the command list.
-  while ((name = builtin_str[list_index])) {
-    list_index++;
-    if (strncmp(name, text, len) == 0) {
-      return strdup(name);
-    }
-  }
-
-  // If no names matched, then return NULL.
-  return NULL;
+  int i = start - 1;
+  while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t')) i--;
+  return i < 0 || strchr("|;&(", rl_line_buffer[i]) != NULL;
 }
 
 // Custom completion function
@@ -40,105 +30,807 @@ char **shell_completion(const char *text, int start, int end)
   char **matches = NULL;
   (void)end;
 
-  // If this word is at the start of the line, then it is a command to complete.
-  if (start == 0) {
-    matches = rl_completion_matches(text, command_generator);
+  // Command names come from the completion index; paths and arguments
+  // fall back to readline's filename completion.
+  if (command_position(start) && !strchr(text, '/')) {
+    matches = rl_completion_matches(text, complete_command);
   }
 
-  return matches; // If start > 0, returns NULL, falling back to default filename completion
+  return matches;
 }
 
 void shell_init_readline(void)
 {
   rl_attempted_completion_function = shell_completion;
+  complete_init();
+
+  const char *size = var_get("HISTSIZE");
+  int window = size && atoi(size) > 0 ? atoi(size) : HISTORY_WINDOW;
+  histstore_init(window);
 }
 
 char *shell_read_line(const char *prompt)
 {
-  char *line = readline(prompt);
+  char *line = event_readline(prompt);
 
   // If EOF is encountered, readline returns NULL.
   if (!line) {
     exit(EXIT_SUCCESS);
   }
 
-  // If line is not empty, add it to history
-  if (line[0] != '\0') {
-    add_history(line);
-  }
-
   return line;
 }
 
-char **shell_split_line(char *line)
-{
-  int bufsize = LSH_TOK_BUFSIZE, position = 0;
-  char **tokens = malloc(bufsize * sizeof(char*));
-  char *token;
+// Recursive-descent parser over the token stream:
+//
+//   list     : and_or ((';' | '&' | NEWLINE) and_or)*
+//   and_or   : 'time' and_or | pipeline (('&&' | '||') pipeline)*
+//   pipeline : 'time' pipeline | '!' pipeline | command ('|' command)*
+//   command  : compound redirect* | funcdef | (WORD | redirect)+
+//   compound : '(' list ')' | '{' list '}'
+//            | 'if' list 'then' list ('elif' list 'then' list)* ['else' list] 'fi'
+//            | ('while' | 'until') list 'do' list 'done'
+//            | 'for' NAME ['in' WORD*] (';' | NEWLINE) 'do' list 'done'
+//            | 'case' WORD 'in' (['('] WORD ('|' WORD)* ')' list [';;'])* 'esac'
+//   funcdef  : NAME '(' ')' compound redirect* | 'function' NAME ['(' ')'] compound redirect*
+//   redirect : [IO_NUMBER] ('<' | '>' | '>>' | '&>' | '<<' | '<<-' | '<<<' | '<&' | '>&' | '<>') WORD
+//
+// Reserved words (if, then, do, done, {, }, ...) are only recognized
+// unquoted and in command position; anywhere else they are plain words.
+//
+// A here-document's body starts on the line after its operator. The
+// operators are queued as they are parsed and their bodies are read straight
+// from the source when the parser moves past the next newline, so the body
+// is a span of the input like every other word.
 
-  if (!tokens) {
-    fprintf(stderr, "myshell: allocation error\n");
-    exit(EXIT_FAILURE);
-  }
+struct Parser {
+    struct Lexer lx;
+    struct Token tok;       // current lookahead
+    const char *last_end;   // end of the last consumed token
+    struct Arena *arena;
+    int status;
+    int recover;            // skip bad lines instead of failing (scripts)
+    int partial;            // more input may follow; running out is not an error
+    int errors;             // lines skipped in recover mode
+    struct Redir **heredocs;    // here-documents waiting for their bodies
+    int nheredocs;
+    int heredocs_cap;
+    struct Redir *spliced;  // bodies for an alias splice, see parse_spliced()
+};
 
-  token = strtok(line, LSH_TOK_DELIM);
-  while (token != NULL) {
-    tokens[position] = token;
-    position++;
+static int is_heredoc(const struct Redir *r) {
+    return r->type == REDIR_HEREDOC || r->type == REDIR_HEREDOC_STRIP;
+}
 
-    if (position >= bufsize) {
-      bufsize += LSH_TOK_BUFSIZE;
-      tokens = realloc(tokens, bufsize * sizeof(char*));
-      if (!tokens) {
-        fprintf(stderr, "myshell: allocation error\n");
-        exit(EXIT_FAILURE);
-      }
+// The delimiter is the word after quote removal; any quoting in it makes
+// the body literal.
+static int heredoc_delimiter(struct Redir *r, char *out, int cap) {
+    int n = 0;
+    const char *w = r->target.text, *end = w + r->target.len;
+    while (w < end && n < cap - 1) {
+        if (*w == '\\' && w + 1 < end) {
+            r->literal = 1;
+            out[n++] = w[1];
+            w += 2;
+        } else if (*w == '\'' || *w == '"') {
+            r->literal = 1;
+            w++;
+        } else {
+            out[n++] = *w++;
+        }
     }
+    out[n] = '\0';
+    return n;
+}
 
-    token = strtok(NULL, LSH_TOK_DELIM);
-  }
-  tokens[position] = NULL;
-  return tokens;
-}
-
-#include <glob.h>
-
-char **shell_expand_args(char **args) {
-    int bufsize = LSH_TOK_BUFSIZE;
-    int position = 0;
-    char **new_args = malloc(bufsize * sizeof(char*));
-
-    for (int i = 0; args[i] != NULL; i++) {
-        char *token = args[i];
-        
-        // Variable expansion
-        if (token[0] == '$') {
-            char *val = getenv(token + 1);
-            token = val ? val : "";
-        }
-        
-        // Globbing
-        glob_t glob_result;
-        memset(&glob_result, 0, sizeof(glob_result));
-        int ret = glob(token, GLOB_NOCHECK | GLOB_TILDE, NULL, &glob_result);
-        
-        if (ret == 0) {
-            for (size_t j = 0; j < glob_result.gl_pathc; j++) {
-                new_args[position++] = strdup(glob_result.gl_pathv[j]);
-                if (position >= bufsize) {
-                    bufsize += LSH_TOK_BUFSIZE;
-                    new_args = realloc(new_args, bufsize * sizeof(char*));
+// Read the bodies of the queued here-documents, which start at the
+// lexer's position (just past a newline), and move the lexer beyond them.
+static void read_heredocs(struct Parser *p) {
+    const char *q = p->lx.pos;
+    for (int i = 0; i < p->nheredocs; i++) {
+        struct Redir *r = p->heredocs[i];
+        char delim[256];
+        int dlen = heredoc_delimiter(r, delim, sizeof(delim));
+        const char *body = q;
+
+        while (1) {
+            const char *line = q;
+            if (r->type == REDIR_HEREDOC_STRIP) while (*line == '\t') line++;
+            const char *eol = strchr(line, '\n');
+            if (!eol) eol = line + strlen(line);
+            if (eol - line == dlen && memcmp(line, delim, dlen) == 0) {
+                r->target.text = body;
+                r->target.len = q - body;
+                q = *eol ? eol + 1 : eol;
+                break;
+            }
+            if (!*eol) {
+                // Ran out of input before the delimiter line
+                r->target.text = body;
+                r->target.len = eol - body;
+                q = eol;
+                if (p->partial) {
+                    if (p->status == PARSE_OK) p->status = PARSE_INCOMPLETE;
+                } else {
+                    fprintf(stderr, "myshell: warning: here-document delimited by end-of-file (wanted `%s')\n", delim);
                 }
+                break;
             }
-            globfree(&glob_result);
-        } else {
-            new_args[position++] = strdup(token);
-            if (position >= bufsize) {
-                bufsize += LSH_TOK_BUFSIZE;
-                new_args = realloc(new_args, bufsize * sizeof(char*));
+            q = eol + 1;
+        }
+    }
+    p->nheredocs = 0;
+    p->lx.pos = q;
+}
+
+// Input ended with here-documents still waiting: an alias splice takes the
+// bodies the original command already read, anything else reads nothing.
+static void finish_heredocs(struct Parser *p) {
+    if (!p->nheredocs) return;
+    if (p->spliced) {
+        for (int i = 0; i < p->nheredocs; i++) {
+            while (p->spliced && !is_heredoc(p->spliced)) p->spliced = p->spliced->next;
+            if (!p->spliced) break;
+            p->heredocs[i]->target = p->spliced->target;
+            p->heredocs[i]->literal = p->spliced->literal;
+            p->spliced = p->spliced->next;
+        }
+        p->nheredocs = 0;
+        return;
+    }
+    read_heredocs(p);
+}
+
+static void advance(struct Parser *p) {
+    p->last_end = p->tok.start + p->tok.len;
+    if (p->tok.type == TOK_NEWLINE && p->nheredocs) read_heredocs(p);
+    lexer_next(&p->lx, &p->tok);
+}
+
+static void skip_newlines(struct Parser *p) {
+    while (p->tok.type == TOK_NEWLINE) advance(p);
+}
+
+static void syntax_error(struct Parser *p) {
+    if (p->status != PARSE_OK) return;
+    if (p->tok.type == TOK_ERROR || p->tok.type == TOK_EOF) {
+        // Open quote, or input ended where a command was required
+        p->status = PARSE_INCOMPLETE;
+        if (!p->partial) fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+    } else {
+        p->status = PARSE_ERROR;
+        fprintf(stderr, "myshell: syntax error near unexpected token `%s'\n", token_name(&p->tok));
+    }
+}
+
+static struct Node *new_node(struct Parser *p, NodeType type, const char *start) {
+    struct Node *n = arena_alloc(p->arena, sizeof(struct Node));
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->src.text = start;
+    n->src.len = p->last_end - start;
+    return n;
+}
+
+static int is_redir_op(TokenType t) {
+    return t == TOK_LESS || t == TOK_GREAT || t == TOK_DGREAT || t == TOK_AND_GREAT ||
+           t == TOK_DLESS || t == TOK_DLESSDASH || t == TOK_TLESS || t == TOK_LESSAND ||
+           t == TOK_GREATAND || t == TOK_LESSGREAT;
+}
+
+// Parses one redirection into *out. Returns 0 on a syntax error.
+static int parse_redirect(struct Parser *p, struct Redir **out) {
+    int fd = -1;
+    if (p->tok.type == TOK_IO_NUMBER) {
+        fd = atoi(p->tok.start);
+        advance(p);
+    }
+
+    struct Redir *r = arena_alloc(p->arena, sizeof(struct Redir));
+    switch (p->tok.type) {
+    case TOK_LESS:      r->type = REDIR_IN; break;
+    case TOK_GREAT:     r->type = REDIR_OUT; break;
+    case TOK_DGREAT:    r->type = REDIR_APPEND; break;
+    case TOK_AND_GREAT: r->type = REDIR_OUT_ERR; break;
+    case TOK_DLESS:     r->type = REDIR_HEREDOC; break;
+    case TOK_DLESSDASH: r->type = REDIR_HEREDOC_STRIP; break;
+    case TOK_TLESS:     r->type = REDIR_HERESTRING; break;
+    case TOK_LESSAND:   r->type = REDIR_DUP_IN; break;
+    case TOK_GREATAND:  r->type = REDIR_DUP_OUT; break;
+    case TOK_LESSGREAT: r->type = REDIR_RDWR; break;
+    default:
+        syntax_error(p);
+        return 0;
+    }
+    r->fd = fd >= 0 ? fd : (r->type == REDIR_OUT || r->type == REDIR_APPEND ||
+                            r->type == REDIR_OUT_ERR || r->type == REDIR_DUP_OUT ? 1 : 0);
+    r->literal = 0;
+    advance(p);
+
+    if (p->tok.type != TOK_WORD) {
+        syntax_error(p);
+        return 0;
+    }
+    // `>&file`, with no descriptor in front or after it, is csh's &>file
+    if (r->type == REDIR_DUP_OUT && fd < 0 && !isdigit((unsigned char)p->tok.start[0]) &&
+        p->tok.start[0] != '-' && p->tok.start[0] != '$') {
+        r->type = REDIR_OUT_ERR;
+    }
+    r->target.text = p->tok.start;
+    r->target.len = p->tok.len;
+    r->next = NULL;
+    if (is_heredoc(r)) {
+        if (p->nheredocs == p->heredocs_cap) {
+            int cap = p->heredocs_cap ? p->heredocs_cap * 2 : 4;
+            p->heredocs = arena_grow(p->arena, p->heredocs, p->heredocs_cap * sizeof(struct Redir *),
+                                     cap * sizeof(struct Redir *));
+            p->heredocs_cap = cap;
+        }
+        p->heredocs[p->nheredocs++] = r;
+    }
+    advance(p);
+
+    *out = r;
+    return 1;
+}
+
+// Redirections after a compound command, appended to *list.
+static int parse_redirects(struct Parser *p, struct Redir **list) {
+    while (*list) list = &(*list)->next;
+    while (p->tok.type == TOK_IO_NUMBER || is_redir_op(p->tok.type)) {
+        if (!parse_redirect(p, list)) return 0;
+        list = &(*list)->next;
+    }
+    return 1;
+}
+
+static int at_word(struct Parser *p, const char *word) {
+    int len = strlen(word);
+    return p->tok.type == TOK_WORD && p->tok.len == len && strncmp(p->tok.start, word, len) == 0;
+}
+
+// Reserved words are looked for in front of every command; this turns
+// most words away before comparing them with each one.
+static int maybe_reserved(struct Parser *p) {
+    return p->tok.type == TOK_WORD && p->tok.len <= 8 && strchr("!{}cdefituw", p->tok.start[0]);
+}
+
+// Reserved words that end the list of a compound command.
+static const char *const list_ends[] = { "then", "elif", "else", "fi", "do", "done", "esac", "}", NULL };
+
+static int at_list_end(struct Parser *p) {
+    if (p->tok.type == TOK_DSEMI) return 1;
+    if (!maybe_reserved(p)) return 0;
+    for (int i = 0; list_ends[i]; i++) {
+        if (at_word(p, list_ends[i])) return 1;
+    }
+    return 0;
+}
+
+// Consume the reserved word that has to come next.
+static int expect(struct Parser *p, const char *word) {
+    if (!at_word(p, word)) {
+        syntax_error(p);
+        return 0;
+    }
+    advance(p);
+    return 1;
+}
+
+// The lists of if, while, for and { } may not be empty.
+static int nonempty(struct Parser *p, struct Node *list) {
+    if (!list) syntax_error(p);
+    return list != NULL;
+}
+
+static struct Node *parse_list(struct Parser *p, TokenType end);
+static struct Node *parse_command(struct Parser *p);
+
+// Bodies of compound commands end at a reserved word; a `)` there can
+// only be an error.
+#define parse_body(p) parse_list(p, TOK_RPAREN)
+
+// if/elif: an elif is parsed as an if nested in the else branch, and
+// consumes the fi.
+static struct Node *parse_if(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    struct Node *cond = parse_body(p);
+    if (!nonempty(p, cond) || !expect(p, "then")) return NULL;
+    struct Node *body = parse_body(p);
+    if (!nonempty(p, body)) return NULL;
+    struct Node *orelse = NULL;
+    if (at_word(p, "elif")) {
+        if (!(orelse = parse_if(p))) return NULL;
+    } else {
+        if (at_word(p, "else")) {
+            advance(p);
+            orelse = parse_body(p);
+            if (!nonempty(p, orelse)) return NULL;
+        }
+        if (!expect(p, "fi")) return NULL;
+    }
+    struct Node *n = new_node(p, NODE_IF, start);
+    n->ctl.cond = cond;
+    n->ctl.body = body;
+    n->ctl.orelse = orelse;
+    return n;
+}
+
+static struct Node *parse_loop(struct Parser *p, NodeType type) {
+    const char *start = p->tok.start;
+    advance(p);
+    struct Node *cond = parse_body(p);
+    if (!nonempty(p, cond) || !expect(p, "do")) return NULL;
+    struct Node *body = parse_body(p);
+    if (!nonempty(p, body) || !expect(p, "done")) return NULL;
+    struct Node *n = new_node(p, type, start);
+    n->ctl.cond = cond;
+    n->ctl.body = body;
+    return n;
+}
+
+static struct Node *parse_for(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    if (p->tok.type != TOK_WORD || var_name_len(p->tok.start, p->tok.len) != p->tok.len) {
+        syntax_error(p);
+        return NULL;
+    }
+    struct Word name = { p->tok.start, p->tok.len };
+    advance(p);
+    skip_newlines(p);
+
+    int nwords = -1, cap = 0;
+    struct Word *words = NULL;
+    if (at_word(p, "in")) {
+        advance(p);
+        nwords = 0;
+        while (p->tok.type == TOK_WORD) {
+            if (nwords == cap) {
+                words = arena_grow(p->arena, words, cap * sizeof(struct Word),
+                                   (cap ? cap * 2 : 8) * sizeof(struct Word));
+                cap = cap ? cap * 2 : 8;
             }
+            words[nwords].text = p->tok.start;
+            words[nwords].len = p->tok.len;
+            nwords++;
+            advance(p);
         }
+        if (p->tok.type != TOK_SEMI && p->tok.type != TOK_NEWLINE) {
+            syntax_error(p);
+            return NULL;
+        }
+        advance(p);
+    } else if (p->tok.type == TOK_SEMI) {
+        advance(p);
+    }
+    skip_newlines(p);
+    if (!expect(p, "do")) return NULL;
+    struct Node *body = parse_body(p);
+    if (!nonempty(p, body) || !expect(p, "done")) return NULL;
+
+    struct Node *n = new_node(p, NODE_FOR, start);
+    n->loop.name = name;
+    n->loop.nwords = nwords;
+    n->loop.words = words;
+    n->loop.body = body;
+    return n;
+}
+
+static struct Node *parse_case(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    if (p->tok.type != TOK_WORD) {
+        syntax_error(p);
+        return NULL;
     }
-    new_args[position] = NULL;
-    return new_args;
+    struct Word word = { p->tok.start, p->tok.len };
+    advance(p);
+    skip_newlines(p);
+    if (!expect(p, "in")) return NULL;
+    skip_newlines(p);
+
+    int n = 0, cap = 0;
+    struct CaseItem *items = NULL;
+    while (!at_word(p, "esac")) {
+        if (n == cap) {
+            items = arena_grow(p->arena, items, cap * sizeof(struct CaseItem),
+                               (cap ? cap * 2 : 4) * sizeof(struct CaseItem));
+            cap = cap ? cap * 2 : 4;
+        }
+        struct CaseItem *item = &items[n++];
+        int pcap = 0;
+        memset(item, 0, sizeof(*item));
+
+        if (p->tok.type == TOK_LPAREN) advance(p);
+        while (1) {
+            if (p->tok.type != TOK_WORD) {
+                syntax_error(p);
+                return NULL;
+            }
+            if (item->npatterns == pcap) {
+                item->patterns = arena_grow(p->arena, item->patterns, pcap * sizeof(struct Word),
+                                            (pcap ? pcap * 2 : 2) * sizeof(struct Word));
+                pcap = pcap ? pcap * 2 : 2;
+            }
+            item->patterns[item->npatterns].text = p->tok.start;
+            item->patterns[item->npatterns].len = p->tok.len;
+            item->npatterns++;
+            advance(p);
+            if (p->tok.type != TOK_PIPE) break;
+            advance(p);
+        }
+        if (p->tok.type != TOK_RPAREN) {
+            syntax_error(p);
+            return NULL;
+        }
+        advance(p);
+
+        // An item may be empty, and the last one needs no ;;
+        item->body = parse_body(p);
+        if (p->status != PARSE_OK) return NULL;
+        if (p->tok.type == TOK_DSEMI) {
+            advance(p);
+            skip_newlines(p);
+        } else if (!at_word(p, "esac")) {
+            syntax_error(p);
+            return NULL;
+        }
+    }
+    advance(p);
+
+    struct Node *node = new_node(p, NODE_CASE, start);
+    node->match.word = word;
+    node->match.n = n;
+    node->match.items = items;
+    return node;
+}
+
+// { list; }
+static struct Node *parse_group(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    struct Node *body = parse_body(p);
+    if (!nonempty(p, body) || !expect(p, "}")) return NULL;
+    struct Node *n = new_node(p, NODE_GROUP, start);
+    n->sub.body = body;
+    return n;
+}
+
+static struct Node *parse_subshell(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    struct Node *body = parse_list(p, TOK_RPAREN);
+    if (!body || p->tok.type != TOK_RPAREN) {
+        syntax_error(p);
+        return NULL;
+    }
+    advance(p);
+    struct Node *n = new_node(p, NODE_SUBSHELL, start);
+    n->sub.body = body;
+    return n;
+}
+
+// The redirections of a compound command apply to all of it.
+static struct Redir **compound_redirs(struct Node *n) {
+    switch (n->type) {
+    case NODE_SUBSHELL:
+    case NODE_GROUP:
+        return &n->sub.redirs;
+    case NODE_IF:
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        return &n->ctl.redirs;
+    case NODE_FOR:
+        return &n->loop.redirs;
+    case NODE_CASE:
+        return &n->match.redirs;
+    default:
+        return NULL;
+    }
+}
+
+static struct Node *parse_compound(struct Parser *p) {
+    const char *start = p->tok.start;
+    struct Node *n;
+    if (p->tok.type == TOK_LPAREN) n = parse_subshell(p);
+    else if (at_word(p, "{")) n = parse_group(p);
+    else if (at_word(p, "if")) n = parse_if(p);
+    else if (at_word(p, "while")) n = parse_loop(p, NODE_WHILE);
+    else if (at_word(p, "until")) n = parse_loop(p, NODE_UNTIL);
+    else if (at_word(p, "for")) n = parse_for(p);
+    else if (at_word(p, "case")) n = parse_case(p);
+    else return NULL;
+
+    if (!n || !parse_redirects(p, compound_redirs(n))) return NULL;
+    n->src.text = start;
+    n->src.len = p->last_end - start;
+    return n;
+}
+
+static int at_compound(struct Parser *p) {
+    if (p->tok.type == TOK_LPAREN) return 1;
+    return maybe_reserved(p) && (at_word(p, "{") || at_word(p, "if") || at_word(p, "while") ||
+                                 at_word(p, "until") || at_word(p, "for") || at_word(p, "case"));
+}
+
+// The body of a function definition, after `name()`.
+static struct Node *parse_funcdef(struct Parser *p, const char *start, struct Word name) {
+    skip_newlines(p);
+    if (!at_compound(p)) {
+        syntax_error(p);
+        return NULL;
+    }
+    struct Node *body = parse_compound(p);
+    if (!body) return NULL;
+    struct Node *n = new_node(p, NODE_FUNCTION, start);
+    n->func.name = name;
+    n->func.body = body;
+    return n;
+}
+
+static int valid_name(const struct Token *tok) {
+    return tok->type == TOK_WORD && var_name_len(tok->start, tok->len) == tok->len;
+}
+
+// `function name [()] compound`
+static struct Node *parse_function(struct Parser *p) {
+    const char *start = p->tok.start;
+    advance(p);
+    if (!valid_name(&p->tok)) {
+        syntax_error(p);
+        return NULL;
+    }
+    struct Word name = { p->tok.start, p->tok.len };
+    advance(p);
+    if (p->tok.type == TOK_LPAREN) {
+        advance(p);
+        if (p->tok.type != TOK_RPAREN) {
+            syntax_error(p);
+            return NULL;
+        }
+        advance(p);
+    }
+    return parse_funcdef(p, start, name);
+}
+
+static struct Node *parse_command(struct Parser *p) {
+    const char *start = p->tok.start;
+    struct Redir *redirs = NULL, **redir_tail = &redirs;
+
+    if (at_compound(p)) return parse_compound(p);
+    if (at_word(p, "function")) return parse_function(p);
+
+    int argc = 0, cap = 8;
+    struct Word *argv = arena_alloc(p->arena, cap * sizeof(struct Word));
+
+    while (1) {
+        if (p->tok.type == TOK_LPAREN && argc == 1 && !redirs &&
+            var_name_len(argv[0].text, argv[0].len) == argv[0].len) {
+            // name() compound
+            advance(p);
+            if (p->tok.type != TOK_RPAREN) {
+                syntax_error(p);
+                return NULL;
+            }
+            advance(p);
+            return parse_funcdef(p, start, argv[0]);
+        } else if (p->tok.type == TOK_WORD) {
+            if (argc + 1 >= cap) {
+                argv = arena_grow(p->arena, argv, cap * sizeof(struct Word),
+                                  cap * 2 * sizeof(struct Word));
+                cap *= 2;
+            }
+            argv[argc].text = p->tok.start;
+            argv[argc].len = p->tok.len;
+            argc++;
+            advance(p);
+        } else if (p->tok.type == TOK_IO_NUMBER || is_redir_op(p->tok.type)) {
+            if (!parse_redirect(p, redir_tail)) return NULL;
+            redir_tail = &(*redir_tail)->next;
+        } else {
+            break;
+        }
+    }
+
+    if (argc == 0 && redirs == NULL) {
+        syntax_error(p);
+        return NULL;
+    }
+
+    struct Node *n = new_node(p, NODE_COMMAND, start);
+    n->cmd.argc = argc;
+    n->cmd.argv = argv;
+    n->cmd.redirs = redirs;
+    return n;
+}
+
+// `time` is a reserved word only unquoted, in command position.
+static int at_time(struct Parser *p) {
+    return at_word(p, "time");
+}
+
+// Parses `time` and what it measures. On its own, `time` times nothing.
+static struct Node *parse_time(struct Parser *p, struct Node *(*body)(struct Parser *)) {
+    const char *start = p->tok.start;
+    advance(p);
+    struct Node *n = NULL;
+    TokenType t = p->tok.type;
+    if (t != TOK_NEWLINE && t != TOK_SEMI && t != TOK_AMP && t != TOK_RPAREN && t != TOK_EOF) {
+        n = body(p);
+        if (!n) return NULL;
+    }
+    struct Node *timed = new_node(p, NODE_TIME, start);
+    timed->sub.body = n;
+    return timed;
+}
+
+static struct Node *parse_pipeline(struct Parser *p) {
+    const char *start = p->tok.start;
+    if (at_time(p)) return parse_time(p, parse_pipeline);
+    if (at_word(p, "!")) {
+        advance(p);
+        struct Node *body = parse_pipeline(p);
+        if (!body) {
+            syntax_error(p);
+            return NULL;
+        }
+        struct Node *n = new_node(p, NODE_NOT, start);
+        n->sub.body = body;
+        return n;
+    }
+    struct Node *first = parse_command(p);
+    if (!first || p->tok.type != TOK_PIPE) return first;
+
+    int n = 1, cap = 4;
+    struct Node **stages = arena_alloc(p->arena, cap * sizeof(struct Node *));
+    stages[0] = first;
+
+    while (p->tok.type == TOK_PIPE) {
+        advance(p);
+        skip_newlines(p);
+        struct Node *stage = parse_command(p);
+        if (!stage) return NULL;
+        if (n == cap) {
+            stages = arena_grow(p->arena, stages, cap * sizeof(struct Node *),
+                                cap * 2 * sizeof(struct Node *));
+            cap *= 2;
+        }
+        stages[n++] = stage;
+    }
+
+    struct Node *node = new_node(p, NODE_PIPELINE, start);
+    node->pipe.n = n;
+    node->pipe.stages = stages;
+    return node;
+}
+
+// A leading `time` covers the whole list; after && or || it only covers
+// the pipeline that follows, so it never regroups the operators.
+static struct Node *parse_and_or(struct Parser *p) {
+    const char *start = p->tok.start;
+    if (at_time(p)) return parse_time(p, parse_and_or);
+    struct Node *left = parse_pipeline(p);
+
+    while (left && (p->tok.type == TOK_AND_IF || p->tok.type == TOK_OR_IF)) {
+        NodeType type = p->tok.type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        advance(p);
+        skip_newlines(p);
+        struct Node *right = parse_pipeline(p);
+        if (!right) return NULL;
+        struct Node *n = new_node(p, type, start);
+        n->pair.left = left;
+        n->pair.right = right;
+        left = n;
+    }
+    return left;
+}
+
+// Sequences are built right-leaning (a ; (b ; c)) so the executor can walk
+// them iteratively no matter how long a script is.
+static struct Node *parse_list(struct Parser *p, TokenType end) {
+    struct Node *head = NULL;
+    struct Node **tail = &head;
+
+    skip_newlines(p);
+    while (p->tok.type != end && p->tok.type != TOK_EOF) {
+        const char *start = p->tok.start;
+        struct Node *n = NULL;
+        if (!at_list_end(p)) {
+            n = parse_and_or(p);
+        } else if (end != TOK_EOF) {
+            break;
+        } else {
+            syntax_error(p);   // fi, done, ... with nothing to end
+        }
+
+        if (n && p->tok.type == TOK_AMP) {
+            advance(p);
+            struct Node *bg = new_node(p, NODE_BACKGROUND, start);
+            bg->sub.body = n;
+            n = bg;
+        } else if (n && (p->tok.type == TOK_SEMI || p->tok.type == TOK_NEWLINE)) {
+            advance(p);
+        } else if (n && p->tok.type != end && p->tok.type != TOK_EOF && (end == TOK_EOF || !at_list_end(p))) {
+            syntax_error(p);
+            n = NULL;
+        }
+
+        if (!n) {
+            // Scripts skip the offending line and carry on, like running
+            // them line by line would
+            if (!p->recover || end != TOK_EOF) return NULL;
+            p->errors++;
+            if (p->status != PARSE_ERROR) return head;
+            p->status = PARSE_OK;
+            while (p->tok.type != TOK_NEWLINE && p->tok.type != TOK_EOF) advance(p);
+            skip_newlines(p);
+            continue;
+        }
+
+        skip_newlines(p);
+        if (*tail == NULL) {
+            *tail = n;
+        } else {
+            struct Node *seq = new_node(p, NODE_SEQ, (*tail)->src.text);
+            seq->pair.left = *tail;
+            seq->pair.right = n;
+            *tail = seq;
+            tail = &seq->pair.right;
+        }
+    }
+    return head;
+}
+
+static struct Node *parse_source(const char *src, struct Arena *arena, int recover,
+                                 int partial, int *status, int *errors, struct Redir *spliced) {
+    struct Parser p;
+    memset(&p, 0, sizeof(p));
+    lexer_init(&p.lx, src);
+    p.arena = arena;
+    p.status = PARSE_OK;
+    p.recover = recover;
+    p.partial = partial;
+    p.spliced = spliced;
+    p.last_end = src;
+    lexer_next(&p.lx, &p.tok);
+
+    struct Node *n = parse_list(&p, TOK_EOF);
+    if (p.status == PARSE_OK && p.tok.type != TOK_EOF) syntax_error(&p);
+    if (p.status == PARSE_OK) finish_heredocs(&p);
+
+    *status = p.status;
+    if (errors) *errors = p.errors;
+    return n;
+}
+
+// Parse a complete command line. Returns NULL for an empty line or on a
+// syntax error; *status tells the two apart.
+struct Node *parse_line(const char *src, struct Arena *arena, int *status) {
+    struct Node *n = parse_source(src, arena, 0, 0, status, NULL, NULL);
+    return *status == PARSE_OK ? n : NULL;
+}
+
+// Like parse_line(), for an alias spliced into a command whose
+// here-documents were already read: `redirs` (the original command's
+// redirections) supplies their bodies, which the spliced text lacks.
+struct Node *parse_spliced(const char *src, struct Arena *arena, int *status, struct Redir *redirs) {
+    struct Node *n = parse_source(src, arena, 0, 0, status, NULL, redirs);
+    return *status == PARSE_OK ? n : NULL;
+}
+
+// Like parse_line(), for input that arrives a line at a time: when src
+// ends inside a quote or after an operator, nothing is reported and the
+// status is PARSE_INCOMPLETE so the caller can append the next line.
+struct Node *parse_partial(const char *src, struct Arena *arena, int *status) {
+    struct Node *n = parse_source(src, arena, 0, 1, status, NULL, NULL);
+    return *status == PARSE_OK ? n : NULL;
+}
+
+// Parse a whole script. Commands with syntax errors are reported and
+// dropped; *errors counts them.
+struct Node *parse_script(const char *src, struct Arena *arena, int *errors) {
+    int status;
+    return parse_source(src, arena, 1, 0, &status, errors, NULL);
 }
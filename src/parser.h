@@ -1,9 +1,21 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+struct Arena;
+struct Node;
+struct Redir;
+
+enum {
+    PARSE_OK,
+    PARSE_ERROR,
+    PARSE_INCOMPLETE    // input ended inside a quote or after an operator
+};
+
 void shell_init_readline(void);
 char *shell_read_line(const char *prompt);
-char **shell_split_line(char *line);
-char **shell_expand_args(char **args);
+struct Node *parse_line(const char *src, struct Arena *arena, int *status);
+struct Node *parse_spliced(const char *src, struct Arena *arena, int *status, struct Redir *redirs);
+struct Node *parse_partial(const char *src, struct Arena *arena, int *status);
+struct Node *parse_script(const char *src, struct Arena *arena, int *errors);
 
 #endif
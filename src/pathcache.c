@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pathcache.h"
+#include "vars.h"
+
+// Command hash table, in the spirit of bash's `hash`.
+// The parent resolves a command name against $PATH once and remembers the
+// absolute path, so children can execve() directly instead of letting
+// execvp() probe every PATH directory. Misses are remembered too (path == NULL).
+
+#define PATHCACHE_BUCKETS 64
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+struct PathEntry {
+    char *name;
+    char *path;
+    int hits;
+    struct PathEntry *next;
+};
+
+static struct PathEntry *buckets[PATHCACHE_BUCKETS];
+
+static unsigned int hash_name(const char *s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h % PATHCACHE_BUCKETS;
+}
+
+static int is_executable(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walk path (a $PATH value; NULL for the default) the way execvp()
+// would, without the cache. Returns a malloc'd path or NULL.
+char *pathcache_search(const char *name, const char *path) {
+    if (!path) path = DEFAULT_PATH;
+
+    size_t name_len = strlen(name);
+    const char *p = path;
+    while (1) {
+        const char *end = strchr(p, ':');
+        size_t dir_len = end ? (size_t)(end - p) : strlen(p);
+
+        // An empty PATH component means the current directory
+        char *full = malloc(dir_len + name_len + 3);
+        if (dir_len == 0) {
+            sprintf(full, "./%s", name);
+        } else {
+            memcpy(full, p, dir_len);
+            full[dir_len] = '/';
+            memcpy(full + dir_len + 1, name, name_len + 1);
+        }
+
+        if (is_executable(full)) return full;
+        free(full);
+
+        if (!end) break;
+        p = end + 1;
+    }
+    return NULL;
+}
+
+static char *search_path(const char *name) {
+    return pathcache_search(name, var_get("PATH"));
+}
+
+static struct PathEntry *find_entry(const char *name) {
+    struct PathEntry *e = buckets[hash_name(name)];
+    while (e) {
+        if (strcmp(e->name, name) == 0) return e;
+        e = e->next;
+    }
+    return NULL;
+}
+
+static struct PathEntry *insert_entry(const char *name, char *path) {
+    unsigned int b = hash_name(name);
+    struct PathEntry *e = malloc(sizeof(struct PathEntry));
+    e->name = strdup(name);
+    e->path = path;
+    e->hits = 0;
+    e->next = buckets[b];
+    buckets[b] = e;
+    return e;
+}
+
+// Returns the absolute path to exec for `name`, or NULL if it is not on PATH.
+// Names containing a slash bypass the cache, as they do for execvp().
+const char *pathcache_lookup(const char *name) {
+    if (strchr(name, '/')) return name;
+
+    struct PathEntry *e = find_entry(name);
+    if (!e) e = insert_entry(name, search_path(name));
+    if (e->path) e->hits++;
+    return e->path;
+}
+
+// Look at the cache without resolving or counting a hit.
+const char *pathcache_peek(const char *name, int *found) {
+    struct PathEntry *e = find_entry(name);
+    *found = e != NULL;
+    return e ? e->path : NULL;
+}
+
+// Where `name` would be run from, for `type` and `command -v`: like
+// pathcache_lookup(), but nothing is remembered and no hit is counted.
+// Returns a malloc'd path or NULL.
+char *pathcache_resolve(const char *name) {
+    if (strchr(name, '/')) return strdup(name);
+
+    struct PathEntry *e = find_entry(name);
+    if (e) return e->path ? strdup(e->path) : NULL;
+    return search_path(name);
+}
+
+// Drop what is remembered for `name`, such as a location whose file has
+// since been removed.
+void pathcache_forget(const char *name) {
+    struct PathEntry **p = &buckets[hash_name(name)];
+    while (*p && strcmp((*p)->name, name) != 0) p = &(*p)->next;
+    if (!*p) return;
+    struct PathEntry *e = *p;
+    *p = e->next;
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+// Force a fresh resolution of `name` (used by `hash name`). Returns 0 if not found.
+int pathcache_add(const char *name) {
+    struct PathEntry *e = find_entry(name);
+    char *path = search_path(name);
+    if (e) {
+        free(e->path);
+        e->path = path;
+        e->hits = 0;
+    } else {
+        insert_entry(name, path);
+    }
+    return path != NULL;
+}
+
+// Call fn on every remembered location (not on remembered misses).
+void pathcache_foreach(void (*fn)(const char *name, const char *path, int hits, void *arg), void *arg) {
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        for (struct PathEntry *e = buckets[i]; e; e = e->next) {
+            if (e->path) fn(e->name, e->path, e->hits, arg);
+        }
+    }
+}
+
+// Remember `path` for `name` without searching $PATH (a restored snapshot).
+void pathcache_set(const char *name, const char *path, int hits) {
+    struct PathEntry *e = find_entry(name);
+    if (e) free(e->path);
+    else e = insert_entry(name, NULL);
+    e->path = strdup(path);
+    e->hits = hits;
+}
+
+void pathcache_clear(void) {
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        struct PathEntry *e = buckets[i];
+        while (e) {
+            struct PathEntry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+}
+
+void pathcache_print(void) {
+    int any = 0;
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        for (struct PathEntry *e = buckets[i]; e; e = e->next) {
+            if (!e->path) continue;
+            if (!any) printf("hits\tcommand\n");
+            printf("%4d\t%s\n", e->hits, e->path);
+            any = 1;
+        }
+    }
+    if (!any) printf("myshell: hash table empty\n");
+}
@@ -0,0 +1,15 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+const char *pathcache_lookup(const char *name);
+const char *pathcache_peek(const char *name, int *found);
+char *pathcache_resolve(const char *name);
+char *pathcache_search(const char *name, const char *path);
+void pathcache_forget(const char *name);
+int pathcache_add(const char *name);
+void pathcache_foreach(void (*fn)(const char *name, const char *path, int hits, void *arg), void *arg);
+void pathcache_set(const char *name, const char *path, int hits);
+void pathcache_clear(void);
+void pathcache_print(void);
+
+#endif
@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <pwd.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <readline/readline.h>
+#include "prompt.h"
+#include "eventloop.h"
+#include "executor.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "shell.h"
+#include "vars.h"
+
+// The prompt is rendered from a PS1-style template ($PS1, or the default
+// below). Cheap escapes are filled in while rendering. Slow ones (git
+// state) come from segment providers that run on a worker thread. Their
+// results are cached per directory, and the prompt is drawn at once with
+// whatever the cache holds (or a placeholder). When a provider finishes,
+// the worker wakes the event loop through an eventfd, and the prompt on
+// screen is redrawn with the new value.
+//
+// Escapes: \u \h \H \w \W \$ \n \e \a \t \d \s \v \\ \[ \] \NNN as in
+// bash, plus \j (job count), \? (last status), \D (duration of the last
+// command) and \g (git branch, with `*` when the work tree is dirty).
+
+#define DEFAULT_PS1 "\\[\\e[1;32m\\]myshell\\[\\e[0m\\]:\\[\\e[1;34m\\]\\w\\[\\e[0m\\]$ "
+#define PROMPT_MAX 2048
+#define PROMPT_CACHE_SIZE 32
+#define SEGMENT_MAX 128
+#define PROMPT_DEADLINE_MS 2000     // give up on a provider after this long
+#define PLACEHOLDER "\xe2\x80\xa6"  // "…" until the first result for a directory
+
+// A segment too slow to compute while the user waits. run() is called on
+// the worker thread and writes the segment's text into out.
+struct Provider {
+    char escape;
+    void (*run)(const char *cwd, char *out, size_t size);
+};
+
+static void git_segment(const char *cwd, char *out, size_t size);
+
+static const struct Provider providers[] = {
+    { 'g', git_segment },
+};
+#define NPROVIDERS (int)(sizeof(providers) / sizeof(providers[0]))
+
+struct CacheEntry {
+    char *cwd;
+    char value[NPROVIDERS][SEGMENT_MAX];
+    int valid[NPROVIDERS];
+    unsigned long used;             // for evicting the least recently used
+};
+
+static struct CacheEntry cache[PROMPT_CACHE_SIZE];
+static unsigned long cache_tick;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The worker's next job: providers to run and the directory to run them in
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static char *work_cwd;
+static unsigned work_mask;
+static char *work_path;             // the shell's $PATH then, to find git on
+
+// The worker's copy of work_path, for run_capture(). Only the worker uses it.
+static char *worker_path;
+
+static int wake_fd = -1;
+static char shown[PROMPT_MAX];      // the prompt readline is displaying
+static double last_duration = -1;
+
+// Cache slot for cwd, reusing the least recently used one. Called with
+// cache_lock held.
+static struct CacheEntry *cache_entry(const char *cwd, int create) {
+    struct CacheEntry *victim = &cache[0];
+    for (int i = 0; i < PROMPT_CACHE_SIZE; i++) {
+        if (cache[i].cwd && strcmp(cache[i].cwd, cwd) == 0) {
+            cache[i].used = ++cache_tick;
+            return &cache[i];
+        }
+        if (cache[i].used < victim->used) victim = &cache[i];
+    }
+    if (!create) return NULL;
+    free(victim->cwd);
+    memset(victim, 0, sizeof(*victim));
+    victim->cwd = strdup(cwd);
+    victim->used = ++cache_tick;
+    return victim;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&cache_lock);
+    while (1) {
+        while (!work_cwd) pthread_cond_wait(&work_cond, &cache_lock);
+        char *cwd = work_cwd;
+        unsigned mask = work_mask;
+        free(worker_path);
+        worker_path = work_path;
+        work_cwd = NULL;
+        work_path = NULL;
+        pthread_mutex_unlock(&cache_lock);
+
+        for (int i = 0; i < NPROVIDERS; i++) {
+            if (!(mask & (1u << i))) continue;
+            char value[SEGMENT_MAX];
+            value[0] = '\0';
+            providers[i].run(cwd, value, sizeof(value));
+
+            pthread_mutex_lock(&cache_lock);
+            struct CacheEntry *e = cache_entry(cwd, 1);
+            strcpy(e->value[i], value);
+            e->valid[i] = 1;
+            pthread_mutex_unlock(&cache_lock);
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) { /* a wakeup is already pending */ }
+        free(cwd);
+        pthread_mutex_lock(&cache_lock);
+    }
+    return NULL;
+}
+
+static void put(char *buf, size_t *len, const char *s) {
+    size_t n = strlen(s);
+    if (*len + n >= PROMPT_MAX) n = PROMPT_MAX - 1 - *len;
+    memcpy(buf + *len, s, n);
+    *len += n;
+    buf[*len] = '\0';
+}
+
+static void format_duration(char *out, size_t size) {
+    if (last_duration < 0) {
+        out[0] = '\0';
+    } else if (last_duration < 1) {
+        snprintf(out, size, "%dms", (int)(last_duration * 1000));
+    } else if (last_duration < 60) {
+        snprintf(out, size, "%.1fs", last_duration);
+    } else {
+        int s = (int)last_duration;
+        snprintf(out, size, "%dm%02ds", s / 60, s % 60);
+    }
+}
+
+// Expand the template. Async segments are read from the cache; *mask
+// collects the providers the template uses.
+static void render(char *buf, const char *cwd, unsigned *mask) {
+    const char *ps1 = var_get("PS1");
+    const char *home = var_get("HOME");
+    size_t len = 0;
+    char tmp[PROMPT_MAX];
+
+    if (!ps1) ps1 = DEFAULT_PS1;
+    buf[0] = '\0';
+    *mask = 0;
+    for (const char *p = ps1; *p && len < PROMPT_MAX - 1; p++) {
+        if (*p != '\\' || !p[1]) {
+            buf[len++] = *p;
+            buf[len] = '\0';
+            continue;
+        }
+        char c = *++p;
+        tmp[0] = '\0';
+        switch (c) {
+        case 'u': {
+            struct passwd *pw = getpwuid(getuid());
+            snprintf(tmp, sizeof(tmp), "%s", pw ? pw->pw_name : "?");
+            break;
+        }
+        case 'h':
+        case 'H':
+            gethostname(tmp, sizeof(tmp) - 1);
+            tmp[sizeof(tmp) - 1] = '\0';
+            if (c == 'h') tmp[strcspn(tmp, ".")] = '\0';
+            break;
+        case 'w': {
+            size_t hl = home ? strlen(home) : 0;
+            if (hl > 1 && strncmp(cwd, home, hl) == 0 && (cwd[hl] == '/' || cwd[hl] == '\0')) {
+                snprintf(tmp, sizeof(tmp), "~%s", cwd + hl);
+            } else {
+                snprintf(tmp, sizeof(tmp), "%s", cwd);
+            }
+            break;
+        }
+        case 'W': {
+            const char *slash = strrchr(cwd, '/');
+            snprintf(tmp, sizeof(tmp), "%s", slash && slash[1] ? slash + 1 : cwd);
+            break;
+        }
+        case '$': strcpy(tmp, geteuid() == 0 ? "#" : "$"); break;
+        case 'n': strcpy(tmp, "\n"); break;
+        case 'e': strcpy(tmp, "\033"); break;
+        case 'a': strcpy(tmp, "\a"); break;
+        case '\\': strcpy(tmp, "\\"); break;
+        case '[': tmp[0] = RL_PROMPT_START_IGNORE; tmp[1] = '\0'; break;
+        case ']': tmp[0] = RL_PROMPT_END_IGNORE; tmp[1] = '\0'; break;
+        case 's': strcpy(tmp, "myshell"); break;
+        case 'v': strcpy(tmp, MYSHELL_VERSION); break;
+        case 't':
+        case 'd': {
+            time_t now = time(NULL);
+            strftime(tmp, sizeof(tmp), c == 't' ? "%H:%M:%S" : "%a %b %d", localtime(&now));
+            break;
+        }
+        case 'j': {
+            int n = 0;
+            for (struct Job *j = first_job; j; j = j->next) n++;
+            snprintf(tmp, sizeof(tmp), "%d", n);
+            break;
+        }
+        case '?': snprintf(tmp, sizeof(tmp), "%d", last_command_status); break;
+        case 'D': format_duration(tmp, sizeof(tmp)); break;
+        default:
+            if (c >= '0' && c <= '7') {
+                int v = 0, n = 0;
+                while (n < 3 && *p >= '0' && *p <= '7') v = v * 8 + (*p++ - '0'), n++;
+                p--;
+                tmp[0] = (char)v;
+                tmp[1] = '\0';
+                break;
+            }
+            int found = 0;
+            for (int i = 0; i < NPROVIDERS; i++) {
+                if (providers[i].escape != c) continue;
+                struct CacheEntry *e = cache_entry(cwd, 0);
+                snprintf(tmp, sizeof(tmp), "%s", e && e->valid[i] ? e->value[i] : PLACEHOLDER);
+                *mask |= 1u << i;
+                found = 1;
+            }
+            if (!found) snprintf(tmp, sizeof(tmp), "\\%c", c);
+        }
+        put(buf, &len, tmp);
+    }
+}
+
+static void current_dir(char *cwd, size_t size) {
+    if (!getcwd(cwd, size)) snprintf(cwd, size, "?");
+}
+
+// Results came in: redraw the prompt if they changed it.
+static void on_results(int fd, void *data) {
+    uint64_t n;
+    char cwd[PATH_MAX], buf[PROMPT_MAX];
+    unsigned mask;
+    (void)data;
+
+    if (read(fd, &n, sizeof(n)) < 0) return;
+    current_dir(cwd, sizeof(cwd));
+    pthread_mutex_lock(&cache_lock);
+    render(buf, cwd, &mask);
+    pthread_mutex_unlock(&cache_lock);
+    if (strcmp(buf, shown) == 0) return;
+    // A command's continuation lines show $PS2, which has no segments
+    if (!rl_prompt || strcmp(rl_prompt, shown) != 0) return;
+
+    strcpy(shown, buf);
+    rl_clear_visible_line();
+    rl_set_prompt(shown);
+    rl_on_new_line();
+    rl_redisplay();
+}
+
+void prompt_init(void) {
+    pthread_t thread;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) return;
+
+    // The worker must not take signals meant for the shell
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    } else {
+        pthread_detach(thread);
+        event_watch(wake_fd, on_results, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void prompt_set_duration(double seconds) {
+    last_duration = seconds;
+}
+
+// Render the prompt for the next line and ask the worker to refresh the
+// slow segments for this directory.
+const char *prompt_build(void) {
+    char cwd[PATH_MAX];
+    unsigned mask;
+
+    current_dir(cwd, sizeof(cwd));
+    pthread_mutex_lock(&cache_lock);
+    render(shown, cwd, &mask);
+    if (mask && wake_fd >= 0) {
+        free(work_cwd);
+        free(work_path);
+        work_cwd = strdup(cwd);
+        work_mask = mask;
+        // The variables belong to the main thread, and environ is only
+        // what the shell started with: hand the worker the current PATH
+        const char *path = var_get("PATH");
+        work_path = path ? strdup(path) : NULL;
+        pthread_cond_signal(&work_cond);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return shown;
+}
+
+// Run a command with its output captured, killing it at the deadline.
+// Returns the number of bytes read, or -1 if it failed or timed out.
+static ssize_t run_capture(char *const argv[], char *out, size_t size) {
+    int pfd[2];
+    char *prog = pathcache_search(argv[0], worker_path);
+    if (!prog) return -1;
+    if (pipe2(pfd, O_CLOEXEC) < 0) {
+        free(prog);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pfd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_init(&attr);
+    // Its own process group, so Ctrl+C at the prompt leaves it alone
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, event_child_sigmask());
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, prog, &actions, &attr, argv, environ);
+    free(prog);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(pfd[1]);
+    if (err != 0) {
+        close(pfd[0]);
+        return -1;
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t len = 0;
+    int timed_out = 0;
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= PROMPT_DEADLINE_MS) {
+            timed_out = 1;
+            break;
+        }
+        struct pollfd p = { .fd = pfd[0], .events = POLLIN };
+        if (poll(&p, 1, PROMPT_DEADLINE_MS - elapsed) < 0 && errno != EINTR) break;
+        if (!p.revents) continue;
+        char discard[4096];
+        ssize_t r = len < size ? read(pfd[0], out + len, size - len) : read(pfd[0], discard, sizeof(discard));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if (len < size) len += r;
+    }
+    close(pfd[0]);
+    if (timed_out) kill(pid, SIGKILL);
+    // The shell's reaper may get to it first; either way it is gone
+    waitpid(pid, NULL, 0);
+    return timed_out ? -1 : (ssize_t)len;
+}
+
+// Branch from HEAD (short hash when detached), plus `*` if the work tree
+// has uncommitted changes. Empty outside a repository.
+static void git_segment(const char *cwd, char *out, size_t size) {
+    char dir[PATH_MAX], path[PATH_MAX + 16], head[256];
+    struct stat st;
+
+    // Find the .git of the enclosing repository
+    snprintf(dir, sizeof(dir), "%s", cwd);
+    while (1) {
+        snprintf(path, sizeof(path), "%s/.git", dir);
+        if (stat(path, &st) == 0) break;
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) return;
+        *slash = '\0';
+    }
+
+    // Worktrees and submodules have a .git file pointing at the real one
+    if (S_ISREG(st.st_mode)) {
+        FILE *f = fopen(path, "re");
+        if (!f) return;
+        char line[PATH_MAX];
+        int ok = fgets(line, sizeof(line), f) && strncmp(line, "gitdir: ", 8) == 0;
+        fclose(f);
+        if (!ok) return;
+        line[strcspn(line, "\n")] = '\0';
+        int n = line[8] == '/' ? snprintf(path, sizeof(path), "%s", line + 8)
+                               : snprintf(path, sizeof(path), "%s/%s", dir, line + 8);
+        if (n < 0 || (size_t)n >= sizeof(path) - sizeof("/HEAD")) return;
+    }
+
+    size_t plen = strlen(path);
+    snprintf(path + plen, sizeof(path) - plen, "/HEAD");
+    FILE *f = fopen(path, "re");
+    if (!f) return;
+    if (!fgets(head, sizeof(head), f)) head[0] = '\0';
+    fclose(f);
+    head[strcspn(head, "\n")] = '\0';
+    if (strncmp(head, "ref: refs/heads/", 16) == 0) {
+        // A branch name longer than the segment is cut short
+        size_t n = strnlen(head + 16, size - 1);
+        memcpy(out, head + 16, n);
+        out[n] = '\0';
+    } else {
+        snprintf(out, size, "%.7s", head);
+    }
+
+    char status[1];
+    char *argv[] = { "git", "--no-optional-locks", "-C", (char *)cwd, "status",
+                     "--porcelain", "--untracked-files=no", "--ignore-submodules", NULL };
+    if (run_capture(argv, status, sizeof(status)) > 0) {
+        size_t n = strlen(out);
+        if (n + 1 < size) strcpy(out + n, "*");
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+void prompt_init(void);
+const char *prompt_build(void);
+void prompt_set_duration(double seconds);
+
+#endif
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scriptcache.h"
+#include "ast.h"
+#include "parser.h"
+#include "executor.h"
+#include "options.h"
+#include "shell.h"
+
+// Compiled script cache.
+//
+// `script.sh` is compiled to `script.sh.mshc`: a header, the source path,
+// a copy of the source text, and the AST with every pointer stored as an
+// offset from the start of the file. Loading maps the file privately and
+// adds the mapping's base address to each pointer, which is one linear walk
+// over the nodes; nothing is lexed or parsed. The cache is only used if
+// the path, size, mtime and shell version all match, and only if it
+// belongs to us (or the script's owner) and nobody else can write to it.
+
+#define CACHE_SUFFIX ".mshc"
+#define CACHE_MAGIC "MYSHSC\0"
+#define CACHE_FORMAT 3
+
+// Below this size, open+mmap+relocate costs more than parsing the text.
+#define CACHE_MIN_SIZE 4096
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t node_size;     // sizeof(struct Node), catches ABI changes
+    char version[16];
+    uint64_t src_size;
+    int64_t src_mtime_sec;
+    int64_t src_mtime_nsec;
+    uint64_t parse_ns;      // what parsing cost when the cache was written
+    uint64_t path_off, path_len;
+    uint64_t text_off, text_len;
+    uint64_t root_off;      // 0 for an empty script
+    uint64_t total_size;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// A cache may only come from us or the script's owner, and nobody else
+// may be able to replace it: anyone who could would choose what the
+// script runs. The same goes for the directory a cache is written into.
+static int trusted(const struct stat *st, uid_t src_owner) {
+    return (st->st_uid == geteuid() || st->st_uid == src_owner) &&
+           !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static int trusted_dir(const char *path, uid_t src_owner) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash > path ? (size_t)(slash - path) : 1) : strdup(".");
+    struct stat st;
+    int ok = stat(dir, &st) == 0 && S_ISDIR(st.st_mode) && trusted(&st, src_owner);
+    free(dir);
+    return ok;
+}
+
+static char *cache_path_for(const char *path) {
+    char *p = malloc(strlen(path) + sizeof(CACHE_SUFFIX));
+    sprintf(p, "%s%s", path, CACHE_SUFFIX);
+    return p;
+}
+
+// ---- Writing ----
+
+uint64_t cache_emit(struct Writer *w, const void *data, size_t size) {
+    size_t off = (w->len + 7) & ~(size_t)7;
+    if (off + size > w->cap) {
+        while (off + size > w->cap) w->cap = w->cap ? w->cap * 2 : 4096;
+        w->buf = realloc(w->buf, w->cap);
+    }
+    memset(w->buf + w->len, 0, off - w->len);
+    if (data) memcpy(w->buf + off, data, size);
+    else memset(w->buf + off, 0, size);
+    w->len = off + size;
+    return off;
+}
+
+static void patch(struct Writer *w, uint64_t at, uint64_t off) {
+    void *p = (void *)(uintptr_t)off;
+    memcpy(w->buf + at, &p, sizeof(p));
+}
+
+#define AS_PTR(off) ((void *)(uintptr_t)(off))
+
+// Where the text at p (len bytes) is in the file: inside the source text
+// copy when it comes from there, otherwise a copy of its own.
+static const char *text_ref(struct Writer *w, const char *p, size_t len) {
+    if (!p) return NULL;
+    if (p >= w->text && p + len <= w->text + w->text_len) return AS_PTR(w->text_off + (p - w->text));
+    uint64_t off = cache_emit(w, NULL, len + 1);
+    memcpy(w->buf + off, p, len);
+    return AS_PTR(off);
+}
+
+static uint64_t put_node(struct Writer *w, struct Node *n);
+
+static uint64_t put_redirs(struct Writer *w, struct Redir *r) {
+    uint64_t head = 0, link = 0;
+    for (; r; r = r->next) {
+        struct Redir copy = *r;
+        copy.target.text = text_ref(w, r->target.text, r->target.len);
+        copy.next = NULL;
+        uint64_t off = cache_emit(w, &copy, sizeof(copy));
+        if (link) patch(w, link, off);
+        else head = off;
+        link = off + offsetof(struct Redir, next);
+    }
+    return head;
+}
+
+static uint64_t put_words(struct Writer *w, struct Word *words, int n) {
+    uint64_t off = cache_emit(w, NULL, (n + 1) * sizeof(struct Word));
+    for (int i = 0; i < n; i++) {
+        struct Word word = { text_ref(w, words[i].text, words[i].len), words[i].len };
+        memcpy(w->buf + off + i * sizeof(struct Word), &word, sizeof(word));
+    }
+    return off;
+}
+
+static uint64_t put_single(struct Writer *w, struct Node *n) {
+    struct Node copy = *n;
+    copy.src.text = text_ref(w, n->src.text, n->src.len);
+
+    switch (n->type) {
+    case NODE_COMMAND:
+        copy.cmd.argv = AS_PTR(put_words(w, n->cmd.argv, n->cmd.argc));
+        copy.cmd.redirs = AS_PTR(put_redirs(w, n->cmd.redirs));
+        break;
+    case NODE_PIPELINE: {
+        uint64_t stages = cache_emit(w, NULL, n->pipe.n * sizeof(struct Node *));
+        for (int i = 0; i < n->pipe.n; i++) {
+            patch(w, stages + i * sizeof(struct Node *), put_node(w, n->pipe.stages[i]));
+        }
+        copy.pipe.stages = AS_PTR(stages);
+        break;
+    }
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQ:
+        copy.pair.left = AS_PTR(put_node(w, n->pair.left));
+        copy.pair.right = AS_PTR(put_node(w, n->pair.right));
+        break;
+    case NODE_BACKGROUND:
+    case NODE_SUBSHELL:
+    case NODE_TIME:
+    case NODE_NOT:
+    case NODE_GROUP:
+        copy.sub.body = AS_PTR(put_node(w, n->sub.body));
+        copy.sub.redirs = AS_PTR(put_redirs(w, n->sub.redirs));
+        break;
+    case NODE_IF:
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        copy.ctl.cond = AS_PTR(put_node(w, n->ctl.cond));
+        copy.ctl.body = AS_PTR(put_node(w, n->ctl.body));
+        copy.ctl.orelse = AS_PTR(put_node(w, n->ctl.orelse));
+        copy.ctl.redirs = AS_PTR(put_redirs(w, n->ctl.redirs));
+        break;
+    case NODE_FOR:
+        copy.loop.name.text = text_ref(w, n->loop.name.text, n->loop.name.len);
+        if (n->loop.nwords >= 0) copy.loop.words = AS_PTR(put_words(w, n->loop.words, n->loop.nwords));
+        copy.loop.body = AS_PTR(put_node(w, n->loop.body));
+        copy.loop.redirs = AS_PTR(put_redirs(w, n->loop.redirs));
+        break;
+    case NODE_CASE: {
+        copy.match.word.text = text_ref(w, n->match.word.text, n->match.word.len);
+        uint64_t items = cache_emit(w, NULL, n->match.n * sizeof(struct CaseItem));
+        for (int i = 0; i < n->match.n; i++) {
+            struct CaseItem item = n->match.items[i];
+            item.patterns = AS_PTR(put_words(w, item.patterns, item.npatterns));
+            item.body = AS_PTR(put_node(w, item.body));
+            memcpy(w->buf + items + i * sizeof(item), &item, sizeof(item));
+        }
+        copy.match.items = AS_PTR(items);
+        copy.match.redirs = AS_PTR(put_redirs(w, n->match.redirs));
+        break;
+    }
+    case NODE_FUNCTION:
+        copy.func.name.text = text_ref(w, n->func.name.text, n->func.name.len);
+        copy.func.body = AS_PTR(put_node(w, n->func.body));
+        break;
+    }
+    return cache_emit(w, &copy, sizeof(copy));
+}
+
+// Sequences are walked along their right spine so long scripts do not
+// recurse once per line.
+static uint64_t put_node(struct Writer *w, struct Node *n) {
+    uint64_t head = 0, link = 0;
+    if (!n) return 0;
+
+    while (n->type == NODE_SEQ) {
+        struct Node copy = *n;
+        copy.src.text = text_ref(w, n->src.text, n->src.len);
+        copy.pair.left = AS_PTR(put_node(w, n->pair.left));
+        copy.pair.right = NULL;
+        uint64_t off = cache_emit(w, &copy, sizeof(copy));
+        if (link) patch(w, link, off);
+        else head = off;
+        link = off + offsetof(struct Node, pair.right);
+        n = n->pair.right;
+    }
+
+    uint64_t off = put_single(w, n);
+    if (link) patch(w, link, off);
+    else head = off;
+    return head;
+}
+
+// Append the tree n, whose words point into text (len bytes), with a copy
+// of that text. Returns the offset of the root, 0 for an empty tree.
+uint64_t cache_put_tree(struct Writer *w, struct Node *n, const char *text, size_t len) {
+    w->text_off = cache_emit(w, text, len + 1);
+    w->text = text;
+    w->text_len = len;
+    uint64_t root = put_node(w, n);
+    w->text = NULL;
+    w->text_len = 0;
+    return root;
+}
+
+// Write buf to a private temp file and rename it over path, so a
+// concurrently starting shell never maps a half-written file. Returns 0
+// on failure.
+int cache_write_file(const char *path, const void *buf, size_t len) {
+    char *tmp = malloc(strlen(path) + 32);
+    sprintf(tmp, "%s.%d", path, (int)getpid());
+    // A leftover from an earlier shell with our pid; never follow a link
+    unlink(tmp);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    int ok = fd >= 0;
+    if (ok) {
+        ok = write(fd, buf, len) == (ssize_t)len;
+        close(fd);
+        if (!ok || rename(tmp, path) != 0) {
+            ok = 0;
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    return ok;
+}
+
+static void write_cache(const char *path, const struct stat *st, const char *text,
+                        size_t text_len, struct Node *root, uint64_t parse_ns) {
+    struct Writer w = {0};
+    struct CacheHeader h;
+
+    memset(&h, 0, sizeof(h));
+    cache_emit(&w, &h, sizeof(h));
+    h.path_len = strlen(path);
+    h.path_off = cache_emit(&w, path, h.path_len + 1);
+    h.text_len = text_len;
+    h.root_off = cache_put_tree(&w, root, text, text_len);
+    h.text_off = w.text_off;
+
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.format = CACHE_FORMAT;
+    h.node_size = sizeof(struct Node);
+    snprintf(h.version, sizeof(h.version), "%s", MYSHELL_VERSION);
+    h.src_size = st->st_size;
+    h.src_mtime_sec = st->st_mtim.tv_sec;
+    h.src_mtime_nsec = st->st_mtim.tv_nsec;
+    h.parse_ns = parse_ns;
+    h.total_size = w.len;
+    memcpy(w.buf, &h, sizeof(h));
+
+    char *cache = cache_path_for(path);
+    cache_write_file(cache, w.buf, w.len);
+    free(cache);
+    free(w.buf);
+}
+
+// ---- Loading ----
+
+// Turn a stored offset back into a pointer, refusing anything outside the map.
+void *cache_reloc(struct Loader *l, const void *p, size_t size) {
+    uintptr_t off = (uintptr_t)p;
+    if (off == 0) return NULL;
+    if (off >= l->len || size > l->len - off) {
+        l->bad = 1;
+        return NULL;
+    }
+    return l->base + off;
+}
+
+static void fix_node(struct Loader *l, struct Node *n);
+
+static struct Redir *fix_redirs(struct Loader *l, struct Redir *r) {
+    struct Redir *head = cache_reloc(l, r, sizeof(struct Redir));
+    for (r = head; r && !l->bad; r = r->next) {
+        r->target.text = cache_reloc(l, r->target.text, r->target.len);
+        r->next = cache_reloc(l, r->next, sizeof(struct Redir));
+    }
+    return head;
+}
+
+static struct Word *fix_words(struct Loader *l, struct Word *words, int n) {
+    words = cache_reloc(l, words, (n + 1) * sizeof(struct Word));
+    for (int i = 0; words && i < n; i++) {
+        words[i].text = cache_reloc(l, words[i].text, words[i].len);
+    }
+    return words;
+}
+
+// A child node: relocate the pointer, then the node it points to.
+static struct Node *fix_child(struct Loader *l, struct Node *n) {
+    n = cache_reloc(l, n, sizeof(struct Node));
+    fix_node(l, n);
+    return n;
+}
+
+static void fix_single(struct Loader *l, struct Node *n) {
+    n->src.text = cache_reloc(l, n->src.text, n->src.len);
+    switch (n->type) {
+    case NODE_COMMAND:
+        n->cmd.argv = fix_words(l, n->cmd.argv, n->cmd.argc);
+        n->cmd.redirs = fix_redirs(l, n->cmd.redirs);
+        break;
+    case NODE_PIPELINE:
+        n->pipe.stages = cache_reloc(l, n->pipe.stages, n->pipe.n * sizeof(struct Node *));
+        for (int i = 0; n->pipe.stages && i < n->pipe.n; i++) {
+            n->pipe.stages[i] = cache_reloc(l, n->pipe.stages[i], sizeof(struct Node));
+            fix_node(l, n->pipe.stages[i]);
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQ:
+        n->pair.left = cache_reloc(l, n->pair.left, sizeof(struct Node));
+        n->pair.right = cache_reloc(l, n->pair.right, sizeof(struct Node));
+        fix_node(l, n->pair.left);
+        fix_node(l, n->pair.right);
+        break;
+    case NODE_BACKGROUND:
+    case NODE_SUBSHELL:
+    case NODE_TIME:
+    case NODE_NOT:
+    case NODE_GROUP:
+        n->sub.body = cache_reloc(l, n->sub.body, sizeof(struct Node));
+        n->sub.redirs = fix_redirs(l, n->sub.redirs);
+        fix_node(l, n->sub.body);
+        break;
+    case NODE_IF:
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        n->ctl.cond = fix_child(l, n->ctl.cond);
+        n->ctl.body = fix_child(l, n->ctl.body);
+        n->ctl.orelse = fix_child(l, n->ctl.orelse);
+        n->ctl.redirs = fix_redirs(l, n->ctl.redirs);
+        break;
+    case NODE_FOR:
+        n->loop.name.text = cache_reloc(l, n->loop.name.text, n->loop.name.len);
+        if (n->loop.nwords >= 0) n->loop.words = fix_words(l, n->loop.words, n->loop.nwords);
+        n->loop.body = fix_child(l, n->loop.body);
+        n->loop.redirs = fix_redirs(l, n->loop.redirs);
+        break;
+    case NODE_CASE:
+        n->match.word.text = cache_reloc(l, n->match.word.text, n->match.word.len);
+        n->match.items = cache_reloc(l, n->match.items, n->match.n * sizeof(struct CaseItem));
+        for (int i = 0; n->match.items && i < n->match.n && !l->bad; i++) {
+            struct CaseItem *item = &n->match.items[i];
+            item->patterns = fix_words(l, item->patterns, item->npatterns);
+            item->body = fix_child(l, item->body);
+        }
+        n->match.redirs = fix_redirs(l, n->match.redirs);
+        break;
+    case NODE_FUNCTION:
+        n->func.name.text = cache_reloc(l, n->func.name.text, n->func.name.len);
+        n->func.body = fix_child(l, n->func.body);
+        break;
+    }
+}
+
+static void fix_node(struct Loader *l, struct Node *n) {
+    while (n && !l->bad && n->type == NODE_SEQ) {
+        n->src.text = cache_reloc(l, n->src.text, n->src.len);
+        n->pair.left = cache_reloc(l, n->pair.left, sizeof(struct Node));
+        n->pair.right = cache_reloc(l, n->pair.right, sizeof(struct Node));
+        fix_node(l, n->pair.left);
+        n = n->pair.right;
+    }
+    if (n && !l->bad) fix_single(l, n);
+}
+
+// Relocate the tree whose root is at offset off. NULL (with l->bad set if
+// anything pointed outside the file) when there is none.
+struct Node *cache_fix_tree(struct Loader *l, uint64_t off) {
+    struct Node *root = cache_reloc(l, AS_PTR(off), sizeof(struct Node));
+    fix_node(l, root);
+    return root;
+}
+
+static int load_cache(const char *path, const struct stat *st, struct CompiledScript *cs,
+                      uint64_t *parse_ns) {
+    char *cache = cache_path_for(path);
+    int fd = open(cache, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    free(cache);
+    if (fd < 0) return 0;
+
+    struct stat cst;
+    if (fstat(fd, &cst) != 0 || !S_ISREG(cst.st_mode) || !trusted(&cst, st->st_uid) ||
+        (size_t)cst.st_size < sizeof(struct CacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    // Private writable mapping: relocation patches pages copy-on-write,
+    // the file on disk is never touched.
+    void *map = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    struct CacheHeader *h = map;
+    int valid = memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+                h->format == CACHE_FORMAT &&
+                h->node_size == sizeof(struct Node) &&
+                strncmp(h->version, MYSHELL_VERSION, sizeof(h->version)) == 0 &&
+                h->total_size == (uint64_t)cst.st_size &&
+                h->src_size == (uint64_t)st->st_size &&
+                h->src_mtime_sec == st->st_mtim.tv_sec &&
+                h->src_mtime_nsec == st->st_mtim.tv_nsec &&
+                h->path_off + h->path_len < h->total_size &&
+                h->path_len == strlen(path) &&
+                memcmp((char *)map + h->path_off, path, h->path_len) == 0;
+
+    if (valid) {
+        struct Loader l = { map, cst.st_size, 0 };
+        cs->root = cache_fix_tree(&l, h->root_off);
+        valid = !l.bad;
+    }
+    if (!valid) {
+        munmap(map, cst.st_size);
+        return 0;
+    }
+
+    cs->map = map;
+    cs->map_len = cst.st_size;
+    *parse_ns = h->parse_ns;
+    return 1;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    size_t cap = 4096, n = 0;
+    char *buf = malloc(cap);
+    ssize_t r;
+    while ((r = read(fd, buf + n, cap - n - 1)) > 0) {
+        n += r;
+        if (n + 1 == cap) buf = realloc(buf, cap *= 2);
+    }
+    close(fd);
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+// Get the AST for the script at `path`, from its cache when possible.
+// Returns 0 if the script can't be read.
+int script_load(const char *path, struct CompiledScript *cs) {
+    struct stat st;
+    uint64_t t0 = now_ns(), parse_ns;
+
+    memset(cs, 0, sizeof(*cs));
+    cs->mark = arena_mark(&cmd_arena);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+
+    int use_cache = shell_options[OPT_SCRIPTCACHE] && st.st_size >= CACHE_MIN_SIZE;
+    if (use_cache && load_cache(path, &st, cs, &parse_ns)) {
+        if (shell_options[OPT_CACHESTATS]) {
+            double load = (now_ns() - t0) / 1e6, parse = parse_ns / 1e6;
+            fprintf(stderr, "myshell: %s: script cache hit, loaded in %.3f ms "
+                    "(parsing took %.3f ms, saved %.3f ms)\n", path, load, parse, parse - load);
+        }
+        return 1;
+    }
+
+    size_t len;
+    cs->text = read_file(path, &len);
+    if (!cs->text) return 0;
+
+    int errors;
+    uint64_t p0 = now_ns();
+    cs->root = parse_script(cs->text, &cmd_arena, &errors);
+    parse_ns = now_ns() - p0;
+
+    // Scripts with syntax errors are not cached, so the errors show up every time
+    if (use_cache && errors == 0 && trusted_dir(path, st.st_uid)) {
+        write_cache(path, &st, cs->text, len, cs->root, parse_ns);
+    }
+    if (shell_options[OPT_CACHESTATS]) {
+        fprintf(stderr, "myshell: %s: %s, parsed in %.3f ms\n", path,
+                use_cache ? "script cache miss" : "not cached", parse_ns / 1e6);
+    }
+    return 1;
+}
+
+void script_release(struct CompiledScript *cs) {
+    if (cs->map) munmap(cs->map, cs->map_len);
+    free(cs->text);
+    arena_release(&cmd_arena, cs->mark);
+    memset(cs, 0, sizeof(*cs));
+}
@@ -0,0 +1,48 @@
+#ifndef SCRIPTCACHE_H
+#define SCRIPTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+struct Node;
+
+// A parsed script, either freshly parsed into the command arena or mapped
+// from its compiled cache file.
+struct CompiledScript {
+    struct Node *root;
+    char *text;             // source text when parsed from scratch
+    void *map;              // cache mapping when loaded from disk
+    size_t map_len;
+    struct ArenaMark mark;
+};
+
+int script_load(const char *path, struct CompiledScript *cs);
+void script_release(struct CompiledScript *cs);
+
+// A relocatable file image being built: data is appended 8-byte aligned,
+// and pointers inside it are stored as offsets from its start. Also used
+// for shell snapshots (see snapshot.c).
+struct Writer {
+    char *buf;
+    size_t len;
+    size_t cap;
+    const char *text;       // source text the tree being written points into
+    size_t text_len;
+    uint64_t text_off;
+};
+
+// A mapped image whose offsets are being turned back into pointers.
+struct Loader {
+    char *base;
+    size_t len;
+    int bad;                // an offset pointed outside the image
+};
+
+uint64_t cache_emit(struct Writer *w, const void *data, size_t size);
+uint64_t cache_put_tree(struct Writer *w, struct Node *n, const char *text, size_t len);
+int cache_write_file(const char *path, const void *buf, size_t len);
+void *cache_reloc(struct Loader *l, const void *p, size_t size);
+struct Node *cache_fix_tree(struct Loader *l, uint64_t off);
+
+#endif
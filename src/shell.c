@@ -1,63 +1,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include "shell.h"
 #include "parser.h"
 #include "executor.h"
 #include "builtins.h"
+#include "arena.h"
+#include "scriptcache.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "eventloop.h"
+#include "histstore.h"
+#include "vars.h"
 
+// An odd number of backslashes at the end continues the line.
+static int ends_in_backslash(const char *line, size_t len) {
+    size_t n = 0;
+    while (n < len && line[len - 1 - n] == '\\') n++;
+    return n % 2;
+}
+
+// Parse a command typed at the prompt into an AST in the command arena and
+// run it. While the command is unfinished (an open quote, a trailing
+// operator or backslash, a here-document still waiting for its delimiter),
+// more lines are read with $PS2 and appended. The whole command goes into
+// the history as one entry. Everything allocated for it is released in one
+// step afterwards.
 void shell_process_line(char *line, int *status_out) {
-    char **args = shell_split_line(line);
-    
-    if (args && args[0]) {
-        char *alias_val = resolve_alias(args[0]);
-        char **alias_args = NULL;
-        char *val_copy = NULL;
-        char **base_args = args;
-        
-        if (alias_val) {
-            val_copy = strdup(alias_val);
-            alias_args = shell_split_line(val_copy);
-            
-            int c_alias = 0, c_args = 0;
-            while(alias_args[c_alias]) c_alias++;
-            while(args[c_args]) c_args++;
-            
-            char **merged = malloc((c_alias + c_args) * sizeof(char*));
-            int p = 0;
-            for(int i=0; i<c_alias; i++) merged[p++] = alias_args[i];
-            for(int i=1; i<c_args; i++) merged[p++] = args[i];
-            merged[p] = NULL;
-            base_args = merged;
-        }
+    struct ArenaMark mark = arena_mark(&cmd_arena);
+    size_t len = strlen(line);
+    int parse_status;
+    struct Node *tree;
 
-        char **expanded_args = shell_expand_args(base_args);
-        
-        if (alias_val) {
-            free(base_args);
-            free(alias_args);
-            free(val_copy);
+    *status_out = 1;
+    while (1) {
+        tree = parse_partial(line, &cmd_arena, &parse_status);
+        if (parse_status != PARSE_INCOMPLETE && !ends_in_backslash(line, len)) break;
+        arena_release(&cmd_arena, mark);
+
+        const char *ps2 = var_get("PS2");
+        char *more = event_readline(ps2 ? ps2 : "> ");
+        if (!more) {
+            // Input ended in the middle of the command: report it, or run
+            // it if only a here-document's delimiter was missing
+            tree = parse_line(line, &cmd_arena, &parse_status);
+            break;
         }
-        
-        // Backup pointers to free properly
-        int count = 0;
-        while(expanded_args[count]) count++;
-        char **to_free = malloc((count + 1) * sizeof(char*));
-        for (int i = 0; i < count; i++) to_free[i] = expanded_args[i];
-        
-        *status_out = shell_execute_line(expanded_args);
-        
-        for (int i = 0; i < count; i++) free(to_free[i]);
-        free(to_free);
-        free(expanded_args);
-    } else {
-        *status_out = 1; // Empty line
+        size_t n = strlen(more);
+        char *joined = realloc(line, len + n + 2);
+        if (!joined) break;
+        line = joined;
+        line[len++] = '\n';
+        memcpy(line + len, more, n + 1);
+        len += n;
+        free(more);
+    }
+    if (line[0] != '\0') histstore_add(line);
+
+    if (tree && parse_status == PARSE_OK) {
+        *status_out = shell_execute_node(tree);
+    } else if (parse_status != PARSE_OK) {
+        set_simple_status(2); // Syntax error; an empty line changes nothing
     }
 
-    free(args);
+    arena_release(&cmd_arena, mark);
+    free(line);
 }
 
 void shell_loop(void)
@@ -66,6 +77,8 @@ void shell_loop(void)
   int status = 1;
 
   shell_init_readline();
+  prompt_init();
+  jobs_interactive = 1;
 
   shell_terminal = STDIN_FILENO;
   shell_pgid = getpid();
@@ -85,59 +98,155 @@ void shell_loop(void)
   }
 
   do {
-    // Reap zombies before prompting
-    int wstat;
-    pid_t wpid;
-    while ((wpid = waitpid(-1, &wstat, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        struct Job *j = find_job_by_pid(wpid);
-        if (j) {
-            if (WIFEXITED(wstat) || WIFSIGNALED(wstat)) {
-                if (j->state == JOB_RUNNING) {
-                    printf("\n[%d]+  Done                    %s\n", j->id, j->cmd);
-                }
-                remove_job(wpid);
-            } else if (WIFSTOPPED(wstat)) {
-                j->state = JOB_STOPPED;
-                printf("\n[%d]+  Stopped                 %s\n", j->id, j->cmd);
-            } else if (WIFCONTINUED(wstat)) {
-                j->state = JOB_RUNNING;
-                printf("\n[%d]+  Continued               %s\n", j->id, j->cmd);
-            }
-        }
-    }
+    // Report background jobs that changed state while the last command ran
+    jobs_reap();
+    jobs_notify(1);
 
-    char prompt[1024];
-    char cwd[512];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        snprintf(prompt, sizeof(prompt), "\033[1;32mmyshell\033[0m:\033[1;34m%s\033[0m$ ", cwd);
-    } else {
-        snprintf(prompt, sizeof(prompt), "myshell> ");
-    }
-
-    line = shell_read_line(prompt);
+    line = shell_read_line(prompt_build());
     if (!line) {
         // EOF or error
         break;
     }
-    
-    shell_process_line(line, &status);
 
-    free(line);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    shell_process_line(line, &status);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    prompt_set_duration((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
   } while (status);
 }
 
-void shell_run_file(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) return;
-
-    char *line = NULL;
-    size_t len = 0;
-    int status = 1;
-    
-    while (getline(&line, &len, fp) != -1 && status) {
-        line[strcspn(line, "\r\n")] = 0;
-        shell_process_line(line, &status);
+// Run a script (e.g. ~/.myshellrc). The whole file is parsed once, or
+// mapped from its compiled cache, and then executed top to bottom.
+// Returns 0 if the script ran `exit`.
+int shell_run_file(const char *filename) {
+    struct CompiledScript script;
+    if (!script_load(filename, &script)) return 1;
+    int res = shell_execute_node(script.root);
+    script_release(&script);
+    return res;
+}
+
+// Run a command string (`myshell -c '...'`). Returns 0 if it ran `exit`.
+int shell_run_string(const char *src) {
+    struct ArenaMark mark = arena_mark(&cmd_arena);
+    int errors;
+    struct Node *tree = parse_script(src, &cmd_arena, &errors);
+    int res = shell_execute_node(tree);
+    if (errors && res) set_simple_status(2);
+    arena_release(&cmd_arena, mark);
+    return res;
+}
+
+// Commands from a pipe or file on stdin, with no prompt, history or
+// terminal setup. A file is read in large blocks instead of a byte at a
+// time through readline. A pipe is read a byte at a time, as in sh: what
+// we took from it could not be given back to the commands that read it.
+// A command can span lines (open quotes, trailing operators,
+// backslash-newline); lines are added until it parses.
+#define STREAM_BUF_SIZE 65536
+
+struct Stream {
+    int fd;
+    char *buf;
+    size_t pos;             // start of the unread input in buf
+    size_t len;
+    int eof;
+    int seekable;
+};
+
+// Append the next line (including its newline) to *cmd. Returns 0 at EOF.
+static int stream_getline(struct Stream *s, char **cmd, size_t *cmd_len, size_t *cmd_cap) {
+    int got = 0;
+    while (1) {
+        char *start = s->buf + s->pos;
+        char *nl = memchr(start, '\n', s->len - s->pos);
+        size_t n = nl ? (size_t)(nl - start) + 1 : s->len - s->pos;
+        if (n) {
+            if (*cmd_len + n + 1 > *cmd_cap) {
+                while (*cmd_len + n + 1 > *cmd_cap) *cmd_cap *= 2;
+                *cmd = realloc(*cmd, *cmd_cap);
+            }
+            memcpy(*cmd + *cmd_len, start, n);
+            *cmd_len += n;
+            (*cmd)[*cmd_len] = '\0';
+            s->pos += n;
+            got = 1;
+        }
+        if (nl) return 1;
+        if (s->eof) return got;
+
+        ssize_t r = read(s->fd, s->buf, s->seekable ? STREAM_BUF_SIZE : 1);
+        if (r < 0 && errno == EINTR) continue;
+        s->pos = 0;
+        s->len = r > 0 ? r : 0;
+        if (r <= 0) s->eof = 1;
     }
-    free(line);
-    fclose(fp);
+}
+
+// Children share stdin with us. For a seekable stdin (`myshell < file`),
+// give back what we read ahead before the first child of a command starts
+// (or `read` runs), so that a command reading stdin gets the lines after
+// it, as in sh.
+static struct Stream *launch_stream;
+
+static void stream_sync(void) {
+    struct Stream *s = launch_stream;
+    launch_hook = NULL;
+    if (s->len > s->pos) lseek(s->fd, -(off_t)(s->len - s->pos), SEEK_CUR);
+    s->pos = s->len = 0;
+}
+
+// A backslash-newline at the very end means the command continues.
+static int ends_in_continuation(const char *cmd, size_t len) {
+    size_t n = 0;
+    if (len < 2 || cmd[len - 1] != '\n') return 0;
+    while (n + 1 < len && cmd[len - 2 - n] == '\\') n++;
+    return n % 2;
+}
+
+// Returns 0 if a command ran `exit`.
+int shell_run_stream(int fd) {
+    struct Stream s = { .fd = fd, .buf = malloc(STREAM_BUF_SIZE) };
+    size_t cap = 4096, len = 0;
+    char *cmd = malloc(cap);
+    int res = 1;
+
+    s.seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+    while (res) {
+        int more = stream_getline(&s, &cmd, &len, &cap);
+        if (!more && len == 0) break;
+
+        struct ArenaMark mark = arena_mark(&cmd_arena);
+        int status;
+        struct Node *tree;
+        if (more) {
+            tree = parse_partial(cmd, &cmd_arena, &status);
+            if (status == PARSE_INCOMPLETE || (status == PARSE_OK && ends_in_continuation(cmd, len))) {
+                arena_release(&cmd_arena, mark);
+                continue;
+            }
+        } else {
+            // Input ended in the middle of a command: report it
+            tree = parse_line(cmd, &cmd_arena, &status);
+        }
+
+        if (tree) {
+            if (s.seekable) {
+                launch_stream = &s;
+                launch_hook = stream_sync;
+            }
+            res = shell_execute_node(tree);
+            launch_hook = NULL;
+        } else if (status != PARSE_OK) {
+            set_simple_status(2);
+        }
+        arena_release(&cmd_arena, mark);
+        len = 0;
+        cmd[0] = '\0';
+    }
+
+    free(cmd);
+    free(s.buf);
+    return res;
 }
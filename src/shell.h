@@ -1,8 +1,12 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#define MYSHELL_VERSION "1.1"
+
 void shell_loop(void);
-void shell_run_file(const char *filename);
+int shell_run_file(const char *filename);
+int shell_run_string(const char *src);
+int shell_run_stream(int fd);
 
 #endif
 
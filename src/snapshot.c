@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "scriptcache.h"
+#include "ast.h"
+#include "builtins.h"
+#include "executor.h"
+#include "options.h"
+#include "pathcache.h"
+#include "shell.h"
+#include "symtab.h"
+#include "vars.h"
+
+// Shell state snapshots.
+//
+// `snapshot save FILE` writes down what an rc file builds up: aliases, the
+// variables the shell set itself (not the ones still as the environment
+// gave them), functions, options, remembered command locations and the
+// directory stack. `myshell --restore FILE` maps the file and installs all
+// of it instead of running .myshellrc; command locations only if $PATH is
+// still what it was when they were saved. The layout is the script cache's: a
+// header and arrays of fixed-size entries, with every string and function
+// body stored as an offset from the start of the file. Function bodies are
+// relocated in place and run straight from the mapping, which is never
+// unmapped; names and values are copied into the symbol table, which owns
+// its strings. A snapshot is only read by the shell version that wrote it.
+
+#define SNAP_MAGIC "MYSHSNP"
+#define SNAP_FORMAT 2
+
+enum { SECT_VARS, SECT_ALIASES, SECT_FUNCS, SECT_PATHS, SECT_DIRS, SECT_COUNT };
+
+struct SnapHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t node_size;     // sizeof(struct Node), catches ABI changes
+    char version[16];
+    uint64_t total_size;
+    uint32_t noptions;
+    uint32_t count[SECT_COUNT];
+    uint64_t options_off;   // noptions int32_t values
+    uint64_t path_off;      // $PATH the command locations were found on, 0 if unset
+    uint64_t off[SECT_COUNT];
+};
+
+// One variable, alias, function, command location or directory.
+struct SnapEntry {
+    uint64_t name;
+    uint64_t value;         // string, or the root of a function body; 0 if none
+    int64_t n;              // variable flags, command hits
+};
+
+static uint64_t put_str(struct Writer *w, const char *s) {
+    return s ? cache_emit(w, s, strlen(s) + 1) : 0;
+}
+
+static int saved_var(const struct Symbol *sym) {
+    return sym->var && !(sym->var->flags & VAR_ENV);
+}
+
+static int saved_alias(const struct Symbol *sym) {
+    return sym->alias != NULL;
+}
+
+static int saved_func(const struct Symbol *sym) {
+    return sym->func != NULL;
+}
+
+struct PathList {
+    struct SnapEntry *entries;
+    int n;
+    int cap;
+    struct Writer *w;
+};
+
+static void put_path(const char *name, const char *path, int hits, void *arg) {
+    struct PathList *pl = arg;
+    if (pl->n == pl->cap) {
+        pl->cap = pl->cap ? pl->cap * 2 : 32;
+        pl->entries = realloc(pl->entries, pl->cap * sizeof(struct SnapEntry));
+    }
+    struct SnapEntry *e = &pl->entries[pl->n++];
+    e->name = put_str(pl->w, name);
+    e->value = put_str(pl->w, path);
+    e->n = hits;
+}
+
+// Append the entries for the symbols matching pred as one section.
+static void put_symbols(struct Writer *w, struct SnapHeader *h, int sect,
+                        int (*pred)(const struct Symbol *)) {
+    struct Symbol **list;
+    int n = sym_collect(pred, &list);
+    struct SnapEntry *entries = calloc(n ? n : 1, sizeof(struct SnapEntry));
+    for (int i = 0; i < n; i++) {
+        struct Symbol *sym = list[i];
+        entries[i].name = put_str(w, sym->name);
+        if (sect == SECT_VARS) {
+            entries[i].value = put_str(w, sym->var->str ? sym->var->value : NULL);
+            entries[i].n = sym->var->flags;
+        } else if (sect == SECT_ALIASES) {
+            entries[i].value = put_str(w, sym->alias);
+        } else {
+            struct Node *body = sym->func->body;
+            entries[i].value = cache_put_tree(w, body, body->src.text, body->src.len);
+        }
+    }
+    h->count[sect] = n;
+    h->off[sect] = cache_emit(w, entries, n * sizeof(struct SnapEntry));
+    free(entries);
+    free(list);
+}
+
+// `snapshot save FILE`. Returns 0 (with a message) on failure.
+int snapshot_save(const char *path) {
+    struct Writer w = {0};
+    struct SnapHeader h;
+
+    memset(&h, 0, sizeof(h));
+    cache_emit(&w, &h, sizeof(h));
+
+    int32_t options[OPT_COUNT];
+    for (int i = 0; i < OPT_COUNT; i++) options[i] = shell_options[i];
+    h.noptions = OPT_COUNT;
+    h.options_off = cache_emit(&w, options, sizeof(options));
+
+    put_symbols(&w, &h, SECT_VARS, saved_var);
+    put_symbols(&w, &h, SECT_ALIASES, saved_alias);
+    put_symbols(&w, &h, SECT_FUNCS, saved_func);
+
+    h.path_off = put_str(&w, var_get("PATH"));
+    struct PathList pl = { .w = &w };
+    pathcache_foreach(put_path, &pl);
+    h.count[SECT_PATHS] = pl.n;
+    h.off[SECT_PATHS] = cache_emit(&w, pl.entries, pl.n * sizeof(struct SnapEntry));
+    free(pl.entries);
+
+    struct SnapEntry *dirs = calloc(dir_stack_top ? dir_stack_top : 1, sizeof(struct SnapEntry));
+    for (int i = 0; i < dir_stack_top; i++) dirs[i].name = put_str(&w, dir_stack[i]);
+    h.count[SECT_DIRS] = dir_stack_top;
+    h.off[SECT_DIRS] = cache_emit(&w, dirs, dir_stack_top * sizeof(struct SnapEntry));
+    free(dirs);
+
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.format = SNAP_FORMAT;
+    h.node_size = sizeof(struct Node);
+    snprintf(h.version, sizeof(h.version), "%s", MYSHELL_VERSION);
+    h.total_size = w.len;
+    memcpy(w.buf, &h, sizeof(h));
+
+    int ok = cache_write_file(path, w.buf, w.len);
+    if (!ok) fprintf(stderr, "myshell: snapshot: %s: %s\n", path, strerror(errno));
+    free(w.buf);
+    return ok;
+}
+
+// The string at offset off, or NULL (l->bad set) if it does not end
+// inside the file.
+static const char *str_at(struct Loader *l, uint64_t off) {
+    if (off == 0) return NULL;
+    const char *s = cache_reloc(l, (void *)(uintptr_t)off, 1);
+    if (s && !memchr(s, '\0', l->len - off)) l->bad = 1;
+    return l->bad ? NULL : s;
+}
+
+// Check every entry of the mapped snapshot and relocate the function
+// bodies, before anything is installed.
+static int check_snapshot(struct Loader *l, struct SnapHeader *h, struct SnapEntry **sect) {
+    for (int s = 0; s < SECT_COUNT; s++) {
+        sect[s] = NULL;
+        if (h->count[s] == 0) continue;
+        sect[s] = cache_reloc(l, (void *)(uintptr_t)h->off[s], h->count[s] * sizeof(struct SnapEntry));
+        for (uint32_t i = 0; sect[s] && i < h->count[s] && !l->bad; i++) {
+            struct SnapEntry *e = &sect[s][i];
+            if (!str_at(l, e->name)) return 0;
+            if (s == SECT_FUNCS) {
+                if (!cache_fix_tree(l, e->value)) return 0;
+            } else if (!str_at(l, e->value) && (s == SECT_ALIASES || s == SECT_PATHS)) {
+                return 0;       // variables may be unset, directories have no value
+            }
+        }
+        if (!sect[s]) return 0;
+    }
+    return !l->bad;
+}
+
+// `myshell --restore FILE`. Returns 0 (with a message) if the file is not
+// a snapshot this shell can use; nothing has been changed then.
+int snapshot_restore(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "myshell: snapshot: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(struct SnapHeader)) {
+        close(fd);
+        fprintf(stderr, "myshell: snapshot: %s: not a snapshot\n", path);
+        return 0;
+    }
+    // Private writable mapping: relocation patches pages copy-on-write
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "myshell: snapshot: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    struct SnapHeader *h = map;
+    struct Loader l = { map, st.st_size, 0 };
+    struct SnapEntry *sect[SECT_COUNT];
+    const int32_t *options = NULL;
+    int valid = memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) == 0 &&
+                h->format == SNAP_FORMAT &&
+                h->node_size == sizeof(struct Node) &&
+                strncmp(h->version, MYSHELL_VERSION, sizeof(h->version)) == 0 &&
+                h->total_size == (uint64_t)st.st_size &&
+                h->noptions == OPT_COUNT;
+    if (valid) options = cache_reloc(&l, (void *)(uintptr_t)h->options_off, OPT_COUNT * sizeof(int32_t));
+    const char *saved_path = valid ? str_at(&l, h->path_off) : NULL;
+    if (!valid || !options || l.bad || !check_snapshot(&l, h, sect)) {
+        munmap(map, st.st_size);
+        fprintf(stderr, "myshell: snapshot: %s: not a snapshot for myshell %s\n", path, MYSHELL_VERSION);
+        return 0;
+    }
+
+    for (int i = 0; i < OPT_COUNT; i++) shell_options[i] = options[i];
+    for (uint32_t i = 0; i < h->count[SECT_VARS]; i++) {
+        struct SnapEntry *e = &sect[SECT_VARS][i];
+        const char *name = l.base + e->name;
+        if (e->value) var_set(name, l.base + e->value, e->n & VAR_EXPORT);
+        else if (e->n & VAR_EXPORT) var_export(name);
+    }
+    for (uint32_t i = 0; i < h->count[SECT_ALIASES]; i++) {
+        struct SnapEntry *e = &sect[SECT_ALIASES][i];
+        struct Symbol *sym = sym_intern(l.base + e->name);
+        free(sym->alias);
+        sym->alias = strdup(l.base + e->value);
+    }
+    for (uint32_t i = 0; i < h->count[SECT_FUNCS]; i++) {
+        struct SnapEntry *e = &sect[SECT_FUNCS][i];
+        function_adopt(l.base + e->name, (struct Node *)(l.base + e->value));
+    }
+    // After the variables: setting PATH empties the command cache. The
+    // locations are only good for the PATH they were found on, which
+    // usually comes from the environment and is not saved with the rest.
+    const char *path_now = var_get("PATH");
+    int same_path = saved_path && path_now ? strcmp(saved_path, path_now) == 0 : saved_path == path_now;
+    for (uint32_t i = 0; same_path && i < h->count[SECT_PATHS]; i++) {
+        struct SnapEntry *e = &sect[SECT_PATHS][i];
+        pathcache_set(l.base + e->name, l.base + e->value, e->n);
+    }
+    for (uint32_t i = 0; i < h->count[SECT_DIRS]; i++) {
+        dir_stack_push(l.base + sect[SECT_DIRS][i].name);
+    }
+    return 1;
+}
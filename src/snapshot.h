@@ -0,0 +1,7 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+int snapshot_save(const char *path);
+int snapshot_restore(const char *path);
+
+#endif
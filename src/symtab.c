@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+#include "arena.h"
+
+// One table for every name the shell resolves itself: builtins, aliases,
+// functions and variables. Open addressing with linear probing over
+// a power-of-two slot array, so a lookup is one hash and usually one cache
+// line, no matter how many thousand aliases an rc file defines. Each slot
+// keeps the full hash, so probes only compare strings when the hashes
+// already match.
+
+#define SYMTAB_MIN_SLOTS 64
+
+struct SymSlot {
+    unsigned int hash;
+    struct Symbol *sym;     // NULL: never used, TOMBSTONE: deleted
+};
+
+static struct Symbol tombstone;
+#define TOMBSTONE (&tombstone)
+
+static struct SymSlot *slots;
+static size_t nslots;
+static size_t nused;        // live symbols plus tombstones
+static size_t nlive;
+static struct Pool sym_pool = POOL_INIT(struct Symbol);
+
+static unsigned int hash_span(const char *s, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Slot holding `name`, or the slot where it would be inserted.
+static struct SymSlot *find_slot(const char *name, size_t len, unsigned int hash) {
+    size_t mask = nslots - 1;
+    struct SymSlot *free_slot = NULL;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        struct SymSlot *s = &slots[i];
+        if (!s->sym) return free_slot ? free_slot : s;
+        if (s->sym == TOMBSTONE) {
+            if (!free_slot) free_slot = s;
+        } else if (s->hash == hash && strncmp(s->sym->name, name, len) == 0 &&
+                   s->sym->name[len] == '\0') {
+            return s;
+        }
+    }
+}
+
+// Rehash into a table sized for the live entries, dropping tombstones.
+static void resize(size_t want) {
+    struct SymSlot *old = slots;
+    size_t old_n = nslots;
+
+    nslots = SYMTAB_MIN_SLOTS;
+    while (nslots < want * 2) nslots *= 2;
+    slots = calloc(nslots, sizeof(struct SymSlot));
+    if (!slots) {
+        fprintf(stderr, "myshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    nused = nlive;
+
+    for (size_t i = 0; i < old_n; i++) {
+        struct Symbol *sym = old[i].sym;
+        if (!sym || sym == TOMBSTONE) continue;
+        size_t mask = nslots - 1, j = sym->hash & mask;
+        while (slots[j].sym) j = (j + 1) & mask;
+        slots[j].hash = sym->hash;
+        slots[j].sym = sym;
+    }
+    free(old);
+}
+
+struct Symbol *sym_lookupn(const char *name, size_t len) {
+    if (!nlive) return NULL;
+    struct SymSlot *s = find_slot(name, len, hash_span(name, len));
+    return s->sym == TOMBSTONE ? NULL : s->sym;
+}
+
+struct Symbol *sym_lookup(const char *name) {
+    return sym_lookupn(name, strlen(name));
+}
+
+// Find or create the entry for `name`. New entries have every kind empty.
+struct Symbol *sym_intern(const char *name) {
+    size_t len = strlen(name);
+    unsigned int hash = hash_span(name, len);
+
+    // Keep the load factor (tombstones included) under 3/4
+    if ((nused + 1) * 4 > nslots * 3) resize(nlive + 1);
+
+    struct SymSlot *s = find_slot(name, len, hash);
+    if (s->sym && s->sym != TOMBSTONE) return s->sym;
+
+    struct Symbol *sym = pool_alloc(&sym_pool);
+    memset(sym, 0, sizeof(*sym));
+    sym->name = strdup(name);
+    sym->hash = hash;
+    if (!s->sym) nused++;
+    s->hash = hash;
+    s->sym = sym;
+    nlive++;
+    return sym;
+}
+
+// Drop the entry if nothing is defined under its name any more.
+void sym_release(struct Symbol *sym) {
+    if (sym->builtin || sym->alias || sym->func || sym->var) return;
+
+    struct SymSlot *s = find_slot(sym->name, strlen(sym->name), sym->hash);
+    s->sym = TOMBSTONE;
+    nlive--;
+    free(sym->name);
+    pool_free(&sym_pool, sym);
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp((*(struct Symbol **)a)->name, (*(struct Symbol **)b)->name);
+}
+
+// Gather the entries matching `pred` into a malloc'd array, in table
+// order. Returns the number of entries.
+int sym_collect_unsorted(int (*pred)(const struct Symbol *), struct Symbol ***out) {
+    struct Symbol **list = malloc((nlive + 1) * sizeof(struct Symbol *));
+    int n = 0;
+    for (size_t i = 0; i < nslots; i++) {
+        struct Symbol *sym = slots[i].sym;
+        if (sym && sym != TOMBSTONE && pred(sym)) list[n++] = sym;
+    }
+    *out = list;
+    return n;
+}
+
+// The same, sorted by name.
+int sym_collect(int (*pred)(const struct Symbol *), struct Symbol ***out) {
+    int n = sym_collect_unsorted(pred, out);
+    qsort(*out, n, sizeof(struct Symbol *), by_name);
+    return n;
+}
+
+size_t sym_count(void) {
+    return nlive;
+}
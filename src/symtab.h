@@ -0,0 +1,31 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+
+typedef int (*builtin_fn)(char **);
+struct Var;
+struct Function;
+
+// Everything the shell knows about one name. A name can be an alias, a
+// function and a builtin at the same time (`alias cd='cd -P'`), or a
+// variable too, so each kind has its own slot; the entry goes away when all
+// of them are empty.
+struct Symbol {
+    char *name;
+    unsigned int hash;
+    builtin_fn builtin;     // NULL if not a builtin
+    char *alias;            // alias text, NULL if not an alias
+    struct Function *func;  // shell function, NULL if none (see executor.c)
+    struct Var *var;        // shell variable, NULL if unset (see vars.c)
+};
+
+struct Symbol *sym_lookup(const char *name);
+struct Symbol *sym_lookupn(const char *name, size_t len);
+struct Symbol *sym_intern(const char *name);
+void sym_release(struct Symbol *sym);
+int sym_collect(int (*pred)(const struct Symbol *), struct Symbol ***out);
+int sym_collect_unsorted(int (*pred)(const struct Symbol *), struct Symbol ***out);
+size_t sym_count(void);
+
+#endif
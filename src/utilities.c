@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "vars.h"
+
+// In-process versions of the small utilities scripts call all the time
+// (echo, printf, test/[, true, false, pwd, basename, dirname, sleep).
+// Each one would otherwise cost a fork and an exec for microseconds of
+// work. They write through stdio; the executor flushes stdout after every
+// builtin so the output stays ordered with that of external commands.
+// `command name` still runs the external binary.
+
+// Write the escape sequence starting after a backslash at *pp and advance
+// past it. `zero_octal` selects echo's \0NNN form over printf's \NNN.
+// Returns 0 after \c, which ends all output.
+static int put_escape(const char **pp, int zero_octal) {
+    const char *p = *pp;
+    int c = *p++;
+    int val, n;
+
+    switch (c) {
+    case 'a': putchar('\a'); break;
+    case 'b': putchar('\b'); break;
+    case 'e': case 'E': putchar('\033'); break;
+    case 'f': putchar('\f'); break;
+    case 'n': putchar('\n'); break;
+    case 'r': putchar('\r'); break;
+    case 't': putchar('\t'); break;
+    case 'v': putchar('\v'); break;
+    case '\\': putchar('\\'); break;
+    case 'c':
+        *pp = p;
+        return 0;
+    case 'x':
+        for (val = 0, n = 0; n < 2 && isxdigit((unsigned char)*p); n++, p++) {
+            val = val * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+        }
+        if (n) putchar(val);
+        else fputs("\\x", stdout);
+        break;
+    case '\0':
+        putchar('\\');
+        p--;
+        break;
+    default:
+        if (c >= '0' && c <= '7' && (!zero_octal || c == '0')) {
+            // printf's \NNN, or echo's \0NNN where the leading 0 does not count
+            int max = zero_octal ? 3 : 2;
+            val = c - '0';
+            for (n = 0; n < max && *p >= '0' && *p <= '7'; n++, p++) val = val * 8 + (*p - '0');
+            putchar(val & 0xff);
+        } else {
+            putchar('\\');
+            putchar(c);
+        }
+        break;
+    }
+    *pp = p;
+    return 1;
+}
+
+int shell_echo(char **args) {
+    int newline = 1, escapes = 0;
+    int i = 1;
+
+    // Only words made entirely of n, e and E are options, as in bash
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        const char *o = args[i] + 1;
+        if (strspn(o, "neE") != strlen(o)) break;
+        for (; *o; o++) {
+            if (*o == 'n') newline = 0;
+            else escapes = (*o == 'e');
+        }
+    }
+
+    for (int first = 1; args[i]; i++, first = 0) {
+        if (!first) putchar(' ');
+        if (!escapes) {
+            fputs(args[i], stdout);
+            continue;
+        }
+        for (const char *p = args[i]; *p; ) {
+            if (*p != '\\') {
+                putchar(*p++);
+                continue;
+            }
+            p++;
+            if (!put_escape(&p, 1)) return 1;
+        }
+    }
+    if (newline) putchar('\n');
+    return 1;
+}
+
+// printf: the argument for a numeric conversion may be a number in any C
+// base, or 'c / "c for the character's code. Bad numbers print as 0.
+static int printf_number(const char *arg, long long *out) {
+    if (*arg == '\'' || *arg == '"') {
+        *out = (unsigned char)arg[1];
+        return 1;
+    }
+    char *end;
+    errno = 0;
+    *out = strtoll(arg, &end, 0);
+    if (*arg == '\0') return 1;
+    if (end == arg || *end != '\0' || errno) {
+        *out = 0;
+        fprintf(stderr, "myshell: printf: %s: invalid number\n", arg);
+        builtin_status = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static double printf_double(const char *arg) {
+    if (*arg == '\'' || *arg == '"') return (unsigned char)arg[1];
+    char *end;
+    double d = strtod(arg, &end);
+    if (*arg && (end == arg || *end != '\0')) {
+        fprintf(stderr, "myshell: printf: %s: invalid number\n", arg);
+        builtin_status = 1;
+    }
+    return d;
+}
+
+// Expand the format once over the arguments starting at args[*ai].
+// Returns 0 if \c in a %b argument ended all output.
+static int printf_once(const char *fmt, char **args, int *ai) {
+    for (const char *p = fmt; *p; ) {
+        if (*p == '\\') {
+            p++;
+            if (!put_escape(&p, 0)) return 0;
+            continue;
+        }
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+
+        // Copy the conversion spec, resolving * widths from the arguments
+        char spec[64];
+        int len = 0;
+        spec[len++] = *p++;
+        while (*p && strchr("-+ #0", *p) && len < 40) spec[len++] = *p++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*p != '.') break;
+                spec[len++] = *p++;
+            }
+            if (*p == '*') {
+                long long v = 0;
+                if (args[*ai]) printf_number(args[(*ai)++], &v);
+                len += snprintf(spec + len, sizeof(spec) - len - 8, "%d", (int)v);
+                p++;
+            } else {
+                while (isdigit((unsigned char)*p) && len < 50) spec[len++] = *p++;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;    // length modifiers mean nothing here
+
+        char conv = *p;
+        if (!conv) {
+            spec[len] = '\0';
+            fputs(spec, stdout);
+            break;
+        }
+        p++;
+
+        const char *arg = args[*ai] ? args[(*ai)++] : NULL;
+        long long num;
+        switch (conv) {
+        case 'd': case 'i':
+            strcpy(spec + len, "lld");
+            printf_number(arg ? arg : "", &num);
+            printf(spec, num);
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            spec[len++] = 'l';
+            spec[len++] = 'l';
+            spec[len++] = conv;
+            spec[len] = '\0';
+            printf_number(arg ? arg : "", &num);
+            printf(spec, (unsigned long long)num);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec[len++] = conv;
+            spec[len] = '\0';
+            printf(spec, arg ? printf_double(arg) : 0.0);
+            break;
+        case 'c':
+            strcpy(spec + len, "c");
+            if (arg && *arg) printf(spec, *arg);
+            else if (len > 1) printf(spec, ' ');
+            break;
+        case 's':
+            strcpy(spec + len, "s");
+            printf(spec, arg ? arg : "");
+            break;
+        case 'b':
+            for (const char *b = arg ? arg : ""; *b; ) {
+                if (*b != '\\') {
+                    putchar(*b++);
+                    continue;
+                }
+                b++;
+                if (!put_escape(&b, 1)) return 0;
+            }
+            break;
+        default:
+            fprintf(stderr, "myshell: printf: %%%c: invalid format character\n", conv);
+            builtin_status = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int shell_printf(char **args) {
+    int ai = 2;
+    if (args[1] && strcmp(args[1], "--") == 0) args++;
+    if (args[1] == NULL) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        builtin_status = 2;
+        return 1;
+    }
+
+    // The format is reused until every argument has been consumed
+    do {
+        int start = ai;
+        if (!printf_once(args[1], args, &ai)) break;
+        if (ai == start) break;
+    } while (args[ai]);
+    return 1;
+}
+
+// test / [ : a recursive-descent evaluator over the argument words.
+//
+//   or      : and ('-o' and)*
+//   and     : not ('-a' not)*
+//   not     : '!' not | primary
+//   primary : '(' or ')' | word binop word | unop word | word
+
+struct TestState {
+    char **argv;
+    int argc;
+    int pos;
+    int error;
+};
+
+static void test_error(struct TestState *t, const char *what, const char *arg) {
+    if (!t->error) {
+        if (arg) fprintf(stderr, "myshell: test: %s: %s\n", arg, what);
+        else fprintf(stderr, "myshell: test: %s\n", what);
+    }
+    t->error = 1;
+}
+
+static int is_binop(const char *s) {
+    static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                 "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+    for (int i = 0; ops[i]; i++) {
+        if (strcmp(s, ops[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int is_unop(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprstuwxzGLOS", s[1]);
+}
+
+static long long test_integer(struct TestState *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (end == s || *end != '\0' || errno) {
+        test_error(t, "integer expression expected", s);
+        return 0;
+    }
+    return v;
+}
+
+static int test_unary(struct TestState *t, char op, const char *arg) {
+    struct stat st;
+
+    switch (op) {
+    case 'z': return arg[0] == '\0';
+    case 'n': return arg[0] != '\0';
+    case 't': return isatty((int)test_integer(t, arg));
+    case 'h': case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    }
+
+    if (stat(arg, &st) != 0) return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+    return 0;
+}
+
+static int mtime_cmp(const char *a, const char *b) {
+    struct stat sa, sb;
+    int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+    if (!ha || !hb) return ha - hb;     // an existing file is newer than a missing one
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec) return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+    if (sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec) return sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int test_binary(struct TestState *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+    if (strcmp(op, "-nt") == 0) return mtime_cmp(a, b) > 0;
+    if (strcmp(op, "-ot") == 0) return mtime_cmp(a, b) < 0;
+    if (strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+               sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+
+    long long x = test_integer(t, a), y = test_integer(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static int test_or(struct TestState *t);
+
+static int test_primary(struct TestState *t) {
+    if (t->pos >= t->argc) {
+        test_error(t, "argument expected", NULL);
+        return 0;
+    }
+    char **v = t->argv + t->pos;
+    int left = t->argc - t->pos;
+
+    // A binary operator in second place wins, so `[ -f = -f ]` compares strings
+    if (left >= 3 && is_binop(v[1])) {
+        t->pos += 3;
+        return test_binary(t, v[0], v[1], v[2]);
+    }
+    if (strcmp(v[0], "(") == 0 && left >= 2) {
+        t->pos++;
+        int r = test_or(t);
+        if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+            test_error(t, "`)' expected", NULL);
+            return 0;
+        }
+        t->pos++;
+        return r;
+    }
+    if (left >= 2 && is_unop(v[0])) {
+        t->pos += 2;
+        return test_unary(t, v[0][1], v[1]);
+    }
+    t->pos++;
+    return v[0][0] != '\0';
+}
+
+static int test_not(struct TestState *t) {
+    if (t->pos < t->argc - 1 && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(struct TestState *t) {
+    int r = test_not(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        r = test_not(t) && r;
+    }
+    return r;
+}
+
+static int test_or(struct TestState *t) {
+    int r = test_and(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        r = test_and(t) || r;
+    }
+    return r;
+}
+
+int shell_test(char **args) {
+    int argc = 0;
+    while (args[argc]) argc++;
+
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[argc - 1], "]") != 0) {
+            fprintf(stderr, "myshell: [: missing `]'\n");
+            builtin_status = 2;
+            return 1;
+        }
+        argc--;
+    }
+
+    struct TestState t = { args + 1, argc - 1, 0, 0 };
+    if (t.argc == 0) {
+        builtin_status = 1;
+        return 1;
+    }
+    int r = test_or(&t);
+    if (!t.error && t.pos < t.argc) test_error(&t, "too many arguments", NULL);
+    builtin_status = t.error ? 2 : !r;
+    return 1;
+}
+
+int shell_true(char **args) {
+    (void)args;
+    return 1;
+}
+
+int shell_false(char **args) {
+    (void)args;
+    builtin_status = 1;
+    return 1;
+}
+
+int shell_pwd(char **args) {
+    int physical = args[1] && strcmp(args[1], "-P") == 0;
+    const char *pwd = var_get("PWD");
+    struct stat a, b;
+
+    // $PWD keeps the path the user took through symlinks, if it is still right
+    if (!physical && pwd && pwd[0] == '/' && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+        a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+        puts(pwd);
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("myshell: pwd");
+        builtin_status = 1;
+        return 1;
+    }
+    puts(cwd);
+    return 1;
+}
+
+int shell_basename(char **args) {
+    if (args[1] && strcmp(args[1], "--") == 0) args++;
+    if (args[1] == NULL) {
+        fprintf(stderr, "basename: missing operand\n");
+        builtin_status = 1;
+        return 1;
+    }
+
+    const char *s = args[1];
+    size_t end = strlen(s);
+    while (end > 1 && s[end - 1] == '/') end--;
+    size_t start = end;
+    while (start > 0 && s[start - 1] != '/') start--;
+    if (end == 1 && s[0] == '/') start = 0;
+
+    // The suffix is only removed if something is left over
+    const char *suffix = args[2];
+    if (suffix && end - start > strlen(suffix) &&
+        memcmp(s + end - strlen(suffix), suffix, strlen(suffix)) == 0) {
+        end -= strlen(suffix);
+    }
+    printf("%.*s\n", (int)(end - start), s + start);
+    return 1;
+}
+
+int shell_dirname(char **args) {
+    if (args[1] && strcmp(args[1], "--") == 0) args++;
+    if (args[1] == NULL) {
+        fprintf(stderr, "dirname: missing operand\n");
+        builtin_status = 1;
+        return 1;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        const char *s = args[i];
+        size_t end = strlen(s);
+        while (end > 1 && s[end - 1] == '/') end--;     // trailing slashes
+        while (end > 0 && s[end - 1] != '/') end--;     // last component
+        if (end == 0) {
+            puts(s[0] == '/' ? "/" : ".");
+            continue;
+        }
+        while (end > 1 && s[end - 1] == '/') end--;     // separating slashes
+        printf("%.*s\n", (int)end, s);
+    }
+    return 1;
+}
+
+static volatile sig_atomic_t sleep_interrupted;
+
+static void sleep_on_sigint(int sig) {
+    (void)sig;
+    sleep_interrupted = 1;
+}
+
+// sleep NUMBER[smhd]... The interactive shell ignores SIGINT, so Ctrl+C is
+// caught for the duration of the sleep and ends it with status 130.
+int shell_sleep(char **args) {
+    double total = 0;
+
+    if (args[1] == NULL) {
+        fprintf(stderr, "sleep: missing operand\n");
+        builtin_status = 1;
+        return 1;
+    }
+    for (int i = 1; args[i]; i++) {
+        char *end;
+        double v = strtod(args[i], &end);
+        double unit = 1;
+        if (*end && !end[1]) {
+            switch (*end) {
+            case 's': unit = 1; end++; break;
+            case 'm': unit = 60; end++; break;
+            case 'h': unit = 3600; end++; break;
+            case 'd': unit = 86400; end++; break;
+            }
+        }
+        if (end == args[i] || *end || v < 0 || isnan(v)) {
+            fprintf(stderr, "myshell: sleep: invalid time interval '%s'\n", args[i]);
+            builtin_status = 1;
+            return 1;
+        }
+        total += v * unit;
+    }
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sleep_on_sigint;
+    sigemptyset(&sa.sa_mask);
+    sleep_interrupted = 0;
+    sigaction(SIGINT, &sa, &old);
+
+    struct timespec ts;
+    ts.tv_sec = total >= (double)LONG_MAX ? LONG_MAX : (time_t)total;
+    ts.tv_nsec = (long)((total - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec < 0 || ts.tv_nsec > 999999999) ts.tv_nsec = 0;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR && !sleep_interrupted) continue;
+
+    sigaction(SIGINT, &old, NULL);
+    if (sleep_interrupted) {
+        putchar('\n');
+        builtin_status = 130;
+    }
+    return 1;
+}
@@ -0,0 +1,252 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vars.h"
+#include "symtab.h"
+#include "arena.h"
+#include "pathcache.h"
+
+// Shell variables. Each one hangs off its name's entry in the symbol table,
+// so `$NAME` costs one hash lookup instead of getenv()'s walk over environ.
+// Values are kept as "NAME=value" strings, ready to go into an envp array.
+//
+// The shell never touches environ itself (the prompt worker thread reads
+// it). Launched commands get vars_environ() instead, an array of the
+// exported variables that is only rebuilt when the exported set has changed
+// since the last launch: vars_generation counts those changes.
+
+unsigned long vars_generation = 1;
+
+static struct Pool var_pool = POOL_INIT(struct Var);
+static char **envp;
+static unsigned long envp_generation;
+
+// Import the environment the shell was started with, all exported.
+void vars_init(char **env) {
+    for (char **e = env; *e; e++) {
+        char *eq = strchr(*e, '=');
+        if (eq && eq > *e) var_setn(*e, eq - *e, eq + 1, VAR_EXPORT | VAR_ENV);
+    }
+}
+
+const char *var_getn(const char *name, size_t len) {
+    struct Symbol *sym = sym_lookupn(name, len);
+    return sym && sym->var ? sym->var->value : NULL;
+}
+
+const char *var_get(const char *name) {
+    return var_getn(name, strlen(name));
+}
+
+// Length of the variable name at the start of s (within len bytes), 0 if
+// it does not start with one.
+int var_name_len(const char *s, size_t len) {
+    size_t i = 0;
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_')) return 0;
+    while (i < len && (isalnum((unsigned char)s[i]) || s[i] == '_')) i++;
+    return i;
+}
+
+static struct Var *var_slot(struct Symbol *sym) {
+    if (!sym->var) {
+        sym->var = pool_alloc(&var_pool);
+        memset(sym->var, 0, sizeof(*sym->var));
+    }
+    return sym->var;
+}
+
+static void var_changed(struct Symbol *sym, int was_exported) {
+    if (was_exported || (sym->var && (sym->var->flags & VAR_EXPORT))) vars_generation++;
+    // Cached command locations are only valid for the old PATH
+    if (strcmp(sym->name, "PATH") == 0) pathcache_clear();
+}
+
+// Set a variable, adding `flags` to the ones it already has: assigning to
+// an exported variable keeps it exported. It is no longer VAR_ENV.
+void var_setn(const char *name, size_t len, const char *value, int flags) {
+    char stack[64];
+    char *key = len < sizeof(stack) ? stack : malloc(len + 1);
+    memcpy(key, name, len);
+    key[len] = '\0';
+    struct Symbol *sym = sym_intern(key);
+    if (key != stack) free(key);
+
+    struct Var *v = var_slot(sym);
+    int was_exported = v->str && (v->flags & VAR_EXPORT);
+    size_t vlen = strlen(value);
+    char *str = malloc(len + vlen + 2);
+    memcpy(str, sym->name, len);
+    str[len] = '=';
+    memcpy(str + len + 1, value, vlen + 1);
+    free(v->str);
+    v->str = str;
+    v->value = str + len + 1;
+    v->flags = (v->flags & ~VAR_ENV) | flags;
+    var_changed(sym, was_exported);
+}
+
+void var_set(const char *name, const char *value, int flags) {
+    var_setn(name, strlen(name), value, flags);
+}
+
+void var_unset(const char *name) {
+    struct Symbol *sym = sym_lookup(name);
+    if (!sym || !sym->var) return;
+    int was_exported = sym->var->str && (sym->var->flags & VAR_EXPORT);
+    free(sym->var->str);
+    pool_free(&var_pool, sym->var);
+    sym->var = NULL;
+    var_changed(sym, was_exported);
+    sym_release(sym);
+}
+
+// `export NAME`: without a value yet, it enters the environment once set.
+void var_export(const char *name) {
+    struct Var *v = var_slot(sym_intern(name));
+    if (v->flags & VAR_EXPORT) return;
+    v->flags |= VAR_EXPORT;
+    if (v->str) vars_generation++;
+}
+
+static int is_exported(const struct Symbol *sym) {
+    return sym->var && sym->var->str && (sym->var->flags & VAR_EXPORT);
+}
+
+// The environment for launched commands. The array belongs to vars.c and
+// stays valid until the next call.
+char **vars_environ(void) {
+    if (envp && envp_generation == vars_generation) return envp;
+
+    // Programs do not care about the order
+    struct Symbol **list;
+    int n = sym_collect_unsorted(is_exported, &list);
+    free(envp);
+    envp = malloc((n + 1) * sizeof(char *));
+    for (int i = 0; i < n; i++) envp[i] = list[i]->var->str;
+    envp[n] = NULL;
+    free(list);
+    envp_generation = vars_generation;
+    return envp;
+}
+
+static int same_name(const char *a, const char *b) {
+    while (*a == *b && *a != '=') a++, b++;
+    return *a == '=' && *b == '=';
+}
+
+// The environment plus per-command "NAME=value" assignments, which replace
+// exported variables of the same name. The caller frees the array (not
+// the strings) once the command is launched.
+char **vars_environ_with(char **assigns) {
+    char **base = vars_environ();
+    int nbase = 0, nassign = 0;
+    while (base[nbase]) nbase++;
+    while (assigns[nassign]) nassign++;
+
+    char **env = malloc((nbase + nassign + 1) * sizeof(char *));
+    int n = 0;
+    for (int i = 0; i < nbase; i++) {
+        int replaced = 0;
+        for (int j = 0; j < nassign && !replaced; j++) replaced = same_name(base[i], assigns[j]);
+        if (!replaced) env[n++] = base[i];
+    }
+    // The last assignment to a name wins
+    for (int j = 0; j < nassign; j++) {
+        int replaced = 0;
+        for (int k = j + 1; k < nassign && !replaced; k++) replaced = same_name(assigns[j], assigns[k]);
+        if (!replaced) env[n++] = assigns[j];
+    }
+    env[n] = NULL;
+    return env;
+}
+
+// Remember what name (of len bytes) is now, for restore_var() to put back.
+static void save_var(struct VarSave *s, const char *name, size_t len) {
+    struct Symbol *sym = sym_lookupn(name, len);
+    s->name = strndup(name, len);
+    s->existed = 0;
+    s->value = NULL;
+    if (sym && sym->var) {
+        s->existed = 1;
+        s->flags = sym->var->flags;
+        s->value = sym->var->str ? strdup(sym->var->value) : NULL;
+    }
+}
+
+static void restore_var(struct VarSave *s) {
+    if (!s->existed) {
+        var_unset(s->name);
+    } else {
+        // It may have been unset meanwhile
+        struct Symbol *sym = sym_intern(s->name);
+        struct Var *v = var_slot(sym);
+        int was_exported = v->str && (v->flags & VAR_EXPORT);
+        free(v->str);
+        v->str = NULL;
+        v->value = NULL;
+        if (s->value) var_set(s->name, s->value, 0);
+        v->flags = s->flags;
+        var_changed(sym, was_exported);
+    }
+    free(s->name);
+    free(s->value);
+}
+
+// Apply "NAME=value" assignments, exported, for the length of one builtin.
+// Returns what vars_pop() needs to undo them.
+struct VarSave *vars_push(char **assigns) {
+    int n = 0;
+    while (assigns[n]) n++;
+    struct VarSave *saved = calloc(n + 1, sizeof(struct VarSave));
+    for (int i = 0; i < n; i++) {
+        const char *eq = strchr(assigns[i], '=');
+        save_var(&saved[i], assigns[i], eq - assigns[i]);
+        var_setn(assigns[i], eq - assigns[i], eq + 1, VAR_EXPORT);
+    }
+    return saved;
+}
+
+void vars_pop(struct VarSave *saved) {
+    int n = 0;
+    while (saved[n].name) n++;
+    // Backwards, so a name assigned twice gets its original value back
+    while (n-- > 0) restore_var(&saved[n]);
+    free(saved);
+}
+
+// Function locals: `local NAME` saves the variable on a stack that the
+// function call unwinds to its frame mark when it returns.
+static struct VarSave *locals;
+static int nlocals, locals_cap;
+
+int vars_frame(void) {
+    return nlocals;
+}
+
+void var_local(const char *name) {
+    if (nlocals == locals_cap) {
+        locals_cap = locals_cap ? locals_cap * 2 : 16;
+        locals = realloc(locals, locals_cap * sizeof(*locals));
+    }
+    save_var(&locals[nlocals++], name, strlen(name));
+}
+
+void vars_unwind(int mark) {
+    while (nlocals > mark) restore_var(&locals[--nlocals]);
+}
+
+// `export` with no arguments, in a form the shell can read back.
+void vars_print_exported(void) {
+    struct Symbol **list;
+    int n = sym_collect(is_exported, &list);
+    for (int i = 0; i < n; i++) {
+        printf("export %s='", list[i]->name);
+        for (const char *p = list[i]->var->value; *p; p++) {
+            if (*p == '\'') fputs("'\\''", stdout);
+            else putchar(*p);
+        }
+        printf("'\n");
+    }
+    free(list);
+}
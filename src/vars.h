@@ -0,0 +1,44 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+
+#define VAR_EXPORT 1       // passed to the environment of launched commands
+#define VAR_ENV 2          // still the value the shell's environment gave it
+
+// A shell variable, hung off its name's entry in the symbol table.
+struct Var {
+    char *str;              // "NAME=value", NULL while declared but unset
+    const char *value;      // points into str
+    int flags;
+};
+
+// What vars_push() replaced, for vars_pop() to put back.
+struct VarSave {
+    char *name;             // NULL ends the list
+    char *value;            // NULL if it was unset
+    int flags;
+    int existed;
+};
+
+void vars_init(char **env);
+const char *var_get(const char *name);
+const char *var_getn(const char *name, size_t len);
+void var_set(const char *name, const char *value, int flags);
+void var_setn(const char *name, size_t len, const char *value, int flags);
+void var_unset(const char *name);
+void var_export(const char *name);
+int var_name_len(const char *s, size_t len);
+
+char **vars_environ(void);
+char **vars_environ_with(char **assigns);
+struct VarSave *vars_push(char **assigns);
+void vars_pop(struct VarSave *saved);
+int vars_frame(void);
+void var_local(const char *name);
+void vars_unwind(int mark);
+void vars_print_exported(void);
+
+extern unsigned long vars_generation;
+
+#endif